@@ -0,0 +1,134 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/BloomFilter.h"
+#include <cstring>
+
+
+namespace cardinality {
+
+BloomFilter::BloomFilter(const ValueType t, const std::size_t num_values)
+    : type_(t),
+      words_(),
+      mask_()
+{
+    std::size_t num_words = 1;
+    while (num_words * 64 < num_values * BITS_PER_VALUE) {
+        num_words <<= 1;
+    }
+    words_.resize(num_words);
+    mask_ = num_words - 1;
+}
+
+BloomFilter::BloomFilter(google::protobuf::io::CodedInputStream *input)
+    : type_(),
+      words_(),
+      mask_()
+{
+    Deserialize(input);
+}
+
+BloomFilter::~BloomFilter()
+{
+}
+
+// Four bits are chosen by the upper bits of the hash value,
+// and the word by the lower bits.
+void BloomFilter::insert(const Chunk &c)
+{
+    uint64_t h = hash(c);
+    words_[h & mask_] |= (1ULL << ((h >> 40) & 63))
+                         | (1ULL << ((h >> 46) & 63))
+                         | (1ULL << ((h >> 52) & 63))
+                         | (1ULL << ((h >> 58) & 63));
+}
+
+bool BloomFilter::mayContain(const Chunk &c) const
+{
+    uint64_t h = hash(c);
+    uint64_t bits = (1ULL << ((h >> 40) & 63))
+                    | (1ULL << ((h >> 46) & 63))
+                    | (1ULL << ((h >> 52) & 63))
+                    | (1ULL << ((h >> 58) & 63));
+    return (words_[h & mask_] & bits) == bits;
+}
+
+uint8_t *BloomFilter::SerializeToArray(uint8_t *target) const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    target = CodedOutputStream::WriteVarint32ToArray(type_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(words_.size(), target);
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+        target = CodedOutputStream::WriteLittleEndian64ToArray(words_[i],
+                                                               target);
+    }
+
+    return target;
+}
+
+int BloomFilter::ByteSize() const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    int total_size = 1;
+
+    total_size += CodedOutputStream::VarintSize32(words_.size());
+    total_size += 8 * words_.size();
+
+    return total_size;
+}
+
+void BloomFilter::Deserialize(google::protobuf::io::CodedInputStream *input)
+{
+    uint32_t temp;
+    input->ReadVarint32(&temp);
+    type_ = static_cast<ValueType>(temp);
+
+    input->ReadVarint32(&temp);
+    words_.resize(temp);
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+        google::protobuf::uint64 word;
+        input->ReadLittleEndian64(&word);
+        words_[i] = word;
+    }
+    mask_ = words_.size() - 1;
+}
+
+double BloomFilter::estByteSize(const double num_values)
+{
+    return num_values * BITS_PER_VALUE / 8;
+}
+
+uint64_t BloomFilter::hash(const Chunk &c) const
+{
+    return Operator::finishHash(Operator::hashValue(c, type_));
+}
+
+}  // namespace cardinality
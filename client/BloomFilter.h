@@ -0,0 +1,89 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_BLOOMFILTER_H_
+#define CARDINALITY_BLOOMFILTER_H_
+
+#include <vector>
+#include <google/protobuf/io/coded_stream.h>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Represent a register-blocked Bloom filter on join values.
+// All bits for a value are set in a single 64-bit word, so that a lookup
+// touches only one cache line.
+class BloomFilter {
+public:
+    typedef boost::shared_ptr<const BloomFilter> Ptr;
+
+    // constructor called by HashJoin at the join node
+    BloomFilter(const ValueType, const std::size_t);
+
+    // constructor called by Connection::handle_query() at remote nodes
+    explicit BloomFilter(google::protobuf::io::CodedInputStream *);
+
+    // destructor
+    ~BloomFilter();
+
+    // filter operations
+    void insert(const Chunk &);
+    bool mayContain(const Chunk &) const;
+
+    // serialization
+    uint8_t *SerializeToArray(uint8_t *target) const;
+    int ByteSize() const;
+    void Deserialize(google::protobuf::io::CodedInputStream *);
+
+    // cost estimation
+    static double estByteSize(const double);
+
+    // constants
+    static const double FALSE_POSITIVE_RATE = 0.01;
+
+private:
+    // non-copyable
+    BloomFilter(const BloomFilter &);
+    BloomFilter& operator=(const BloomFilter &);
+
+    // Returns a hash value of the given join value.
+    uint64_t hash(const Chunk &) const;
+
+    ValueType type_;
+    std::vector<uint64_t> words_;
+    uint64_t mask_;
+
+    // constants
+    static const int BITS_PER_VALUE = 16;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_BLOOMFILTER_H_
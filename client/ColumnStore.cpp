@@ -0,0 +1,497 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/ColumnStore.h"
+#include <cstdio>
+#include <algorithm>  // std::sort, std::min, std::max
+#include <stdexcept>  // std::runtime_error
+#include <boost/filesystem/operations.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
+#include "client/IOManager.h"
+#include "client/PartStats.h"
+#include "client/Tokenizer.h"
+
+
+namespace cardinality {
+
+// header of the meta file, which is written after all the other files
+struct StoreMeta {
+    uint64_t file_size;
+    int64_t file_time;
+    uint32_t num_rows;
+    uint32_t num_cols;
+};
+
+ColumnStore::ColumnStore()
+    : num_rows_(),
+      num_zones_(),
+      col_kinds_(),
+      offsets_(),
+      values_(), heaps_(), zones_(),
+      files_()
+{
+}
+
+ColumnStore::~ColumnStore()
+{
+}
+
+// A store consists of the file offsets of rows ("rows"), the values of
+// each column ("c<id>"), the heap of each string column ("c<id>.heap"),
+// and the zone map of each column ("c<id>.zones"). String columns have
+// one more offset at the end.
+bool ColumnStore::build(const std::string &filename,
+                        const std::vector<ValueType> &types,
+                        const std::vector<uint32_t> &priorities,
+                        PartStats *stats,
+                        const boost::system_time &deadline)
+{
+    namespace fs = boost::filesystem;
+
+    // a store of a previous run may be out of date
+    std::string dir = getStoreDir(filename);
+    boost::system::error_code ec;
+    fs::remove_all(dir, ec);
+
+    // choose columns in the order of priority within the space limit
+    std::vector<std::pair<uint32_t, ColID> > cands;
+    for (std::size_t i = 0; i < priorities.size(); ++i) {
+        if (priorities[i] > 0) {
+            cands.push_back(std::make_pair(priorities[i], i));
+        }
+    }
+    std::sort(cands.rbegin(), cands.rend());
+
+    double est_rows = stats->num_distinct_values_[0];
+    uint64_t est_zones = stats->num_pages_ * 4096 / ZONE_SIZE + 1;
+    uint64_t est_size = static_cast<uint64_t>(8 * (est_rows + 1));
+    std::vector<uint8_t> kinds(types.size(), COL_NONE);
+    std::size_t num_cols = 0;
+    ColID last_col = 0;
+    IOManager *io = IOManager::instance();
+    if (!io->reserveSpace(est_size)) {
+        return false;
+    }
+    for (std::size_t k = 0; k < cands.size(); ++k) {
+        ColID cid = cands[k].second;
+        uint64_t col_size = static_cast<uint64_t>(4 * (est_rows + 1))
+                            + 8 * est_zones;
+        if (types[cid] == STRING) {
+            col_size += static_cast<uint64_t>(
+                            stats->col_lengths_[cid] * est_rows);
+        }
+        if (io->reserveSpace(col_size)) {
+            est_size += col_size;
+            kinds[cid] = (types[cid] == INT) ? COL_INT : COL_STRING;
+            last_col = std::max(last_col, cid);
+            ++num_cols;
+        }
+    }
+    if (num_cols == 0) {
+        io->releaseSpace(est_size);
+        return false;
+    }
+
+    // open output files
+    fs::create_directories(dir, ec);
+    std::vector<std::FILE *> outs(2 * types.size() + 1);
+    bool ok = (outs[0] = std::fopen((dir + "/rows").c_str(), "wb")) != NULL;
+    for (std::size_t i = 0; ok && i < types.size(); ++i) {
+        if (kinds[i] == COL_NONE) {
+            continue;
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "/c%u", static_cast<unsigned>(i));
+        ok = (outs[2 * i + 1] = std::fopen((dir + name).c_str(), "wb"));
+        if (ok && kinds[i] == COL_STRING) {
+            std::snprintf(name, sizeof(name), "/c%u.heap",
+                          static_cast<unsigned>(i));
+            ok = (outs[2 * i + 2] = std::fopen((dir + name).c_str(), "wb"));
+        }
+    }
+
+    // convert rows
+    boost::iostreams::mapped_file_source file(filename);
+    uint32_t num_zones = (file.size() + ZONE_SIZE - 1) / ZONE_SIZE;
+    std::vector<std::vector<uint32_t> > zones(types.size());
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        if (kinds[i] == COL_NONE) {
+            continue;
+        }
+        zones[i].resize(2 * num_zones);
+        for (uint32_t z = 0; z < num_zones; ++z) {
+            zones[i][2 * z] = 0xffffffff;
+        }
+    }
+    std::vector<uint64_t> heap_sizes(types.size());
+    std::vector<const char *> delims(last_col + 1);
+    uint32_t num_rows = 0;
+    const char *pos = file.begin();
+
+    for (; ok && pos < file.end(); ++num_rows) {
+        if (num_rows % STORE_CHECK_INTERVAL == 0
+            && boost::get_system_time() > deadline) {
+            ok = false;
+            break;
+        }
+
+        uint64_t offset = pos - file.begin();
+        ok = std::fwrite(&offset, sizeof(offset), 1, outs[0]) == 1;
+        uint32_t zone = offset / ZONE_SIZE;
+
+        const char *next = splitLine(pos, file.end(), last_col + 1, '\n',
+                                     &delims[0]);
+        if (next == NULL) {
+            ok = false;
+            break;
+        }
+
+        for (ColID i = 0; ok && i <= last_col; ++i) {
+            Chunk value(pos, delims[i] - pos);
+            pos = delims[i] + 1;
+
+            if (kinds[i] == COL_NONE) {
+                continue;
+            }
+
+            uint32_t key = getZoneKey(types[i], value);
+            zones[i][2 * zone] = std::min(zones[i][2 * zone], key);
+            zones[i][2 * zone + 1] = std::max(zones[i][2 * zone + 1], key);
+
+            if (kinds[i] == COL_INT) {
+                ok = std::fwrite(&key, sizeof(key), 1, outs[2 * i + 1]) == 1;
+            } else {  // COL_STRING
+                uint32_t heap_offset = heap_sizes[i];
+                heap_sizes[i] += value.second;
+                ok = heap_sizes[i] <= 0xffffffffULL
+                     && std::fwrite(&heap_offset, sizeof(heap_offset), 1,
+                                    outs[2 * i + 1]) == 1
+                     && std::fwrite(value.first, 1, value.second,
+                                    outs[2 * i + 2]) == value.second;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+
+        // skip the rest of the line
+        if (*delims[last_col] != '\n') {
+            pos = 1 + static_cast<const char *>(rawmemchr(pos, '\n'));
+        }
+    }
+
+    if (ok) {
+        uint64_t offset = file.size();
+        ok = std::fwrite(&offset, sizeof(offset), 1, outs[0]) == 1;
+        for (std::size_t i = 0; ok && i < types.size(); ++i) {
+            if (kinds[i] == COL_STRING) {
+                uint32_t heap_offset = heap_sizes[i];
+                ok = std::fwrite(&heap_offset, sizeof(heap_offset), 1,
+                                 outs[2 * i + 1]) == 1;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; ok && i < types.size(); ++i) {
+        if (kinds[i] == COL_NONE) {
+            continue;
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "/c%u.zones",
+                      static_cast<unsigned>(i));
+        std::FILE *out = std::fopen((dir + name).c_str(), "wb");
+        ok = out
+             && (zones[i].empty()
+                 || std::fwrite(&zones[i][0], sizeof(uint32_t),
+                                zones[i].size(), out) == zones[i].size());
+        ok = out && !std::fclose(out) && ok;
+    }
+
+    // fclose() may not report errors of earlier flushes
+    for (std::size_t i = 0; i < outs.size(); ++i) {
+        if (outs[i] == NULL) {
+            continue;
+        }
+        if (std::ferror(outs[i])) {
+            ok = false;
+        }
+        if (std::fclose(outs[i])) {
+            ok = false;
+        }
+    }
+
+    // the meta file marks the store complete
+    if (ok) {
+        StoreMeta meta;
+        meta.file_size = file.size();
+        meta.file_time = fs::last_write_time(filename);
+        meta.num_rows = num_rows;
+        meta.num_cols = types.size();
+
+        std::FILE *out = std::fopen((dir + "/meta.tmp").c_str(), "wb");
+        ok = out
+             && std::fwrite(&meta, sizeof(meta), 1, out) == 1
+             && std::fwrite(&kinds[0], 1, kinds.size(), out) == kinds.size();
+        ok = out && !std::fclose(out) && ok;
+        if (ok) {
+            fs::rename(dir + "/meta.tmp", dir + "/meta", ec);
+            ok = !ec;
+        }
+    }
+
+    // keep the space for the actual size, and discard the store if it
+    // exceeds the estimate by more than the space left
+    uint64_t size = 8 * (static_cast<uint64_t>(num_rows) + 1);
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        if (kinds[i] != COL_NONE) {
+            size += 4 * (static_cast<uint64_t>(num_rows) + 1) + heap_sizes[i]
+                    + 4 * zones[i].size();
+        }
+    }
+
+    if (ok && size > est_size && io->reserveSpace(size - est_size)) {
+        est_size = size;
+    }
+
+    if (ok && size <= est_size) {
+        summarizeZones(zones, num_zones, stats);
+        io->releaseSpace(est_size - size);
+    } else {
+        io->releaseSpace(est_size);
+        fs::remove_all(dir, ec);
+        ok = false;
+    }
+
+    return ok;
+}
+
+ColumnStore::Ptr ColumnStore::open(const std::string &filename)
+{
+    namespace fs = boost::filesystem;
+
+    std::string dir = getStoreDir(filename);
+
+    StoreMeta meta;
+    std::vector<uint8_t> kinds;
+    std::FILE *in = std::fopen((dir + "/meta").c_str(), "rb");
+    if (in == NULL) {
+        return Ptr();
+    }
+    bool ok = std::fread(&meta, sizeof(meta), 1, in) == 1;
+    if (ok) {
+        kinds.resize(meta.num_cols);
+        ok = std::fread(&kinds[0], 1, kinds.size(), in) == kinds.size();
+    }
+    std::fclose(in);
+
+    boost::system::error_code ec;
+    if (!ok
+        || meta.file_size != fs::file_size(filename, ec)
+        || meta.file_time != fs::last_write_time(filename, ec)) {
+        return Ptr();
+    }
+
+    boost::shared_ptr<ColumnStore> store(new ColumnStore());
+    store->num_rows_ = meta.num_rows;
+    store->col_kinds_.swap(kinds);
+    store->num_zones_ = (meta.file_size + ZONE_SIZE - 1) / ZONE_SIZE;
+    store->values_.resize(meta.num_cols);
+    store->heaps_.resize(meta.num_cols);
+    store->zones_.resize(meta.num_cols);
+
+    // files of unexpected sizes, e.g., truncated by a full disk, are
+    // rejected because scans do not check bounds
+    uint64_t num_rows = meta.num_rows;
+    try {
+        store->offsets_ = reinterpret_cast<const uint64_t *>(
+                              store->mapFile(dir + "/rows",
+                                             8 * (num_rows + 1)));
+        for (std::size_t i = 0; i < meta.num_cols; ++i) {
+            if (store->col_kinds_[i] == COL_NONE) {
+                continue;
+            }
+            bool is_string = store->col_kinds_[i] == COL_STRING;
+            char name[32];
+            std::snprintf(name, sizeof(name), "/c%u",
+                          static_cast<unsigned>(i));
+            store->values_[i] = reinterpret_cast<const uint32_t *>(
+                                    store->mapFile(dir + name,
+                                                   4 * (num_rows
+                                                        + is_string)));
+            std::snprintf(name, sizeof(name), "/c%u.zones",
+                          static_cast<unsigned>(i));
+            store->zones_[i] = reinterpret_cast<const uint32_t *>(
+                                   store->mapFile(dir + name,
+                                                  8ULL * store->num_zones_));
+            if (is_string) {
+                std::snprintf(name, sizeof(name), "/c%u.heap",
+                              static_cast<unsigned>(i));
+                store->heaps_[i] = store->mapFile(
+                                       dir + name,
+                                       store->values_[i][num_rows]);
+            }
+        }
+    } catch (...) {
+        return Ptr();
+    }
+
+    return store;
+}
+
+uint32_t ColumnStore::numRows() const
+{
+    return num_rows_;
+}
+
+bool ColumnStore::hasCol(const ColID cid) const
+{
+    return col_kinds_[cid] != COL_NONE;
+}
+
+uint32_t ColumnStore::getInt(const ColID cid, const uint32_t row) const
+{
+    return values_[cid][row];
+}
+
+Chunk ColumnStore::getString(const ColID cid, const uint32_t row) const
+{
+    return Chunk(heaps_[cid] + values_[cid][row],
+                 values_[cid][row + 1] - values_[cid][row]);
+}
+
+uint64_t ColumnStore::getOffset(const uint32_t row) const
+{
+    return offsets_[row];
+}
+
+uint32_t ColumnStore::findRow(const uint64_t offset) const
+{
+    return std::lower_bound(offsets_, offsets_ + num_rows_, offset)
+           - offsets_;
+}
+
+uint32_t ColumnStore::numZones() const
+{
+    return num_zones_;
+}
+
+std::pair<uint32_t, uint32_t> ColumnStore::getZone(const ColID cid,
+                                                   const uint32_t zone) const
+{
+    return std::make_pair(zones_[cid][2 * zone], zones_[cid][2 * zone + 1]);
+}
+
+// A STRING key is padded with zero bytes, so that the keys of strings are
+// in the same order as the strings, though distinct strings may share a
+// key.
+uint32_t ColumnStore::getZoneKey(const ValueType type, const Chunk &value)
+{
+    if (type == INT) {
+        return Operator::parseInt(&value);
+    }
+
+    uint32_t key = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        key <<= 8;
+        if (i < value.second) {
+            key |= static_cast<uint8_t>(value.first[i]);
+        }
+    }
+    return key;
+}
+
+// A STRING value greater than the constant may have the same key, while
+// an INT value must have a greater key.
+bool ColumnStore::matchZone(const std::pair<uint32_t, uint32_t> &zone,
+                            const Value *constant, const bool greater)
+{
+    if (zone.first > zone.second) {
+        return false;
+    }
+
+    uint32_t key = constant->intVal;
+    if (constant->type == STRING) {
+        key = getZoneKey(STRING, Chunk(constant->charVal, constant->intVal));
+    }
+
+    if (greater) {
+        return (constant->type == INT) ? key < zone.second
+                                       : key <= zone.second;
+    }
+    return zone.first <= key && key <= zone.second;
+}
+
+// Merge adjacent zones so that PartStats keeps at most STATS_NUM_ZONES
+// zones of each column.
+void ColumnStore::summarizeZones(
+    const std::vector<std::vector<uint32_t> > &zones,
+    const uint32_t num_zones, PartStats *stats)
+{
+    uint32_t merge = (num_zones + STATS_NUM_ZONES - 1) / STATS_NUM_ZONES;
+
+    stats->zones_.clear();
+    stats->zones_.resize(zones.size());
+    for (std::size_t i = 0; i < zones.size(); ++i) {
+        for (uint32_t z = 0; !zones[i].empty() && z < num_zones; ++z) {
+            std::pair<uint32_t, uint32_t> zone(zones[i][2 * z],
+                                               zones[i][2 * z + 1]);
+            if (z % merge == 0) {
+                stats->zones_[i].push_back(zone);
+            } else {
+                std::pair<uint32_t, uint32_t> &last = stats->zones_[i].back();
+                last.first = std::min(last.first, zone.first);
+                last.second = std::max(last.second, zone.second);
+            }
+        }
+    }
+}
+
+std::string ColumnStore::getStoreDir(const std::string &filename)
+{
+    std::string dir(filename);
+    std::replace(dir.begin(), dir.end(), '/', '_');
+    return std::string(IOManager::SPACE_DIR) + "/store_" + dir;
+}
+
+const char *ColumnStore::mapFile(const std::string &filename,
+                                 const uint64_t size)
+{
+    if (boost::filesystem::file_size(filename) != size) {
+        throw std::runtime_error(filename);
+    }
+    if (size == 0) {
+        return NULL;
+    }
+
+    files_.push_back(
+        boost::make_shared<boost::iostreams::mapped_file_source>(filename));
+    return files_.back()->data();
+}
+
+}  // namespace cardinality
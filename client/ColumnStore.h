@@ -0,0 +1,147 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_COLUMNSTORE_H_
+#define CARDINALITY_COLUMNSTORE_H_
+
+#include <string>
+#include <vector>
+#include <utility>  // std::pair
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+class PartStats;
+
+// Represent a binary columnar copy of some columns of a partition, built
+// during pretreatment in IOManager::SPACE_DIR. Integer columns are stored as
+// fixed-width values and string columns as offsets into a heap, so that
+// scans evaluate restrictions without tokenizing lines or parsing
+// digits. The file offset of every row maps row ids to the addresses
+// used by indexes.
+//
+// Each column also has a zone map: the smallest and largest keys of the
+// rows starting in every ZONE_SIZE bytes of the file, so that scans skip
+// zones where no rows can satisfy a restriction without reading them.
+// The key of an INT value is the value, and that of a STRING value is
+// its first 4 bytes in big-endian order.
+class ColumnStore {
+public:
+    typedef boost::shared_ptr<const ColumnStore> Ptr;
+
+    // Build a store for the given partition with the columns of nonzero
+    // priority, the highest first, as long as IOManager::reserveSpace()
+    // allows.
+    // Gives up if the build cannot finish by the given deadline.
+    // Returns true if a store has been built, in which case the zone maps
+    // are also summarized in the given PartStats.
+    static bool build(const std::string &, const std::vector<ValueType> &,
+                      const std::vector<uint32_t> &, PartStats *,
+                      const boost::system_time &);
+
+    // Open the store of the given partition.
+    // Returns NULL if there is no store or it is out of date.
+    // Called by IOManager::openColumnStore().
+    static Ptr open(const std::string &);
+
+    // destructor
+    ~ColumnStore();
+
+    // accessors
+    uint32_t numRows() const;
+    bool hasCol(const ColID) const;
+    uint32_t getInt(const ColID, const uint32_t) const;
+    Chunk getString(const ColID, const uint32_t) const;
+
+    // Map a row id to the file offset of the row, and vice versa.
+    // getOffset(numRows()) returns the file size.
+    uint64_t getOffset(const uint32_t) const;
+    uint32_t findRow(const uint64_t) const;
+
+    // Returns the smallest and largest keys of a column in a zone.
+    // The smallest key is greater than the largest in an empty zone.
+    uint32_t numZones() const;
+    std::pair<uint32_t, uint32_t> getZone(const ColID, const uint32_t) const;
+
+    // Returns the key of the given value in zone maps.
+    static uint32_t getZoneKey(const ValueType, const Chunk &);
+
+    // Returns true if a zone of the given smallest and largest keys may
+    // hold a value equal to (or greater than if the flag is set) the
+    // given constant.
+    static bool matchZone(const std::pair<uint32_t, uint32_t> &,
+                          const Value *, const bool);
+
+    // constants
+    static const uint32_t ZONE_SIZE = 65536;
+    static const uint32_t STATS_NUM_ZONES = 256;  // per column in PartStats
+
+private:
+    // constructor called by open()
+    ColumnStore();
+
+    // non-copyable
+    ColumnStore(const ColumnStore &);
+    ColumnStore& operator=(const ColumnStore &);
+
+    // Returns the directory holding the store of the given partition.
+    static std::string getStoreDir(const std::string &);
+
+    // Map the given file, which may be empty.
+    // Throws an exception unless the file has the given size.
+    const char *mapFile(const std::string &, const uint64_t);
+
+    // Copy coarser zone maps into the given PartStats.
+    static void summarizeZones(const std::vector<std::vector<uint32_t> > &,
+                               const uint32_t, PartStats *);
+
+    // kinds of columns
+    enum { COL_NONE, COL_INT, COL_STRING };
+
+    uint32_t num_rows_;
+    uint32_t num_zones_;
+    std::vector<uint8_t> col_kinds_;
+    const uint64_t *offsets_;
+    std::vector<const uint32_t *> values_;  // values or heap offsets
+    std::vector<const char *> heaps_;
+    std::vector<const uint32_t *> zones_;  // pairs of smallest and largest
+    std::vector<boost::shared_ptr<boost::iostreams::mapped_file_source> >
+        files_;
+
+    // constants
+    static const uint32_t STORE_CHECK_INTERVAL = 65536;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_COLUMNSTORE_H_
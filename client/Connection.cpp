@@ -34,13 +34,17 @@
 #include <cstring>
 #include <algorithm>  // std::max
 #include <boost/thread/thread.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/asio/placeholders.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/asio/streambuf.hpp>
 #include <google/protobuf/wire_format_lite_inl.h>
 #include "client/Operator.h"
+#include "client/IOManager.h"
 #include "client/PartStats.h"
+#include "client/ColumnStore.h"
+#include "client/BloomFilter.h"
 
 
 namespace cardinality {
@@ -87,6 +91,7 @@ void Connection::handle_read(const boost::system::error_code &e,
 
     switch (buffer_[0]) {
     case 'Q':
+    case 'F':
         handler = &Connection::handle_query;
         break;
 
@@ -94,10 +99,18 @@ void Connection::handle_read(const boost::system::error_code &e,
         handler = &Connection::handle_param_query;
         break;
 
+    case 'B':
+        handler = &Connection::handle_lookup_query;
+        break;
+
     case 'S':
         handler = &Connection::handle_stats;
         break;
 
+    case 'W':
+        handler = &Connection::handle_pretreatment;
+        break;
+
     default:
         throw std::runtime_error("unknown command");
     }
@@ -124,54 +137,27 @@ void Connection::handle_query()
     CodedInputStream cis(reinterpret_cast<const uint8_t *>(buf.data()), size);
     Operator::Ptr root = Operator::parsePlan(&cis);
 
-    // execute the query plan and transfer results
-    boost::system::error_code error;
-    Tuple tuple;
-
-    root->Open();
-    while (!root->GetNext(tuple)) {
-        uint32_t tuple_len = 1;
-        for (std::size_t i = 0; i < tuple.size(); i++) {
-            tuple_len += tuple[i].second;
-            if (i < tuple.size() - 1) {
-                ++tuple_len;
-            }
-        }
-
-        buf.resize(tuple_len);
-        char *pos = buf.data();
-        for (std::size_t i = 0; i < tuple.size(); i++) {
-            std::memcpy(pos, tuple[i].first, tuple[i].second);
-            pos += tuple[i].second;
-            if (i < tuple.size() - 1) {
-                *pos++ = '|';
-            }
-        }
-        *pos = '\n';
+    // receive a Bloom filter on an output column (semi-join reduction)
+    if (buffer_[0] == 'F') {
+        uint32_t col_id;
+        boost::asio::read(socket_, boost::asio::buffer(header));
+        CodedInputStream::ReadLittleEndian32FromArray(&header[0], &col_id);
+        boost::asio::read(socket_, boost::asio::buffer(header));
+        CodedInputStream::ReadLittleEndian32FromArray(&header[0], &size);
 
-        boost::asio::write(socket_, boost::asio::buffer(buf),
-                           boost::asio::transfer_all(), error);
-        if (error) {
-            if (error == boost::asio::error::connection_reset) {
-                root->Close();
-                socket_.close();
-                return;
-            }
-            throw boost::system::system_error(error);
-        }
+        buf.resize(size);
+        boost::asio::read(socket_, boost::asio::buffer(buf));
+        CodedInputStream filter_cis(
+            reinterpret_cast<const uint8_t *>(buf.data()), size);
+        root->setBloomFilter(static_cast<ColID>(col_id),
+                             boost::make_shared<BloomFilter>(&filter_cis));
     }
-    root->Close();
 
-    // send a special sequence indicating the end of results
-    char delim[2] = {'|', '\n'};
-    boost::asio::write(socket_, boost::asio::buffer(&delim[0], 2),
-                       boost::asio::transfer_all(), error);
-    if (error) {
-        if (error == boost::asio::error::connection_reset) {
-            socket_.close();
-            return;
-        }
-        throw boost::system::system_error(error);
+    // execute the query plan and transfer results
+    root->Open();
+    if (!send_results(root.get(), false)) {
+        socket_.close();
+        return;
     }
 
     // flush the send buffer
@@ -211,61 +197,195 @@ void Connection::handle_param_query()
     join_value.first = buf.data();
 
     // execute the query plan and transfer results
-    boost::system::error_code error;
+    root->Open(&join_value);
+    if (!send_results(root.get(), false)) {
+        socket_.close();
+        return;
+    }
+
+    // flush the send buffer
+    socket_.set_option(
+        boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_CORK>(0));
+
+    // thread exits, socket waits for another request
+    start();
+}
+
+void Connection::handle_lookup_query()
+{
+    using google::protobuf::io::CodedInputStream;
+
+    // receive a request header
+    uint8_t header[4];
+    uint32_t size;
+    boost::asio::read(socket_, boost::asio::buffer(header));
+    CodedInputStream::ReadLittleEndian32FromArray(&header[0], &size);
+
+    // receive a request body (serialized query plan)
+    std::vector<char> buf(std::max(size, 128u));
+    buf.resize(size);
+    boost::asio::read(socket_, boost::asio::buffer(buf));
+
+    CodedInputStream cis(reinterpret_cast<const uint8_t *>(buf.data()), size);
+    Operator::Ptr root = Operator::parsePlan(&cis);
+
+    // receive parameters (keys for index lookup)
+    uint32_t num_values;
+    boost::asio::read(socket_, boost::asio::buffer(header));
+    CodedInputStream::ReadLittleEndian32FromArray(&header[0], &num_values);
+
+    std::vector<uint32_t> lengths(num_values);
+    std::vector<char> values;
+    for (uint32_t i = 0; i < num_values; ++i) {
+        boost::asio::read(socket_, boost::asio::buffer(header));
+        CodedInputStream::ReadLittleEndian32FromArray(&header[0], &lengths[i]);
+
+        std::size_t offset = values.size();
+        values.resize(offset + lengths[i] + 1);
+        boost::asio::read(socket_,
+                          boost::asio::buffer(&values[offset], lengths[i]));
+    }
+
+    std::vector<Chunk> join_values(num_values);
+    const char *value_pos = values.data();
+    for (uint32_t i = 0; i < num_values; ++i) {
+        join_values[i] = Chunk(value_pos, lengths[i]);
+        value_pos += lengths[i] + 1;
+    }
+
+    // execute the query plan and transfer results
+    root->OpenLookup(join_values);
+    if (!send_results(root.get(), true)) {
+        socket_.close();
+        return;
+    }
+
+    // flush the send buffer
+    socket_.set_option(
+        boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_CORK>(0));
+
+    // thread exits, socket waits for another request
+    start();
+}
+
+// Results are sent in frames, each of which is a LE32 body size followed
+// by as many rows as fit in FRAME_SIZE bytes. A row is a sequence of
+// varint-length-prefixed column values, prefixed by the LE32 position of
+// its join value for a batch request. An empty frame ends the results.
+bool Connection::send_results(Operator *root, const bool lookup)
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    std::vector<uint8_t> frame;
+    frame.reserve(FRAME_SIZE + 4);
+    frame.resize(4);
+
     Tuple tuple;
+    uint32_t lookup_pos = 0;
+    TupleBatch batch;
+    uint32_t batch_pos = 0;
+    bool batch_done = false;
 
-    root->Open(&join_value);
-    while (!root->GetNext(tuple)) {
-        uint32_t tuple_len = 1;
-        for (std::size_t i = 0; i < tuple.size(); i++) {
-            tuple_len += tuple[i].second;
-            if (i < tuple.size() - 1) {
-                ++tuple_len;
+    for (;;) {
+        bool done;
+        if (lookup) {
+            done = root->GetNextLookup(tuple, lookup_pos);
+        } else {
+            // rows are taken from the batches returned by GetNextBatch()
+            while (batch_pos == batch.sel.size() && !batch_done) {
+                batch_done = root->GetNextBatch(batch);
+                batch_pos = 0;
+            }
+            done = batch_pos == batch.sel.size();
+            if (!done) {
+                batch.getTuple(batch_pos++, tuple);
             }
         }
 
-        buf.resize(tuple_len);
-        char *pos = buf.data();
-        for (std::size_t i = 0; i < tuple.size(); i++) {
-            std::memcpy(pos, tuple[i].first, tuple[i].second);
-            pos += tuple[i].second;
-            if (i < tuple.size() - 1) {
-                *pos++ = '|';
-            }
+        uint32_t row_len = lookup ? 4 : 0;
+        for (std::size_t i = 0; !done && i < tuple.size(); ++i) {
+            row_len += CodedOutputStream::VarintSize32(tuple[i].second)
+                       + tuple[i].second;
         }
-        *pos = '\n';
 
-        boost::asio::write(socket_, boost::asio::buffer(buf),
-                           boost::asio::transfer_all(), error);
-        if (error) {
-            if (error == boost::asio::error::connection_reset) {
+        if (frame.size() > 4
+            && (done || frame.size() - 4 + row_len > FRAME_SIZE)) {
+            if (!send_frame(frame)) {
                 root->Close();
-                socket_.close();
-                return;
+                return false;
             }
-            throw boost::system::system_error(error);
+        }
+        if (done) {
+            break;
+        }
+
+        std::size_t offset = frame.size();
+        frame.resize(offset + row_len);
+        uint8_t *target = &frame[offset];
+        if (lookup) {
+            target = CodedOutputStream::WriteLittleEndian32ToArray(
+                         lookup_pos, target);
+        }
+        for (std::size_t i = 0; i < tuple.size(); ++i) {
+            target = CodedOutputStream::WriteVarint32ToArray(
+                         tuple[i].second, target);
+            target = CodedOutputStream::WriteRawToArray(
+                         tuple[i].first, tuple[i].second, target);
         }
     }
+
+    std::vector<CardCount> counts;
+    root->getCardCounts(counts);
     root->Close();
 
-    // send a special sequence indicating the end of results
-    char delim[2] = {'|', '\n'};
-    boost::asio::write(socket_, boost::asio::buffer(&delim[0], 2),
+    // send an empty frame indicating the end of results, followed by
+    // the actual cardinalities of the operators
+    return send_frame(frame) && send_card_counts(frame, counts);
+}
+
+bool Connection::send_card_counts(std::vector<uint8_t> &frame,
+                                  const std::vector<CardCount> &counts)
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    std::size_t size = 4 + CodedOutputStream::VarintSize32(counts.size());
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        size += CodedOutputStream::VarintSize64(counts[i].num_tuples) + 1;
+    }
+
+    frame.resize(size);
+    uint8_t *target = &frame[4];
+    target = CodedOutputStream::WriteVarint32ToArray(counts.size(), target);
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        target = CodedOutputStream::WriteVarint64ToArray(
+                     counts[i].num_tuples, target);
+        target = CodedOutputStream::WriteVarint32ToArray(
+                     (counts[i].complete ? 1 : 0) | (counts[i].sliced ? 2 : 0),
+                     target);
+    }
+
+    return send_frame(frame);
+}
+
+// Returns false if the connection has been reset.
+bool Connection::send_frame(std::vector<uint8_t> &frame)
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    CodedOutputStream::WriteLittleEndian32ToArray(frame.size() - 4, &frame[0]);
+
+    boost::system::error_code error;
+    boost::asio::write(socket_, boost::asio::buffer(frame),
                        boost::asio::transfer_all(), error);
     if (error) {
         if (error == boost::asio::error::connection_reset) {
-            socket_.close();
-            return;
+            return false;
         }
         throw boost::system::system_error(error);
     }
 
-    // flush the send buffer
-    socket_.set_option(
-        boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_CORK>(0));
-
-    // thread exits, socket waits for another request
-    start();
+    frame.resize(4);
+    return true;
 }
 
 void Connection::handle_stats()
@@ -298,26 +418,60 @@ void Connection::handle_stats()
         std::string fileName;
         google::protobuf::internal::WireFormatLite::ReadString(
             &cis, &fileName);
-        uint32_t fieldType;
-        cis.ReadVarint32(&fieldType);
         uint32_t nbFields;
         cis.ReadVarint32(&nbFields);
         std::vector<std::string> fieldNames;
+        std::vector<ValueType> fieldTypes;
+        std::vector<uint32_t> priorities;
         fieldNames.reserve(nbFields);
+        fieldTypes.reserve(nbFields);
+        priorities.reserve(nbFields);
         for (int k = 0; k < nbFields; ++k) {
             std::string fieldName;
             google::protobuf::internal::WireFormatLite::ReadString(
                 &cis, &fieldName);
             fieldNames.push_back(fieldName);
+            uint32_t temp;
+            cis.ReadVarint32(&temp);
+            fieldTypes.push_back(static_cast<ValueType>(temp));
+            cis.ReadVarint32(&temp);
+            priorities.push_back(temp);
         }
+        uint32_t budget;
+        cis.ReadVarint32(&budget);
 
         buf.consume(size);
 
         // construct a PartStats object
-        PartStats *stats = new PartStats(tableName,
-                                         fileName,
-                                         static_cast<ValueType>(fieldType),
-                                         fieldNames);
+        PartStats *stats = new PartStats(fileName, fieldTypes);
+
+        // mirror the indexes, index the other named columns, and build a
+        // column store within the remaining time, where a fence index
+        // replaces the mirror of the primary key index
+        boost::system_time deadline
+            = boost::get_system_time()
+              + boost::posix_time::milliseconds(budget);
+        bool has_fence
+            = !fieldNames[0].empty() && fieldNames[0][0] == '_'
+              && IOManager::instance()->buildFenceIndex(
+                     fileName, fieldTypes[0], (nbFields > 1) ? '|' : '\n',
+                     deadline);
+        for (std::size_t k = has_fence ? 1 : 0; k < fieldNames.size(); ++k) {
+            if (!fieldNames[k].empty() && fieldNames[k][0] == '_') {
+                IOManager::instance()->buildIndexMirror(
+                    tableName + "." + fieldNames[k], fieldTypes[k],
+                    deadline);
+            }
+        }
+        // the other named columns are restricted or joined without an index
+        for (std::size_t k = 0; k < fieldNames.size(); ++k) {
+            if (!fieldNames[k].empty() && fieldNames[k][0] != '_') {
+                stats->column_indexes_[k]
+                    = IOManager::instance()->buildColumnIndex(
+                          fileName, k, fieldTypes[k], deadline);
+            }
+        }
+        ColumnStore::build(fileName, fieldTypes, priorities, stats, deadline);
 
         // send a response
         size = stats->ByteSize();
@@ -345,4 +499,62 @@ void Connection::handle_stats()
     start();
 }
 
+void Connection::handle_pretreatment()
+{
+    using google::protobuf::io::CodedInputStream;
+    using google::protobuf::io::CodedOutputStream;
+
+    // receive a request header
+    uint8_t header[4];
+    uint32_t size;
+    boost::asio::read(socket_, boost::asio::buffer(header));
+    CodedInputStream::ReadLittleEndian32FromArray(&header[0], &size);
+
+    // receive a request body (budget followed by tasks in priority order)
+    std::vector<uint8_t> buf(size);
+    boost::asio::read(socket_, boost::asio::buffer(buf));
+
+    CodedInputStream cis(&buf[0], size);
+
+    uint32_t budget;
+    cis.ReadVarint32(&budget);
+    boost::system_time deadline
+        = boost::get_system_time() + boost::posix_time::milliseconds(budget);
+
+    uint32_t num_tasks;
+    cis.ReadVarint32(&num_tasks);
+
+    // run the tasks in order until one of them runs out of time
+    uint32_t num_done = 0;
+    for (uint32_t i = 0; i < num_tasks; ++i) {
+        uint32_t kind;
+        cis.ReadVarint32(&kind);
+        std::string name;
+        google::protobuf::internal::WireFormatLite::ReadString(&cis, &name);
+        uint32_t type;
+        cis.ReadVarint32(&type);
+
+        if (!IOManager::instance()->runPreTask(
+                 static_cast<IOManager::PreTaskKind>(kind), name,
+                 static_cast<ValueType>(type), deadline)
+            && boost::get_system_time() >= deadline) {
+            break;
+        }
+        ++num_done;
+    }
+
+    // send a response (number of finished tasks)
+    CodedOutputStream::WriteLittleEndian32ToArray(num_done, header);
+    boost::asio::write(socket_, boost::asio::buffer(header));
+
+    // flush the send buffer
+    socket_.set_option(
+        boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_CORK>(0));
+    socket_.set_option(
+        boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_CORK>(1));
+
+    // thread exits, socket waits for another request
+    start();
+}
+
 }  // namespace cardinality
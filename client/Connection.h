@@ -30,6 +30,7 @@
 #ifndef CARDINALITY_CONNECTION_H_
 #define CARDINALITY_CONNECTION_H_
 
+#include <vector>
 #include <boost/smart_ptr/enable_shared_from_this.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
@@ -37,6 +38,9 @@
 
 namespace cardinality {
 
+class Operator;
+struct CardCount;
+
 // Represent a passive TCP connection handled by IOManager
 class Connection: public boost::enable_shared_from_this<Connection> {
 public:
@@ -58,23 +62,42 @@ private:
     Connection& operator=(const Connection &);
 
     // Asynchronous callback for a new request.
-    // Calls one of the next three methods to handle the request.
+    // Calls one of the next five methods to handle the request.
     void handle_read(const boost::system::error_code &, std::size_t);
 
     // Receive a plan, execute it, and send the results back.
+    // The plan may be followed by a Bloom filter on one of its columns.
     void handle_query();
 
     // handle_query() with a join value for nested-loop index join.
     void handle_param_query();
 
+    // handle_query() with a batch of join values for nested-loop index
+    // join. Each result is prefixed by the position of its join value.
+    void handle_lookup_query();
+
     // Process a statistics gathering request.
     void handle_stats();
 
+    // Run the pretreatment tasks scheduled by the master within a budget.
+    void handle_pretreatment();
+
+    // Execute an opened plan and send its results back in frames,
+    // followed by the actual cardinalities of its operators.
+    // Returns false if the connection has been reset.
+    bool send_results(Operator *, const bool);
+    bool send_frame(std::vector<uint8_t> &);
+    bool send_card_counts(std::vector<uint8_t> &,
+                          const std::vector<CardCount> &);
+
     // boost::asio
     boost::asio::ip::tcp::socket socket_;
 
     // buffer for receiving a request type
     char buffer_[1];
+
+    // constants
+    static const std::size_t FRAME_SIZE = 65536;
 };
 
 }  // namespace cardinality
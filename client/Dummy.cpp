@@ -44,7 +44,7 @@ Dummy::~Dummy()
 
 Operator::Ptr Dummy::clone() const
 {
-    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+    return boost::make_shared<Dummy>(node_id_);
 }
 
 void Dummy::Open(const Chunk *)
@@ -64,6 +64,14 @@ void Dummy::Close()
 {
 }
 
+void Dummy::setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>)
+{
+}
+
+void Dummy::setSlice(const uint32_t, const uint32_t)
+{
+}
+
 uint8_t *Dummy::SerializeToArray(uint8_t *target) const
 {
     throw std::runtime_error(BOOST_CURRENT_FUNCTION);
@@ -111,6 +119,15 @@ ColID Dummy::getOutputColID(const ColName col) const
     return 0;
 }
 
+bool Dummy::isSortedOn(const ColID) const
+{
+    return true;
+}
+
+void Dummy::rebind(const Query *, const Query *)
+{
+}
+
 double Dummy::estCost(const double) const
 {
     return 0.0;
@@ -131,4 +148,21 @@ double Dummy::estColSize(const ColID cid) const
     return 0.0;
 }
 
+std::string Dummy::getTableSet() const
+{
+    return std::string();
+}
+
+void Dummy::getCardEstimates(std::vector<CardEstimate> &) const
+{
+}
+
+void Dummy::getCardCounts(std::vector<CardCount> &) const
+{
+}
+
+void Dummy::setCardCorrections(const CardCorrections &)
+{
+}
+
 }  // namespace cardinality
@@ -47,6 +47,8 @@ public:
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
     void Close();
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
 
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
@@ -60,6 +62,10 @@ public:
     ValueType getColType(const ColName) const;
     ColID numOutputCols() const;
     ColID getOutputColID(const ColName) const;
+    bool isSortedOn(const ColID) const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estCost(const double = 0.0) const;
@@ -67,6 +73,12 @@ public:
     double estTupleSize() const;
     double estColSize(const ColID) const;
 
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
+
 private:
     Dummy& operator=(const Dummy &);
 };
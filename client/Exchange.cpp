@@ -0,0 +1,509 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/Exchange.h"
+#include <stdexcept>  // std::runtime_error
+#include <algorithm>  // std::max
+#include <boost/bind/bind.hpp>
+
+
+namespace cardinality {
+
+Exchange::Exchange(const NodeID n, std::vector<Operator::Ptr> c)
+    : Operator(n),
+      mode_(EXCHANGE_GATHER),
+      children_(c),
+      degree_(c.size()),
+      slice_(0), num_slices_(1),
+      pipelines_(), threads_(),
+      mutex_(), not_empty_(), not_full_(),
+      queue_(), num_running_(), cancelled_(), error_(), output_done_(),
+      batch_(), batch_pos_(), batch_data_pos_(),
+      bloom_filter_(), bloom_col_id_()
+{
+}
+
+Exchange::Exchange(const NodeID n, Operator::Ptr c, const uint32_t degree)
+    : Operator(n),
+      mode_(EXCHANGE_ROUNDROBIN),
+      children_(1, c),
+      degree_(degree),
+      slice_(0), num_slices_(1),
+      pipelines_(), threads_(),
+      mutex_(), not_empty_(), not_full_(),
+      queue_(), num_running_(), cancelled_(), error_(), output_done_(),
+      batch_(), batch_pos_(), batch_data_pos_(),
+      bloom_filter_(), bloom_col_id_()
+{
+}
+
+Exchange::Exchange(google::protobuf::io::CodedInputStream *input)
+    : Operator(input),
+      mode_(),
+      children_(),
+      degree_(),
+      slice_(), num_slices_(),
+      pipelines_(), threads_(),
+      mutex_(), not_empty_(), not_full_(),
+      queue_(), num_running_(), cancelled_(), error_(), output_done_(),
+      batch_(), batch_pos_(), batch_data_pos_(),
+      bloom_filter_(), bloom_col_id_()
+{
+    Deserialize(input);
+}
+
+Exchange::Exchange(const Exchange &x)
+    : Operator(x),
+      mode_(x.mode_),
+      children_(),
+      degree_(x.degree_),
+      slice_(x.slice_), num_slices_(x.num_slices_),
+      pipelines_(), threads_(),
+      mutex_(), not_empty_(), not_full_(),
+      queue_(), num_running_(), cancelled_(), error_(), output_done_(),
+      batch_(), batch_pos_(), batch_data_pos_(),
+      bloom_filter_(), bloom_col_id_()
+{
+    children_.reserve(x.children_.size());
+    for (std::vector<Operator::Ptr>::const_iterator it = x.children_.begin();
+         it < x.children_.end(); ++it) {
+        children_.push_back((*it)->clone());
+    }
+}
+
+Exchange::~Exchange()
+{
+    stopWorkers();
+}
+
+Operator::Ptr Exchange::clone() const
+{
+    return boost::make_shared<Exchange>(*this);
+}
+
+// The pipelines are opened by the calling thread, and then each of them
+// is drained by a worker thread.
+void Exchange::Open(const Chunk *join_value)
+{
+    if (mode_ == EXCHANGE_GATHER) {
+        pipelines_ = children_;
+        for (std::size_t i = 0; i < pipelines_.size(); ++i) {
+            pipelines_[i]->setSlice(slice_, num_slices_);
+        }
+    } else {
+        // slice i of this Exchange consists of the slices i + k * s
+        // of the clones, where s is the number of slices of this Exchange.
+        // A local SeqScan instead claims the blocks of slice i one by one
+        // through a shared cursor, so that no clone runs out of work
+        // while others are still busy.
+        boost::shared_ptr<SliceCursor> cursor(
+            boost::make_shared<SliceCursor>(slice_, num_slices_));
+        pipelines_.clear();
+        for (uint32_t k = 0; k < degree_; ++k) {
+            pipelines_.push_back(children_[0]->clone());
+            pipelines_.back()->setSlice(slice_ + k * num_slices_,
+                                        num_slices_ * degree_);
+            pipelines_.back()->setSliceCursor(cursor);
+        }
+    }
+
+    for (std::size_t i = 0; i < pipelines_.size(); ++i) {
+        if (bloom_filter_) {
+            pipelines_[i]->setBloomFilter(bloom_col_id_, bloom_filter_);
+        }
+        pipelines_[i]->Open(join_value);
+    }
+
+    queue_.clear();
+    num_running_ = pipelines_.size();
+    cancelled_ = false;
+    error_.clear();
+    output_done_ = false;
+    batch_.reset();
+
+    for (std::size_t i = 0; i < pipelines_.size(); ++i) {
+        threads_.push_back(
+            boost::make_shared<boost::thread>(
+                boost::bind(&Exchange::runWorker, this, i)));
+    }
+}
+
+void Exchange::ReOpen(const Chunk *join_value)
+{
+    Close();
+    Open(join_value);
+}
+
+bool Exchange::GetNext(Tuple &tuple)
+{
+    for (;;) {
+        if (batch_ && batch_pos_ < batch_->lengths.size()) {
+            tuple.clear();
+            for (ColID i = 0; i < numOutputCols(); ++i) {
+                uint32_t len = batch_->lengths[batch_pos_++];
+                tuple.push_back(
+                    std::make_pair(batch_->data.data() + batch_data_pos_,
+                                   len));
+                batch_data_pos_ += len;
+            }
+            return false;
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+        while (queue_.empty() && num_running_ > 0 && error_.empty()) {
+            not_empty_.wait(lock);
+        }
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+        if (queue_.empty()) {
+            output_done_ = true;
+            return true;
+        }
+
+        batch_ = queue_.front();
+        queue_.pop_front();
+        not_full_.notify_one();
+        batch_pos_ = 0;
+        batch_data_pos_ = 0;
+    }
+}
+
+void Exchange::Close()
+{
+    stopWorkers();
+
+    for (std::size_t i = 0; i < pipelines_.size(); ++i) {
+        pipelines_[i]->Close();
+    }
+    pipelines_.clear();
+    queue_.clear();
+    batch_.reset();
+    output_done_ = false;
+}
+
+void Exchange::setBloomFilter(const ColID cid,
+                              boost::shared_ptr<const BloomFilter> filter)
+{
+    bloom_filter_ = filter;
+    bloom_col_id_ = cid;
+}
+
+void Exchange::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    slice_ = slice;
+    num_slices_ = num_slices;
+}
+
+// Copy the results of the given pipeline into batches and pass them to
+// the consumer. Exceptions are passed to the consumer as well.
+void Exchange::runWorker(const std::size_t i)
+{
+    try {
+        Tuple tuple;
+        BatchPtr batch = boost::make_shared<Batch>();
+
+        while (!pipelines_[i]->GetNext(tuple)) {
+            for (std::size_t j = 0; j < tuple.size(); ++j) {
+                batch->data.insert(batch->data.end(), tuple[j].first,
+                                   tuple[j].first + tuple[j].second);
+                batch->lengths.push_back(tuple[j].second);
+            }
+
+            if (batch->data.size() >= EXCHANGE_BATCHSIZE) {
+                if (!pushBatch(batch)) {
+                    break;
+                }
+                batch = boost::make_shared<Batch>();
+            }
+        }
+
+        if (!batch->lengths.empty()) {
+            pushBatch(batch);
+        }
+    } catch (std::exception &e) {
+        boost::mutex::scoped_lock lock(mutex_);
+        error_ = e.what();
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    --num_running_;
+    not_empty_.notify_one();
+}
+
+// Block while the queue is full.
+// Returns false if the consumer has stopped the workers.
+bool Exchange::pushBatch(const BatchPtr &batch)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.size() >= EXCHANGE_QUEUESIZE * pipelines_.size()
+           && !cancelled_) {
+        not_full_.wait(lock);
+    }
+    if (cancelled_) {
+        return false;
+    }
+
+    queue_.push_back(batch);
+    not_empty_.notify_one();
+    return true;
+}
+
+void Exchange::stopWorkers()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        cancelled_ = true;
+        not_full_.notify_all();
+    }
+
+    for (std::size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i]->join();
+    }
+    threads_.clear();
+}
+
+uint8_t *Exchange::SerializeToArray(uint8_t *target) const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    target = CodedOutputStream::WriteTagToArray(TAG_EXCHANGE, target);
+
+    target = Operator::SerializeToArray(target);
+
+    target = CodedOutputStream::WriteVarint32ToArray(mode_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(degree_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(slice_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(num_slices_, target);
+
+    target = CodedOutputStream::WriteVarint32ToArray(children_.size(), target);
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        target = children_[i]->SerializeToArray(target);
+    }
+
+    return target;
+}
+
+int Exchange::ByteSize() const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    int total_size = 1 + Operator::ByteSize();
+
+    total_size += 1;
+    total_size += CodedOutputStream::VarintSize32(degree_);
+    total_size += CodedOutputStream::VarintSize32(slice_);
+    total_size += CodedOutputStream::VarintSize32(num_slices_);
+
+    total_size += CodedOutputStream::VarintSize32(children_.size());
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        total_size += children_[i]->ByteSize();
+    }
+
+    return total_size;
+}
+
+void Exchange::Deserialize(google::protobuf::io::CodedInputStream *input)
+{
+    uint32_t temp;
+    input->ReadVarint32(&temp);
+    mode_ = static_cast<Mode>(temp);
+    input->ReadVarint32(&degree_);
+    input->ReadVarint32(&slice_);
+    input->ReadVarint32(&num_slices_);
+
+    uint32_t size;
+    input->ReadVarint32(&size);
+    children_.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        children_.push_back(parsePlan(input));
+    }
+}
+
+void Exchange::print(std::ostream &os, const int tab, const double) const
+{
+    os << std::string(4 * tab, ' ');
+    os << "Exchange@" << node_id();
+    os << ((mode_ == EXCHANGE_GATHER) ? " gather" : " roundrobin");
+    os << " degree=" << degree_;
+    os << " card=" << estCardinality();
+    os << " cost=" << estCost();
+    os << std::endl;
+
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->print(os, tab + 1);
+    }
+}
+
+bool Exchange::hasCol(const ColName col) const
+{
+    return children_[0]->hasCol(col);
+}
+
+ColID Exchange::getInputColID(const ColName col) const
+{
+    return children_[0]->getOutputColID(col);
+}
+
+std::pair<const PartStats *, ColID>
+Exchange::getPartStats(const ColID cid) const
+{
+    return children_[0]->getPartStats(cid);
+}
+
+ValueType Exchange::getColType(const ColName col) const
+{
+    return children_[0]->getColType(col);
+}
+
+ColID Exchange::numOutputCols() const
+{
+    return children_[0]->numOutputCols();
+}
+
+ColID Exchange::getOutputColID(const ColName col) const
+{
+    return children_[0]->getOutputColID(col);
+}
+
+// The results of the threads are interleaved.
+bool Exchange::isSortedOn(const ColID) const
+{
+    return false;
+}
+
+void Exchange::rebind(const Query *from, const Query *to)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->rebind(from, to);
+    }
+}
+
+// Threads are assumed to run on separate cores, and every result tuple
+// is copied once.
+double Exchange::estCost(const double) const
+{
+    double cost = 0.0;
+    if (mode_ == EXCHANGE_GATHER) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            cost = std::max(cost, children_[i]->estCost());
+        }
+    } else {
+        cost = children_[0]->estCost() / degree_;
+    }
+
+    return cost
+           + degree_ * COST_EXCHANGE_THREAD
+           + estCardinality() * estTupleSize() * COST_EXCHANGE_BYTE;
+}
+
+double Exchange::estCardinality(const bool) const
+{
+    double card = 0.0;
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        card += children_[i]->estCardinality();
+    }
+
+    return card;
+}
+
+double Exchange::estTupleSize() const
+{
+    return children_[0]->estTupleSize();
+}
+
+double Exchange::estColSize(const ColID cid) const
+{
+    return children_[0]->estColSize(cid);
+}
+
+std::string Exchange::getTableSet() const
+{
+    return children_[0]->getTableSet();
+}
+
+void Exchange::getCardEstimates(std::vector<CardEstimate> &estimates) const
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->getCardEstimates(estimates);
+    }
+}
+
+// The pipelines may still be running unless all results have been
+// returned, in which case the counts of fresh clones are reported.
+// In the round-robin mode, the counts of operators restricted to a slice
+// are added up over the clones, while the other operators of each clone
+// produce their whole results.
+void Exchange::getCardCounts(std::vector<CardCount> &counts) const
+{
+    if (!output_done_) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            children_[i]->clone()->getCardCounts(counts);
+        }
+        return;
+    }
+
+    if (mode_ == EXCHANGE_GATHER) {
+        for (std::size_t i = 0; i < pipelines_.size(); ++i) {
+            pipelines_[i]->getCardCounts(counts);
+        }
+        return;
+    }
+
+    std::size_t begin = counts.size();
+    pipelines_[0]->getCardCounts(counts);
+
+    std::vector<CardCount> clone_counts;
+    for (std::size_t k = 1; k < pipelines_.size(); ++k) {
+        clone_counts.clear();
+        pipelines_[k]->getCardCounts(clone_counts);
+        for (std::size_t i = 0; i < clone_counts.size(); ++i) {
+            CardCount &count = counts[begin + i];
+            if (count.sliced) {
+                count.num_tuples += clone_counts[i].num_tuples;
+            }
+            count.complete = count.complete && clone_counts[i].complete;
+        }
+    }
+
+    for (std::size_t i = begin; i < counts.size(); ++i) {
+        if (counts[i].sliced) {
+            counts[i].sliced = num_slices_ > 1;
+        }
+    }
+}
+
+void Exchange::setCardCorrections(const CardCorrections &corrections)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->setCardCorrections(corrections);
+    }
+}
+
+}  // namespace cardinality
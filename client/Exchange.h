@@ -0,0 +1,147 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_EXCHANGE_H_
+#define CARDINALITY_EXCHANGE_H_
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Run child plans on worker threads and gather their results.
+// In the gather mode, each child runs in its own thread.
+// In the round-robin mode, the only child is cloned for each thread,
+// and the outer-most input of each clone is split by setSlice().
+class Exchange: public Operator {
+public:
+    enum Mode { EXCHANGE_GATHER, EXCHANGE_ROUNDROBIN };
+
+    // constructor, destructor
+    Exchange(const NodeID, std::vector<Operator::Ptr>);
+    Exchange(const NodeID, Operator::Ptr, const uint32_t);
+    explicit Exchange(google::protobuf::io::CodedInputStream *);
+    Exchange(const Exchange &);
+    ~Exchange();
+    Operator::Ptr clone() const;
+
+    // query execution
+    void Open(const Chunk * = NULL);
+    void ReOpen(const Chunk * = NULL);
+    bool GetNext(Tuple &);
+    void Close();
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
+
+    // serialization
+    uint8_t *SerializeToArray(uint8_t *) const;
+    int ByteSize() const;
+    void Deserialize(google::protobuf::io::CodedInputStream *);
+
+    // plan exploration
+    void print(std::ostream &, const int, const double) const;
+    bool hasCol(const ColName) const;
+    ColID getInputColID(const ColName) const;
+    std::pair<const PartStats *, ColID> getPartStats(const ColID) const;
+    ValueType getColType(const ColName) const;
+    ColID numOutputCols() const;
+    ColID getOutputColID(const ColName) const;
+    bool isSortedOn(const ColID) const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
+
+    // cost estimation
+    double estCost(const double = 0.0) const;
+    double estCardinality(const bool = false) const;
+    double estTupleSize() const;
+    double estColSize(const ColID) const;
+
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
+
+protected:
+    // result tuples copied by a worker, column by column
+    struct Batch {
+        std::vector<char> data;
+        std::vector<uint32_t> lengths;
+    };
+    typedef boost::shared_ptr<Batch> BatchPtr;
+
+    // helpers for the worker threads
+    void runWorker(const std::size_t);
+    bool pushBatch(const BatchPtr &);
+    void stopWorkers();
+
+    // operator description
+    Mode mode_;
+    std::vector<Operator::Ptr> children_;
+    uint32_t degree_;
+    uint32_t slice_;
+    uint32_t num_slices_;
+
+    // execution states
+    std::vector<Operator::Ptr> pipelines_;
+    std::vector<boost::shared_ptr<boost::thread> > threads_;
+    boost::mutex mutex_;
+    boost::condition_variable not_empty_;
+    boost::condition_variable not_full_;
+    std::deque<BatchPtr> queue_;
+    std::size_t num_running_;
+    bool cancelled_;
+    std::string error_;
+    bool output_done_;                  // all results have been returned
+    BatchPtr batch_;                    // batch being returned
+    std::size_t batch_pos_;
+    std::size_t batch_data_pos_;
+    boost::shared_ptr<const BloomFilter> bloom_filter_;
+    ColID bloom_col_id_;
+
+    // constants
+    static const std::size_t EXCHANGE_BATCHSIZE = 65536;
+    static const std::size_t EXCHANGE_QUEUESIZE = 4;  // batches per thread
+    static const double COST_EXCHANGE_THREAD = 100.0;
+    static const double COST_EXCHANGE_BYTE = 0.0001;
+
+private:
+    Exchange& operator=(const Exchange &);
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_EXCHANGE_H_
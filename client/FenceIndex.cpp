@@ -0,0 +1,213 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/FenceIndex.h"
+#include <cstring>
+#include <algorithm>  // std::min
+#include "client/IOManager.h"
+
+
+namespace cardinality {
+
+FenceIndex::FenceIndex(const ValueType type, const char delim,
+                       const std::pair<const char *, const char *> &file)
+    : type_(type),
+      delim_(delim),
+      file_begin_(file.first),
+      file_end_(file.second),
+      int_keys_(),
+      key_offsets_(1, 0),
+      heap_(),
+      offsets_()
+{
+}
+
+FenceIndex::~FenceIndex()
+{
+}
+
+// Scan the whole partition to check that the primary keys are strictly
+// ascending, since a lookup relies on the order of the rows.
+FenceIndex::Ptr FenceIndex::build(const std::string &filename,
+                                  const ValueType type, const char delim,
+                                  const boost::system_time &deadline)
+{
+    std::pair<const char *, const char *> file
+        = IOManager::instance()->openFile(filename);
+    FenceIndex *fence = new FenceIndex(type, delim, file);
+    bool ok = true;
+
+    Chunk prev_key;
+    uint32_t prev_intval = 0;
+    const char *pos = file.first;
+
+    for (uint32_t num_rows = 0; pos < file.second; ++num_rows) {
+        if (num_rows % FENCE_CHECK_INTERVAL == 0
+            && boost::get_system_time() > deadline) {
+            ok = false;
+            break;
+        }
+
+        Chunk key = fence->getKey(pos);
+        uint32_t intval = 0;
+
+        if (type == INT) {
+            intval = Operator::parseInt(&key);
+            if (num_rows > 0 && intval <= prev_intval) {
+                ok = false;
+                break;
+            }
+        } else {  // STRING
+            if (num_rows > 0
+                && fence->compareKey(key.second, key.first, prev_key) <= 0) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (num_rows % FENCE_INTERVAL == 0) {
+            if (type == INT) {
+                fence->int_keys_.push_back(intval);
+            } else {  // STRING
+                fence->heap_.insert(fence->heap_.end(),
+                                    key.first, key.first + key.second);
+                fence->key_offsets_.push_back(fence->heap_.size());
+            }
+            fence->offsets_.push_back(pos - file.first);
+        }
+
+        prev_key = key;
+        prev_intval = intval;
+
+        const char *key_end = key.first + key.second;
+        const char *eol = static_cast<const char *>(
+                              std::memchr(key_end, '\n',
+                                          file.second - key_end));
+        pos = eol ? eol + 1 : file.second;
+    }
+
+    if (ok) {
+        return Ptr(fence);
+    }
+
+    delete fence;
+    return Ptr();
+}
+
+std::pair<uint64_t, uint64_t>
+FenceIndex::findEqual(const uint32_t intval, const char *charval) const
+{
+    const char *pos = searchRow(intval, charval, false);
+    if (pos == file_end_ || compareKey(intval, charval, getKey(pos))) {
+        return std::make_pair(pos - file_begin_, pos - file_begin_);
+    }
+
+    const char *eol = static_cast<const char *>(
+                          std::memchr(pos, '\n', file_end_ - pos));
+    const char *next = eol ? eol + 1 : file_end_;
+    return std::make_pair(pos - file_begin_, next - file_begin_);
+}
+
+std::pair<uint64_t, uint64_t>
+FenceIndex::findGreater(const uint32_t intval, const char *charval) const
+{
+    const char *pos = searchRow(intval, charval, true);
+    return std::make_pair(pos - file_begin_, file_end_ - file_begin_);
+}
+
+const char *FenceIndex::searchRow(const uint32_t intval,
+                                  const char *charval,
+                                  const bool greater) const
+{
+    // find the first fence whose key is not less than (or greater than)
+    // the given key
+    std::size_t lo = 0;
+    std::size_t hi = offsets_.size();
+
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        int cmp;
+        if (type_ == INT) {
+            cmp = (intval > int_keys_[mid]) - (intval < int_keys_[mid]);
+        } else {  // STRING
+            cmp = compareKey(intval, charval,
+                             Chunk(&heap_[0] + key_offsets_[mid],
+                                   key_offsets_[mid + 1]
+                                   - key_offsets_[mid]));
+        }
+        if (cmp > 0 || (greater && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return file_begin_;
+    }
+
+    // scan the rows between the previous fence and the fence
+    const char *pos = file_begin_ + offsets_[lo - 1];
+    const char *end = (lo < offsets_.size())
+                      ? file_begin_ + offsets_[lo] : file_end_;
+
+    while (pos < end) {
+        int cmp = compareKey(intval, charval, getKey(pos));
+        if (cmp < 0 || (!greater && cmp == 0)) {
+            return pos;
+        }
+
+        const char *eol = static_cast<const char *>(
+                              std::memchr(pos, '\n', end - pos));
+        pos = eol ? eol + 1 : end;
+    }
+
+    return end;
+}
+
+Chunk FenceIndex::getKey(const char *pos) const
+{
+    const char *key_end = static_cast<const char *>(
+                              std::memchr(pos, delim_, file_end_ - pos));
+    if (key_end == NULL) {
+        key_end = file_end_;
+    }
+    return Chunk(pos, key_end - pos);
+}
+
+int FenceIndex::compareKey(const uint32_t intval, const char *charval,
+                           const Chunk &key) const
+{
+    return Operator::compareKey(type_, intval, charval,
+                                (type_ == INT) ? Operator::parseInt(&key)
+                                               : key.second,
+                                key.first);
+}
+
+}  // namespace cardinality
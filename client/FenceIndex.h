@@ -0,0 +1,106 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_FENCEINDEX_H_
+#define CARDINALITY_FENCEINDEX_H_
+
+#include <string>
+#include <vector>
+#include <utility>  // std::pair
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Represent a sparse index on the primary key of a partition, which is
+// sorted on the primary key. The primary key and the file offset of
+// every FENCE_INTERVAL-th row are kept in flat arrays, and a lookup
+// scans at most FENCE_INTERVAL rows after a binary search on them.
+// Used by IndexScan instead of the primary key index without locking.
+class FenceIndex {
+public:
+    typedef boost::shared_ptr<const FenceIndex> Ptr;
+
+    // Build a fence index of the given partition whose primary key is of
+    // the given type and followed by the given delimiter.
+    // Gives up if the build cannot finish by the given deadline.
+    // Returns NULL if the partition is not sorted on the primary key.
+    static Ptr build(const std::string &, const ValueType, const char,
+                     const boost::system_time &);
+
+    // destructor
+    ~FenceIndex();
+
+    // Find the file offsets of the rows whose primary keys are equal to
+    // or greater than the given key. A STRING key is given by its length
+    // and characters. Returns a range of offsets that starts and ends at
+    // line boundaries.
+    std::pair<uint64_t, uint64_t> findEqual(const uint32_t,
+                                            const char * = NULL) const;
+    std::pair<uint64_t, uint64_t> findGreater(const uint32_t,
+                                              const char * = NULL) const;
+
+private:
+    // constructor called by build()
+    FenceIndex(const ValueType, const char,
+               const std::pair<const char *, const char *> &);
+
+    // non-copyable
+    FenceIndex(const FenceIndex &);
+    FenceIndex& operator=(const FenceIndex &);
+
+    // Returns the primary key of the row at the given position.
+    Chunk getKey(const char *) const;
+
+    // Compare the given key with a primary key.
+    int compareKey(const uint32_t, const char *, const Chunk &) const;
+
+    // Returns the first row whose primary key is not less than (or
+    // greater than if the flag is set) the given key.
+    const char *searchRow(const uint32_t, const char *, const bool) const;
+
+    ValueType type_;
+    char delim_;
+    const char *file_begin_;
+    const char *file_end_;
+    std::vector<uint32_t> int_keys_;
+    std::vector<uint32_t> key_offsets_;  // offsets into heap_, STRING only
+    std::vector<char> heap_;
+    std::vector<uint64_t> offsets_;
+
+    // constants
+    static const uint32_t FENCE_INTERVAL = 64;
+    static const uint32_t FENCE_CHECK_INTERVAL = 65536;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_FENCEINDEX_H_
@@ -0,0 +1,614 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/HashJoin.h"
+#include <sys/stat.h>  // mkdir
+#include <unistd.h>  // unlink, close
+#include <cstdlib>  // mkstemp
+#include <cstring>
+#include <stdexcept>  // std::runtime_error
+#include <algorithm>  // std::max, std::min
+#include "client/BloomFilter.h"
+#include "client/IOManager.h"
+#include "client/Remote.h"
+
+
+namespace cardinality {
+
+HashJoin::HashJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
+                   const Query *q, const bool semijoin)
+    : Join(n, l, r, q),
+      semijoin_(semijoin), left_opened_(),
+      state_(), build_(), done_(), num_bytes_(),
+      tuples_(), hashes_(), blocks_(),
+      block_pos_(), block_end_(),
+      table_(), mask_(), bucket_(), probe_hash_(), probe_pos_(),
+      spilled_(), part_(), spills_(), spill_buffer_(),
+      spill_size_(), spill_reserved_()
+{
+}
+
+HashJoin::HashJoin(google::protobuf::io::CodedInputStream *input)
+    : Join(input),
+      semijoin_(), left_opened_(),
+      state_(), build_(), done_(), num_bytes_(),
+      tuples_(), hashes_(), blocks_(),
+      block_pos_(), block_end_(),
+      table_(), mask_(), bucket_(), probe_hash_(), probe_pos_(),
+      spilled_(), part_(), spills_(), spill_buffer_(),
+      spill_size_(), spill_reserved_()
+{
+    Deserialize(input);
+}
+
+HashJoin::HashJoin(const HashJoin &x)
+    : Join(x),
+      semijoin_(x.semijoin_), left_opened_(),
+      state_(), build_(), done_(), num_bytes_(),
+      tuples_(), hashes_(), blocks_(),
+      block_pos_(), block_end_(),
+      table_(), mask_(), bucket_(), probe_hash_(), probe_pos_(),
+      spilled_(), part_(), spills_(), spill_buffer_(),
+      spill_size_(), spill_reserved_()
+{
+}
+
+HashJoin::~HashJoin()
+{
+    closeSpills();
+}
+
+Operator::Ptr HashJoin::clone() const
+{
+    return boost::make_shared<HashJoin>(*this);
+}
+
+void HashJoin::Open(const Chunk *)
+{
+    resetCardCount();
+    state_ = STATE_OPEN;
+    left_tuple_.reserve(left_child_->numOutputCols());
+    right_tuple_.reserve(right_child_->numOutputCols());
+    left_opened_ = !semijoin_;
+    if (left_opened_) {
+        left_child_->Open();
+    }
+    right_child_->Open();
+}
+
+void HashJoin::ReOpen(const Chunk *)
+{
+    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+}
+
+bool HashJoin::GetNext(Tuple &tuple)
+{
+    const int probe = 1 - build_;
+
+    for (;;) {
+        switch (state_) {
+        case STATE_OPEN:
+            // Read both inputs, always from the one buffered less so far,
+            // until either one is exhausted. The exhausted input is the
+            // smaller one and becomes the build side.
+            done_[0] = done_[1] = false;
+            num_bytes_[0] = num_bytes_[1] = 0;
+            if (semijoin_) {
+                reduceLeftInput();
+            }
+            while (!done_[0] && !done_[1]) {
+                if (num_bytes_[0] + num_bytes_[1] > HASHJOIN_MEMSIZE) {
+                    break;
+                }
+
+                int side = (num_bytes_[0] <= num_bytes_[1]) ? 0 : 1;
+                if (child(side)->GetNext(scratch(side))) {
+                    done_[side] = true;
+                } else {
+                    storeTuple(side, scratch(side),
+                               hashKey(side, scratch(side)));
+                }
+            }
+
+            if (!done_[0] && !done_[1]) {  // neither input fits in memory
+                build_ = (num_bytes_[0] <= num_bytes_[1]) ? 0 : 1;
+                if (spillInputs()) {
+                    part_ = -1;
+                    state_ = STATE_NEXTPART;
+                    return GetNext(tuple);
+                }
+
+                // Otherwise, the build input is buffered as a whole.
+                while (!done_[build_]) {
+                    if (child(build_)->GetNext(scratch(build_))) {
+                        done_[build_] = true;
+                    } else {
+                        storeTuple(build_, scratch(build_),
+                                   hashKey(build_, scratch(build_)));
+                    }
+                }
+            } else {
+                build_ = done_[0] ? 0 : 1;
+            }
+
+            if (hashes_[build_].empty()) {
+                return finishOutput(true);
+            }
+            buildTable();
+            probe_pos_ = 0;
+            state_ = STATE_GETNEXT;
+            return GetNext(tuple);
+
+        case STATE_NEXTPART:
+            clearTable();
+            if (part_ >= 0) {
+                std::fclose(spills_[part_]);
+                spills_[part_] = NULL;
+            }
+            if (++part_ == HASHJOIN_NUM_PARTS) {
+                return finishOutput(true);
+            }
+
+            // A partition larger than HASHJOIN_MEMSIZE is loaded as a whole.
+            std::rewind(spills_[part_]);
+            while (readSpill(spills_[part_], build_, probe_hash_)) {
+                storeTuple(build_, scratch(build_), probe_hash_);
+            }
+
+            if (hashes_[build_].empty()) {
+                break;
+            }
+            buildTable();
+            std::rewind(spills_[part_]);
+            state_ = STATE_GETNEXT;
+
+        case STATE_GETNEXT:
+            if (spilled_) {
+                if (!readSpill(spills_[part_], probe, probe_hash_)) {
+                    state_ = STATE_NEXTPART;
+                    break;
+                }
+            } else if (probe_pos_ < hashes_[probe].size()) {
+                loadTuple(probe, probe_pos_);
+                probe_hash_ = hashes_[probe][probe_pos_++];
+            } else {
+                if (done_[probe] || child(probe)->GetNext(scratch(probe))) {
+                    done_[probe] = true;
+                    return finishOutput(true);
+                }
+                probe_hash_ = hashKey(probe, scratch(probe));
+            }
+            bucket_ = static_cast<uint32_t>(probe_hash_) & mask_;
+            state_ = STATE_SWEEPBUCKET;
+
+        case STATE_SWEEPBUCKET:
+            for (; table_[bucket_].pos; bucket_ = (bucket_ + 1) & mask_) {
+                if (table_[bucket_].tag
+                    != static_cast<uint32_t>(probe_hash_ >> 32)) {
+                    continue;
+                }
+
+                loadTuple(build_, table_[bucket_].pos - 1);
+                if (execFilter(left_tuple_, right_tuple_)) {
+                    execProject(left_tuple_, right_tuple_, tuple);
+                    bucket_ = (bucket_ + 1) & mask_;
+                    return false;
+                }
+            }
+            state_ = STATE_GETNEXT;
+            break;
+        }
+    }
+
+    return false;
+}
+
+void HashJoin::Close()
+{
+    clearTable();
+    closeSpills();
+    spill_buffer_.clear();
+
+    right_child_->Close();
+    if (left_opened_) {
+        left_child_->Close();
+    }
+}
+
+uint8_t *HashJoin::SerializeToArray(uint8_t *target) const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    target = CodedOutputStream::WriteTagToArray(TAG_HASHJOIN, target);
+
+    target = Join::SerializeToArray(target);
+
+    target = CodedOutputStream::WriteVarint32ToArray(semijoin_, target);
+
+    return target;
+}
+
+int HashJoin::ByteSize() const
+{
+    int total_size = 1 + Join::ByteSize() + 1;
+
+    return total_size;
+}
+
+void HashJoin::Deserialize(google::protobuf::io::CodedInputStream *input)
+{
+    uint32_t temp;
+    input->ReadVarint32(&temp);
+    semijoin_ = temp;
+}
+
+void HashJoin::print(std::ostream &os, const int tab, const double) const
+{
+    os << std::string(4 * tab, ' ');
+    os << "HashJoin@" << node_id();
+    if (semijoin_) {
+        os << " semijoin";
+    }
+    os << " #cols=" << numOutputCols();
+    os << " len=" << estTupleSize();
+    os << " card=" << estCardinality();
+    os << " cost=" << estCost();
+    os << std::endl;
+
+    left_child_->print(os, tab + 1);
+    right_child_->print(os, tab + 1);
+}
+
+double HashJoin::estCost(const double) const
+{
+    double left_bytes = left_child_->estCardinality()
+                        * left_child_->estTupleSize();
+    double right_bytes = right_child_->estCardinality()
+                         * right_child_->estTupleSize();
+
+    double cost = left_child_->estCost() + right_child_->estCost();
+
+    // The Bloom filter is sent to the left input, which then transfers
+    // only the tuples that pass it.
+    if (semijoin_) {
+        double pass = estCardinality() / left_child_->estCardinality()
+                      + BloomFilter::FALSE_POSITIVE_RATE;
+        cost -= (1.0 - std::min(1.0, pass))
+                * Remote::estXferCost(left_bytes);
+        cost += Remote::estXferCost(BloomFilter::estByteSize(
+                    right_child_->estCardinality()));
+    }
+
+    // both inputs are written to and read back from partitions
+    if (2.0 * std::min(left_bytes, right_bytes) > HASHJOIN_COST_MEMSIZE) {
+        cost += 2.0 * (left_bytes + right_bytes) * COST_DISK_SPILL_BYTE;
+    }
+
+    return cost;
+}
+
+// With a Bloom filter, the left input returns only the tuples passing it.
+void HashJoin::getCardCounts(std::vector<CardCount> &counts) const
+{
+    Join::getCardCounts(counts, !semijoin_, true);
+}
+
+Operator::Ptr &HashJoin::child(const int side)
+{
+    return side ? right_child_ : left_child_;
+}
+
+Tuple &HashJoin::scratch(const int side)
+{
+    return side ? right_tuple_ : left_tuple_;
+}
+
+// Hash all join columns of the given input.
+uint64_t HashJoin::hashKey(const int side, const Tuple &t) const
+{
+    static const Chunk separator("\xff", 1);
+
+    uint64_t hash = HASH_OFFSET_BASIS;
+    for (std::size_t i = 0; i < join_conds_.size(); ++i) {
+        const Chunk &c = t[side ? join_conds_[i].get<1>()
+                                : join_conds_[i].get<0>()];
+        hash = hashValue(c, join_conds_[i].get<2>() ? STRING : INT, hash);
+        hash = hashValue(separator, STRING, hash);
+    }
+
+    return finishHash(hash);
+}
+
+// Copy the given tuple into the buffer of the given input.
+void HashJoin::storeTuple(const int side, const Tuple &t, const uint64_t hash)
+{
+    std::size_t len = 0;
+    for (std::size_t i = 0; i < t.size(); ++i) {
+        len += t[i].second + 1;
+    }
+
+    if (block_pos_ + len > block_end_) {
+        std::size_t size = std::max<std::size_t>(HASHJOIN_BLOCKSIZE, len);
+        blocks_.push_back(boost::shared_array<char>(new char[size]));
+        block_pos_ = blocks_.back().get();
+        block_end_ = block_pos_ + size;
+    }
+
+    for (std::size_t i = 0; i < t.size(); ++i) {
+        std::memcpy(block_pos_, t[i].first, t[i].second);
+        block_pos_[t[i].second] = '\0';
+        tuples_[side].push_back(Chunk(block_pos_, t[i].second));
+        block_pos_ += t[i].second + 1;
+    }
+    hashes_[side].push_back(hash);
+
+    num_bytes_[side] += len + t.size() * sizeof(Chunk) + sizeof(uint64_t);
+}
+
+void HashJoin::loadTuple(const int side, const std::size_t pos)
+{
+    std::size_t num_cols = child(side)->numOutputCols();
+    std::vector<Chunk>::const_iterator it
+        = tuples_[side].begin() + pos * num_cols;
+    scratch(side).assign(it, it + num_cols);
+}
+
+// Build an open addressing hash table with linear probing
+// on the buffered tuples of the build input.
+void HashJoin::buildTable()
+{
+    std::size_t num_tuples = hashes_[build_].size();
+
+    uint32_t capacity = 16;
+    while (capacity < 2 * num_tuples) {
+        capacity <<= 1;
+    }
+    Bucket empty = {0, 0};
+    table_.assign(capacity, empty);
+    mask_ = capacity - 1;
+
+    for (std::size_t i = 0; i < num_tuples; ++i) {
+        uint64_t hash = hashes_[build_][i];
+        uint32_t b = static_cast<uint32_t>(hash) & mask_;
+        while (table_[b].pos) {
+            b = (b + 1) & mask_;
+        }
+        table_[b].tag = static_cast<uint32_t>(hash >> 32);
+        table_[b].pos = i + 1;
+    }
+}
+
+// Buffer the right input as long as it fits in memory, and if it does,
+// restrict the left input to tuples whose value on the first join column
+// is in a Bloom filter built on the buffered tuples.
+void HashJoin::reduceLeftInput()
+{
+    while (num_bytes_[1] <= HASHJOIN_MEMSIZE) {
+        if (right_child_->GetNext(right_tuple_)) {
+            done_[1] = true;
+            break;
+        }
+        storeTuple(1, right_tuple_, hashKey(1, right_tuple_));
+    }
+
+    if (done_[1]) {
+        std::size_t num_cols = right_child_->numOutputCols();
+        std::size_t num_tuples = hashes_[1].size();
+        boost::shared_ptr<BloomFilter> filter
+            = boost::make_shared<BloomFilter>(
+                  join_conds_[0].get<2>() ? STRING : INT, num_tuples);
+        for (std::size_t i = 0; i < num_tuples; ++i) {
+            filter->insert(
+                tuples_[1][i * num_cols + join_conds_[0].get<1>()]);
+        }
+        left_child_->setBloomFilter(join_conds_[0].get<0>(), filter);
+    }
+
+    left_child_->Open();
+    left_opened_ = true;
+}
+
+void HashJoin::clearTable()
+{
+    for (int side = 0; side < 2; ++side) {
+        std::vector<Chunk>().swap(tuples_[side]);
+        std::vector<uint64_t>().swap(hashes_[side]);
+    }
+    blocks_.clear();
+    block_pos_ = block_end_ = NULL;
+    std::vector<Bucket>().swap(table_);
+}
+
+// Write both inputs into HASHJOIN_NUM_PARTS partitions by the upper half
+// of their hash values (Grace hash join). Tuples buffered so far are
+// written first, followed by the rest of each input. Both inputs share
+// the file of a partition to save file descriptors.
+// Returns false if the partitions cannot be written, e.g., for lack of
+// file descriptors or disk space, in which case all the tuples read so
+// far are buffered in memory.
+bool HashJoin::spillInputs()
+{
+    if (!IOManager::instance()->reserveFiles(HASHJOIN_NUM_PARTS)) {
+        return false;
+    }
+    spills_.assign(HASHJOIN_NUM_PARTS, NULL);
+    mkdir(IOManager::SPACE_DIR, 0777);
+
+    for (int p = 0; p < HASHJOIN_NUM_PARTS; ++p) {
+        std::string name(IOManager::SPACE_DIR);
+        name += "/hashjoinXXXXXX";
+        std::vector<char> filename(name.begin(), name.end());
+        filename.push_back('\0');
+        int fd = mkstemp(&filename[0]);
+        if (fd < 0) {
+            closeSpills();
+            return false;
+        }
+        unlink(&filename[0]);  // removed from disk when closed
+        spills_[p] = fdopen(fd, "w+b");
+        if (spills_[p] == NULL) {
+            close(fd);
+            closeSpills();
+            return false;
+        }
+    }
+
+    for (int side = 0; side < 2; ++side) {
+        for (std::size_t i = 0; i < hashes_[side].size(); ++i) {
+            loadTuple(side, i);
+            uint64_t hash = hashes_[side][i];
+            if (!writeSpill(spills_[(hash >> 32) % HASHJOIN_NUM_PARTS],
+                            side, scratch(side), hash)) {
+                closeSpills();  // the tuples are still buffered
+                return false;
+            }
+        }
+    }
+    clearTable();
+
+    for (int side = 0; side < 2; ++side) {
+        while (!child(side)->GetNext(scratch(side))) {
+            uint64_t hash = hashKey(side, scratch(side));
+            if (!writeSpill(spills_[(hash >> 32) % HASHJOIN_NUM_PARTS],
+                            side, scratch(side), hash)) {
+                storeTuple(side, scratch(side), hash);
+                unspillInputs();
+                return false;
+            }
+        }
+        done_[side] = true;
+    }
+
+    spilled_ = true;
+    return true;
+}
+
+// Spilled tuples are written as the hash value, the total length, the
+// input and each column prefixed by its length and terminated by '\0'.
+// Disk space is reserved HASHJOIN_MEMSIZE bytes at a time.
+// Returns false if the tuple cannot be written.
+bool HashJoin::writeSpill(std::FILE *file, const int side, const Tuple &t,
+                          const uint64_t hash)
+{
+    uint32_t len = 0;
+    for (std::size_t i = 0; i < t.size(); ++i) {
+        len += sizeof(uint32_t) + t[i].second + 1;
+    }
+    uint8_t input = side;
+
+    spill_size_ += sizeof(hash) + sizeof(len) + sizeof(input) + len;
+    while (spill_size_ > spill_reserved_) {
+        if (!IOManager::instance()->reserveSpace(HASHJOIN_MEMSIZE, true)) {
+            return false;
+        }
+        spill_reserved_ += HASHJOIN_MEMSIZE;
+    }
+
+    bool ok = std::fwrite(&hash, sizeof(hash), 1, file) == 1
+              && std::fwrite(&len, sizeof(len), 1, file) == 1
+              && std::fwrite(&input, sizeof(input), 1, file) == 1;
+    for (std::size_t i = 0; ok && i < t.size(); ++i) {
+        ok = std::fwrite(&t[i].second, sizeof(uint32_t), 1, file) == 1
+             && std::fwrite(t[i].first, 1, t[i].second, file) == t[i].second
+             && std::fputc('\0', file) != EOF;
+    }
+    return ok;
+}
+
+// Read the next spilled tuple of the given input into its scratch tuple,
+// skipping those of the other input.
+// Returns false at the end of the partition.
+bool HashJoin::readSpill(std::FILE *file, const int side, uint64_t &hash)
+{
+    uint32_t len;
+    uint8_t input;
+    do {
+        if (std::fread(&hash, sizeof(hash), 1, file) != 1
+            || std::fread(&len, sizeof(len), 1, file) != 1
+            || std::fread(&input, sizeof(input), 1, file) != 1) {
+            return false;
+        }
+
+        if (spill_buffer_.size() < len) {
+            spill_buffer_.resize(len);
+        }
+        if (std::fread(&spill_buffer_[0], 1, len, file) != len) {
+            throw std::runtime_error(IOManager::SPACE_DIR);
+        }
+    } while (input != side);
+
+    Tuple &t = scratch(side);
+    t.clear();
+    for (const char *pos = &spill_buffer_[0];
+         pos < &spill_buffer_[0] + len; ) {
+        uint32_t col_len;
+        std::memcpy(&col_len, pos, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+        t.push_back(Chunk(pos, col_len));
+        pos += col_len + 1;
+    }
+
+    return true;
+}
+
+// Read all the spilled tuples back into memory and remove the partitions.
+void HashJoin::unspillInputs()
+{
+    for (int p = 0; p < HASHJOIN_NUM_PARTS; ++p) {
+        for (int side = 0; side < 2; ++side) {
+            uint64_t hash;
+            std::rewind(spills_[p]);
+            while (readSpill(spills_[p], side, hash)) {
+                storeTuple(side, scratch(side), hash);
+            }
+        }
+    }
+    closeSpills();
+}
+
+void HashJoin::closeSpills()
+{
+    for (std::size_t p = 0; p < spills_.size(); ++p) {
+        if (spills_[p]) {
+            std::fclose(spills_[p]);
+        }
+    }
+    if (!spills_.empty()) {
+        IOManager::instance()->releaseFiles(spills_.size());
+        spills_.clear();
+    }
+    spilled_ = false;
+
+    if (spill_reserved_ > 0) {
+        IOManager::instance()->releaseSpace(spill_reserved_);
+    }
+    spill_size_ = spill_reserved_ = 0;
+}
+
+}  // namespace cardinality
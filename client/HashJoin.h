@@ -0,0 +1,139 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_HASHJOIN_H_
+#define CARDINALITY_HASHJOIN_H_
+
+#include <cstdio>
+#include <boost/shared_array.hpp>
+#include "client/Join.h"
+
+// The memory budget of a hash join can be lowered at build time, e.g.
+// with -DHASHJOIN_MEMORY_BUDGET=65536, so that the small inputs of
+// dataBench/Test6 are partitioned to disk. Plans are still costed with
+// the default budget, so that the test runs the same plans.
+#ifndef HASHJOIN_MEMORY_BUDGET
+#define HASHJOIN_MEMORY_BUDGET 16777216
+#endif
+
+
+namespace cardinality {
+
+class HashJoin: public Join {
+public:
+    // constructor, destructor
+    HashJoin(const NodeID, Operator::Ptr, Operator::Ptr,
+             const Query *, const bool = false);
+    explicit HashJoin(google::protobuf::io::CodedInputStream *);
+    HashJoin(const HashJoin &);
+    ~HashJoin();
+    Operator::Ptr clone() const;
+
+    // query execution
+    void Open(const Chunk * = NULL);
+    void ReOpen(const Chunk * = NULL);
+    bool GetNext(Tuple &);
+    void Close();
+
+    // serialization
+    uint8_t *SerializeToArray(uint8_t *) const;
+    int ByteSize() const;
+    void Deserialize(google::protobuf::io::CodedInputStream *);
+
+    // plan exploration
+    void print(std::ostream &, const int, const double) const;
+
+    // cost estimation
+    double estCost(const double = 0.0) const;
+
+    // cardinality feedback
+    void getCardCounts(std::vector<CardCount> &) const;
+
+protected:
+    // helpers for GetNext()
+    Operator::Ptr &child(const int);
+    Tuple &scratch(const int);
+    uint64_t hashKey(const int, const Tuple &) const;
+    void storeTuple(const int, const Tuple &, const uint64_t);
+    void loadTuple(const int, const std::size_t);
+    void buildTable();
+    void reduceLeftInput();
+    void clearTable();
+    bool spillInputs();
+    bool writeSpill(std::FILE *, const int, const Tuple &, const uint64_t);
+    bool readSpill(std::FILE *, const int, uint64_t &);
+    void unspillInputs();
+    void closeSpills();
+
+    // If set, the right input is read first, and a Bloom filter on its
+    // join values is pushed down to the left input before opening it.
+    bool semijoin_;
+    bool left_opened_;
+
+    // execution states
+    enum { STATE_OPEN, STATE_NEXTPART,
+           STATE_GETNEXT, STATE_SWEEPBUCKET } state_;
+    int build_;                         // 0 if the left input is hashed
+    bool done_[2];
+    std::size_t num_bytes_[2];
+    std::vector<Chunk> tuples_[2];      // buffered tuples, column by column
+    std::vector<uint64_t> hashes_[2];
+    std::vector<boost::shared_array<char> > blocks_;
+    char *block_pos_;
+    char *block_end_;
+    struct Bucket {
+        uint32_t tag;                   // upper half of the hash value
+        uint32_t pos;                   // 1 + index of the tuple, 0 if empty
+    };
+    std::vector<Bucket> table_;
+    uint32_t mask_;
+    uint32_t bucket_;
+    uint64_t probe_hash_;
+    std::size_t probe_pos_;
+    bool spilled_;
+    int part_;
+    std::vector<std::FILE *> spills_;   // partitions of both inputs
+    std::vector<char> spill_buffer_;
+    uint64_t spill_size_;               // bytes written to partitions
+    uint64_t spill_reserved_;           // bytes reserved in IOManager
+
+    // constants
+    static const std::size_t HASHJOIN_MEMSIZE = HASHJOIN_MEMORY_BUDGET;
+    static const std::size_t HASHJOIN_COST_MEMSIZE = 16777216;
+    static const int HASHJOIN_BLOCKSIZE = 262144;
+    static const int HASHJOIN_NUM_PARTS = 16;
+    static const double COST_DISK_SPILL_BYTE = 0.000244140625;  // 1/4096
+
+private:
+    HashJoin& operator=(const HashJoin &);
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_HASHJOIN_H_
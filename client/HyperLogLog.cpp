@@ -0,0 +1,95 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/HyperLogLog.h"
+#include <cmath>  // std::log, std::ldexp
+
+
+namespace cardinality {
+
+HyperLogLog::HyperLogLog(const ValueType t)
+    : type_(t),
+      registers_(1 << PRECISION)
+{
+}
+
+HyperLogLog::~HyperLogLog()
+{
+}
+
+// The upper bits of the hash value choose a register, which keeps the
+// largest position of the first 1-bit among the other bits.
+void HyperLogLog::insert(const Chunk &c)
+{
+    uint64_t h = hash(c);
+    uint64_t rest = h << PRECISION;
+    uint8_t rank = (rest == 0)
+                   ? 64 - PRECISION + 1 : __builtin_clzll(rest) + 1;
+    uint8_t &reg = registers_[h >> (64 - PRECISION)];
+    if (reg < rank) {
+        reg = rank;
+    }
+}
+
+void HyperLogLog::merge(const HyperLogLog &other)
+{
+    for (std::size_t i = 0; i < registers_.size(); ++i) {
+        if (registers_[i] < other.registers_[i]) {
+            registers_[i] = other.registers_[i];
+        }
+    }
+}
+
+// Small cardinalities are counted by linear counting on the empty
+// registers. No large range correction is needed with 64-bit hashes.
+double HyperLogLog::estimate() const
+{
+    double m = registers_.size();
+    double sum = 0.0;
+    std::size_t num_zeros = 0;
+    for (std::size_t i = 0; i < registers_.size(); ++i) {
+        sum += std::ldexp(1.0, -registers_[i]);
+        if (registers_[i] == 0) {
+            ++num_zeros;
+        }
+    }
+
+    double est = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    if (est <= 2.5 * m && num_zeros > 0) {
+        est = m * std::log(m / num_zeros);
+    }
+    return est;
+}
+
+uint64_t HyperLogLog::hash(const Chunk &c) const
+{
+    return Operator::finishHash(Operator::hashValue(c, type_));
+}
+
+}  // namespace cardinality
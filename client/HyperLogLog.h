@@ -0,0 +1,67 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_HYPERLOGLOG_H_
+#define CARDINALITY_HYPERLOGLOG_H_
+
+#include <vector>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Represent a HyperLogLog sketch of the distinct values of a column.
+// With 2^PRECISION registers, the standard error of an estimate is
+// 1.04 / sqrt(2^PRECISION), about 1.6%. Sketches of the same column
+// can be merged into a sketch of the union of their values.
+class HyperLogLog {
+public:
+    // constructor, destructor
+    explicit HyperLogLog(const ValueType);
+    ~HyperLogLog();
+
+    // sketch operations
+    void insert(const Chunk &);
+    void merge(const HyperLogLog &);
+    double estimate() const;
+
+private:
+    // Returns a hash value of the given column value.
+    uint64_t hash(const Chunk &) const;
+
+    ValueType type_;
+    std::vector<uint8_t> registers_;
+
+    // constants
+    static const int PRECISION = 12;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_HYPERLOGLOG_H_
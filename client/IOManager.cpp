@@ -28,14 +28,24 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "client/IOManager.h"
+#include <sys/mman.h>  // madvise
+#include <sys/resource.h>  // getrlimit
+#include <unistd.h>  // sysconf
+#include <fstream>
+#include <boost/scoped_array.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/asio/placeholders.hpp>
+#include "client/ColumnStore.h"
+#include "client/IndexMirror.h"
+#include "client/FenceIndex.h"
+#include "client/JoinIndex.h"
 
 
 namespace cardinality {
 
 IOManager *IOManager::instance_ = NULL;
+const char IOManager::SPACE_DIR[] = "/tmp/clientSpace";
 
 void IOManager::start(const NodeID n)
 {
@@ -61,8 +71,15 @@ IOManager::IOManager(const NodeID n)
       acceptor_(io_service_),
       new_connection_(new Connection(io_service_)),
       connection_pool_(), connpool_mutex_(),
-      files_(), files_mutex_()
+      files_(), files_mutex_(),
+      space_used_(), files_used_(), files_limit_(), space_mutex_()
 {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        files_limit_ = (limit.rlim_cur == RLIM_INFINITY)
+                       ? 65536 : limit.rlim_cur / 2;
+    }
+
     boost::asio::ip::tcp::endpoint port(boost::asio::ip::tcp::v4(), 17000 + n);
     acceptor_.open(port.protocol());
     acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
@@ -152,4 +169,250 @@ IOManager::openFile(const std::string &filename)
     return std::make_pair(file->begin(), file->end());
 }
 
+void IOManager::prefetch(const char *begin, const char *end)
+{
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+    char *first_page = reinterpret_cast<char *>(
+                           reinterpret_cast<uintptr_t>(begin)
+                           & ~(page_size - 1));
+    if (first_page < end) {
+        madvise(first_page, end - first_page, MADV_WILLNEED);
+    }
+}
+
+boost::shared_ptr<const ColumnStore>
+IOManager::openColumnStore(const std::string &filename)
+{
+    boost::mutex::scoped_lock lock(stores_mutex_);
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const ColumnStore> >::iterator it
+        = stores_.find(filename);
+    if (it == stores_.end()) {
+        it = stores_.insert(
+                 std::make_pair(filename, ColumnStore::open(filename))).first;
+    }
+    return it->second;
+}
+
+void IOManager::buildIndexMirror(const std::string &name,
+                                 const ValueType type,
+                                 const boost::system_time &deadline)
+{
+    if (openIndexMirror(name)) {
+        return;
+    }
+
+    IndexMirror::Ptr mirror = IndexMirror::build(name, type, deadline);
+    if (mirror) {
+        boost::mutex::scoped_lock lock(mirrors_mutex_);
+        mirrors_[name] = mirror;
+    }
+}
+
+boost::shared_ptr<const IndexMirror>
+IOManager::openIndexMirror(const std::string &name)
+{
+    boost::mutex::scoped_lock lock(mirrors_mutex_);
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const IndexMirror> >::iterator it
+        = mirrors_.find(name);
+    if (it == mirrors_.end()) {
+        return boost::shared_ptr<const IndexMirror>();
+    }
+    return it->second;
+}
+
+// Column indexes share the map of index mirrors, under the same names
+// as the columns of join indexes.
+bool IOManager::buildColumnIndex(const std::string &filename,
+                                 const ColID col, const ValueType type,
+                                 const boost::system_time &deadline)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    return false;
+#else
+    if (openColumnIndex(filename, col)) {
+        return true;
+    }
+
+    IndexMirror::Ptr mirror = IndexMirror::buildColumn(filename, col, type,
+                                                       deadline);
+    if (mirror) {
+        boost::mutex::scoped_lock lock(mirrors_mutex_);
+        mirrors_[JoinIndex::getKey(filename, col)] = mirror;
+    }
+    return mirror.get() != NULL;
+#endif
+}
+
+boost::shared_ptr<const IndexMirror>
+IOManager::openColumnIndex(const std::string &filename, const ColID col)
+{
+    return openIndexMirror(JoinIndex::getKey(filename, col));
+}
+
+bool IOManager::buildFenceIndex(const std::string &filename,
+                                const ValueType type, const char delim,
+                                const boost::system_time &deadline)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    return false;
+#else
+    if (openFenceIndex(filename)) {
+        return true;
+    }
+
+    FenceIndex::Ptr fence = FenceIndex::build(filename, type, delim,
+                                              deadline);
+    if (fence) {
+        boost::mutex::scoped_lock lock(fences_mutex_);
+        fences_[filename] = fence;
+    }
+    return fence.get() != NULL;
+#endif
+}
+
+boost::shared_ptr<const FenceIndex>
+IOManager::openFenceIndex(const std::string &filename)
+{
+    boost::mutex::scoped_lock lock(fences_mutex_);
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const FenceIndex> >::iterator it
+        = fences_.find(filename);
+    if (it == fences_.end()) {
+        return boost::shared_ptr<const FenceIndex>();
+    }
+    return it->second;
+}
+
+bool IOManager::buildJoinIndex(const std::string &name,
+                               const ValueType type,
+                               const boost::system_time &deadline)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    return false;
+#else
+    if (openJoinIndex(name)) {
+        return true;
+    }
+
+    JoinIndex::Ptr index;
+    if (JoinIndex::build(name, type, deadline)) {
+        index = JoinIndex::open(name);
+    }
+
+    boost::mutex::scoped_lock lock(joins_mutex_);
+    joins_[name] = index;
+    return index.get() != NULL;
+#endif
+}
+
+boost::shared_ptr<const JoinIndex>
+IOManager::openJoinIndex(const std::string &name)
+{
+    boost::mutex::scoped_lock lock(joins_mutex_);
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const JoinIndex> >::iterator it
+        = joins_.find(name);
+    if (it == joins_.end()) {
+        it = joins_.insert(
+                 std::make_pair(name, JoinIndex::open(name))).first;
+    }
+    return it->second;
+}
+
+bool IOManager::runPreTask(const PreTaskKind kind,
+                           const std::string &name,
+                           const ValueType type,
+                           const boost::system_time &deadline)
+{
+    switch (kind) {
+    case PRETASK_WARM_FILE:
+        return warmFile(name, deadline);
+
+    case PRETASK_MIRROR_INDEX:
+        buildIndexMirror(name, type, deadline);
+        return openIndexMirror(name).get() != NULL;
+
+    case PRETASK_JOIN_INDEX:
+        return buildJoinIndex(name, type, deadline);
+
+    default:
+        return false;
+    }
+}
+
+bool IOManager::reserveSpace(const uint64_t size, const bool spill)
+{
+    uint64_t limit = spill ? SPACE_LIMIT : SPACE_LIMIT - SPILL_SPACE;
+
+    boost::mutex::scoped_lock lock(space_mutex_);
+    if (space_used_ + size > limit) {
+        return false;
+    }
+    space_used_ += size;
+    return true;
+}
+
+void IOManager::releaseSpace(const uint64_t size)
+{
+    boost::mutex::scoped_lock lock(space_mutex_);
+    space_used_ -= size;
+}
+
+bool IOManager::reserveFiles(const std::size_t num_files)
+{
+    boost::mutex::scoped_lock lock(space_mutex_);
+    if (files_used_ + num_files > files_limit_) {
+        return false;
+    }
+    files_used_ += num_files;
+    return true;
+}
+
+void IOManager::releaseFiles(const std::size_t num_files)
+{
+    boost::mutex::scoped_lock lock(space_mutex_);
+    files_used_ -= num_files;
+}
+
+bool IOManager::warmFile(const std::string &filename,
+                         const boost::system_time &deadline)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    boost::scoped_array<char> buffer(new char[WARM_CHUNK_SIZE]);
+    std::ifstream file(filename.c_str(),
+                       std::ifstream::in | std::ifstream::binary);
+
+    while (file.read(buffer.get(), WARM_CHUNK_SIZE)) {
+        if (boost::get_system_time() >= deadline) {
+            return false;
+        }
+    }
+    return true;
+#else
+    static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+
+    std::pair<const char *, const char *> file = openFile(filename);
+
+    // touch a byte of every page after asking the kernel for the chunk
+    for (const char *chunk = file.first; chunk < file.second;
+         chunk += WARM_CHUNK_SIZE) {
+        if (boost::get_system_time() >= deadline) {
+            return false;
+        }
+
+        const char *chunk_end
+            = (static_cast<std::size_t>(file.second - chunk) > WARM_CHUNK_SIZE)
+              ? chunk + WARM_CHUNK_SIZE : file.second;
+        prefetch(chunk, chunk_end);
+        for (const char *page = chunk; page < chunk_end; page += page_size) {
+            *static_cast<volatile const char *>(page);
+        }
+    }
+    return true;
+#endif
+}
+
 }  // namespace cardinality
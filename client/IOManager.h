@@ -38,11 +38,19 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "include/client.h"
 #include "client/Connection.h"
 
 
 namespace cardinality {
 
+class ColumnStore;
+class IndexMirror;
+class FenceIndex;
+class JoinIndex;
+
+typedef uint16_t ColID;  // Operator.h
 typedef uint32_t NodeID;  // Operator.h
 typedef boost::shared_ptr<boost::asio::ip::tcp::socket> tcpsocket_ptr;
 typedef boost::shared_ptr<boost::iostreams::mapped_file_source> mapped_file_ptr;
@@ -69,6 +77,88 @@ public:
     // Multiple calls to openFile return the same addresses.
     std::pair<const char *, const char *> openFile(const std::string &);
 
+    // Ask the kernel to read the pages of the given range of an opened
+    // file in the background. As the mapping of a file is shared by all
+    // the operators reading it, only the ranges about to be read are
+    // advised, and no access pattern is set on the whole mapping.
+    static void prefetch(const char *, const char *);
+
+    // Open the column store of a file if any.
+    // Multiple calls to openColumnStore return the same store.
+    boost::shared_ptr<const ColumnStore> openColumnStore(const std::string &);
+
+    // Build the mirror of an index during pretreatment unless already
+    // built. Gives up if the mirror cannot be built by the given deadline.
+    void buildIndexMirror(const std::string &, const ValueType,
+                          const boost::system_time &);
+
+    // Get the mirror of the given index if any.
+    boost::shared_ptr<const IndexMirror> openIndexMirror(const std::string &);
+
+    // Index a column of a file without a secondary index during
+    // pretreatment unless already indexed, given the type of the column.
+    // Returns true if the column has such an index.
+    bool buildColumnIndex(const std::string &, const ColID, const ValueType,
+                          const boost::system_time &);
+
+    // Get the index built by buildColumnIndex() if any.
+    boost::shared_ptr<const IndexMirror> openColumnIndex(const std::string &,
+                                                         const ColID);
+
+    // Build the fence index of a file during pretreatment unless already
+    // built, given the type of the primary key and the delimiter after it.
+    // Returns true if the file has a fence index.
+    bool buildFenceIndex(const std::string &, const ValueType, const char,
+                         const boost::system_time &);
+
+    // Get the fence index of the given file if any.
+    boost::shared_ptr<const FenceIndex> openFenceIndex(const std::string &);
+
+    // Build the join index of the given name during pretreatment unless
+    // already built, given the type of the join columns.
+    // Returns true if the join index exists.
+    bool buildJoinIndex(const std::string &, const ValueType,
+                        const boost::system_time &);
+
+    // Get the join index of the given name if any.
+    // Multiple calls to openJoinIndex return the same join index.
+    boost::shared_ptr<const JoinIndex> openJoinIndex(const std::string &);
+
+    // Pretreatment tasks that the master schedules on each node: reading
+    // a file into the page cache, mirroring an index whose mirror could
+    // not be built during statistics gathering, and building a join
+    // index for a join condition of the preset queries.
+    enum PreTaskKind { PRETASK_WARM_FILE, PRETASK_MIRROR_INDEX,
+                       PRETASK_JOIN_INDEX };
+
+    // Run a pretreatment task on a file, an index or a join index by the
+    // given deadline.
+    // Returns false if the task could not be finished in time.
+    bool runPreTask(const PreTaskKind, const std::string &, const ValueType,
+                    const boost::system_time &);
+
+    // Reserve disk space in SPACE_DIR, which is shared by the column
+    // stores and join indexes built during pretreatment and the
+    // partitions spilled by hash joins. Pretreatment may use all but
+    // SPILL_SPACE of SPACE_LIMIT, so that spills always have room.
+    // Returns false if the given number of bytes cannot be reserved.
+    bool reserveSpace(const uint64_t, const bool = false);
+
+    // Release disk space reserved by reserveSpace().
+    void releaseSpace(const uint64_t);
+
+    // Reserve file descriptors for the partitions spilled by hash joins,
+    // which may take up to half of RLIMIT_NOFILE so that sockets and
+    // other files still have room.
+    // Returns false if the given number of files cannot be reserved.
+    bool reserveFiles(const std::size_t);
+
+    // Release file descriptors reserved by reserveFiles().
+    void releaseFiles(const std::size_t);
+
+    // directory for the files built by the client
+    static const char SPACE_DIR[];
+
 private:
     // constructor, destructor
     explicit IOManager(const NodeID);
@@ -81,6 +171,9 @@ private:
     // wrapper for io_service.run()
     void run();
 
+    // Read a file chunk by chunk until the deadline.
+    bool warmFile(const std::string &, const boost::system_time &);
+
     // Asynchronous callback for establishing an incoming TCP connection.
     // Call Connection::start() to handle the connection in a new thread.
     void handle_accept(const boost::system::error_code &);
@@ -98,8 +191,39 @@ private:
     std::tr1::unordered_map<std::string, mapped_file_ptr> files_;
     boost::mutex files_mutex_;
 
+    // open column stores, including NULL for files without stores
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const ColumnStore> > stores_;
+    boost::mutex stores_mutex_;
+
+    // index mirrors
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const IndexMirror> > mirrors_;
+    boost::mutex mirrors_mutex_;
+
+    // fence indexes
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const FenceIndex> > fences_;
+    boost::mutex fences_mutex_;
+
+    // open join indexes, including NULL for those not built
+    std::tr1::unordered_map<std::string,
+                            boost::shared_ptr<const JoinIndex> > joins_;
+    boost::mutex joins_mutex_;
+
+    // disk space and spill files reserved in SPACE_DIR
+    uint64_t space_used_;
+    std::size_t files_used_;
+    std::size_t files_limit_;
+    boost::mutex space_mutex_;
+
     // singletone instance
     static IOManager *instance_;
+
+    // constants
+    static const std::size_t WARM_CHUNK_SIZE = 1 << 20;
+    static const uint64_t SPACE_LIMIT = 10ULL << 30;
+    static const uint64_t SPILL_SPACE = 2ULL << 30;
 };
 
 }  // namespace cardinality
@@ -0,0 +1,353 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/IndexMirror.h"
+#include <cstring>
+#include <algorithm>  // std::sort, std::min
+#include "lib/index/include/server.h"
+#include "client/IOManager.h"
+#include "client/Tokenizer.h"
+
+
+namespace cardinality {
+
+uint64_t IndexMirror::space_used_ = 0;
+uint64_t IndexMirror::column_space_used_ = 0;
+boost::mutex IndexMirror::space_mutex_;
+
+IndexMirror::IndexMirror(const ValueType type)
+    : type_(type),
+      int_keys_(),
+      key_offsets_(1, 0),
+      heap_(),
+      postings_(),
+      addrs_()
+{
+}
+
+IndexMirror::~IndexMirror()
+{
+}
+
+// Copy all entries of the index in a single transaction. The entries
+// are returned in ascending order of keys, and the addresses of each key
+// are sorted when the next key is found.
+IndexMirror::Ptr IndexMirror::build(const std::string &name,
+                                    const ValueType type,
+                                    const boost::system_time &deadline)
+{
+    Index *index;
+    TxnState *txn;
+    Record record;
+
+    if (openIndex(name.c_str(), &index) != SUCCESS) {
+        return Ptr();
+    }
+
+    IndexMirror *mirror = new IndexMirror(type);
+    bool ok = true;
+
+    beginTransaction(&txn);
+
+    for (uint32_t num_entries = 0;
+         getNext(index, txn, &record) == SUCCESS; ++num_entries) {
+        if (num_entries % MIRROR_CHECK_INTERVAL == 0) {
+            if (boost::get_system_time() > deadline) {
+                ok = false;
+                break;
+            }
+
+            boost::mutex::scoped_lock lock(space_mutex_);
+            if (space_used_ + mirror->space() > MIRROR_SPACE_LIMIT) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (!mirror->append((type == INT) ? record.val.intVal
+                                          : std::strlen(record.val.charVal),
+                            record.val.charVal, record.address)) {
+            ok = false;
+            break;
+        }
+    }
+
+    commitTransaction(txn);
+    closeIndex(index);
+
+    if (ok) {
+        mirror->finish();
+
+        boost::mutex::scoped_lock lock(space_mutex_);
+        if (space_used_ + mirror->space() <= MIRROR_SPACE_LIMIT) {
+            space_used_ += mirror->space();
+            return Ptr(mirror);
+        }
+    }
+
+    delete mirror;
+    return Ptr();
+}
+
+// a value of the indexed column and the file offset of its row
+struct ColumnEntry {
+    const char *charval;
+    uint32_t intval;  // length of charval if STRING
+    uint64_t addr;
+};
+
+// Order column entries by value, and by address among equal values.
+class LessColumnEntry {
+public:
+    explicit LessColumnEntry(const ValueType type) : type_(type) {}
+
+    bool operator()(const ColumnEntry &a, const ColumnEntry &b) const
+    {
+        int cmp = Operator::compareKey(type_, a.intval, a.charval,
+                                       b.intval, b.charval);
+        return cmp < 0 || (cmp == 0 && a.addr < b.addr);
+    }
+
+private:
+    ValueType type_;
+};
+
+// Scan the whole partition for the values of the column, and sort them
+// with the offsets of their rows. The sort buffer is charged against
+// the space limits until the index is built, as it is larger than the
+// index, and grows only as far as they allow.
+IndexMirror::Ptr IndexMirror::buildColumn(const std::string &filename,
+                                          const ColID col,
+                                          const ValueType type,
+                                          const boost::system_time &deadline)
+{
+    std::pair<const char *, const char *> file
+        = IOManager::instance()->openFile(filename);
+    std::vector<ColumnEntry> entries;
+    std::vector<const char *> delims(col + 1);
+    uint64_t charged = 0;  // space of the sort buffer
+    bool ok = true;
+
+    for (const char *pos = file.first; pos < file.second; ) {
+        if (entries.size() % MIRROR_CHECK_INTERVAL == 0
+            && boost::get_system_time() > deadline) {
+            ok = false;
+            break;
+        }
+
+        // grow the sort buffer as far as the space limits allow
+        if (entries.size() == entries.capacity()) {
+            boost::mutex::scoped_lock lock(space_mutex_);
+            uint64_t avail = MIRROR_SPACE_LIMIT - space_used_;
+            if (avail > COLUMN_SPACE_LIMIT - column_space_used_) {
+                avail = COLUMN_SPACE_LIMIT - column_space_used_;
+            }
+            avail += charged;
+            uint64_t capacity = 2 * entries.size() + MIRROR_CHECK_INTERVAL;
+            if (capacity * sizeof(ColumnEntry) > avail) {
+                capacity = avail / sizeof(ColumnEntry);
+            }
+            if (capacity <= entries.size()) {
+                ok = false;
+                break;
+            }
+            entries.reserve(capacity);
+
+            uint64_t space = sizeof(ColumnEntry) * entries.capacity();
+            space_used_ += space - charged;
+            column_space_used_ += space - charged;
+            charged = space;
+        }
+
+        if (splitLine(pos, file.second, col + 1, '\n', &delims[0]) == NULL) {
+            ok = false;
+            break;
+        }
+
+        ColumnEntry entry;
+        entry.charval = (col == 0) ? pos : delims[col - 1] + 1;
+        entry.intval = delims[col] - entry.charval;
+        entry.addr = pos - file.first;
+        if (type == INT) {
+            Chunk value(entry.charval, entry.intval);
+            entry.intval = Operator::parseInt(&value);
+        }
+        entries.push_back(entry);
+
+        const char *eol = (*delims[col] == '\n')
+                          ? delims[col]
+                          : static_cast<const char *>(
+                                std::memchr(delims[col], '\n',
+                                            file.second - delims[col]));
+        pos = eol ? eol + 1 : file.second;
+    }
+
+    IndexMirror *mirror = NULL;
+    if (ok) {
+        std::sort(entries.begin(), entries.end(), LessColumnEntry(type));
+
+        mirror = new IndexMirror(type);
+        mirror->addrs_.reserve(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            mirror->append(entries[i].intval, entries[i].charval,
+                           entries[i].addr);
+        }
+        mirror->finish();
+    }
+
+    std::vector<ColumnEntry>().swap(entries);
+
+    boost::mutex::scoped_lock lock(space_mutex_);
+    space_used_ -= charged;
+    column_space_used_ -= charged;
+    if (mirror != NULL
+        && space_used_ + mirror->space() <= MIRROR_SPACE_LIMIT
+        && column_space_used_ + mirror->space() <= COLUMN_SPACE_LIMIT) {
+        space_used_ += mirror->space();
+        column_space_used_ += mirror->space();
+        return Ptr(mirror);
+    }
+
+    delete mirror;
+    return Ptr();
+}
+
+bool IndexMirror::append(const uint32_t intval, const char *charval,
+                         const uint64_t addr)
+{
+    int cmp = 1;
+
+    // compare with the last key
+    if (!postings_.empty()) {
+        cmp = compareKey(intval, charval, postings_.size() - 1);
+        if (cmp < 0) {
+            return false;
+        }
+    }
+
+    // a new key
+    if (cmp > 0) {
+        if (!postings_.empty()) {
+            std::sort(addrs_.begin() + postings_.back(), addrs_.end());
+        }
+        postings_.push_back(addrs_.size());
+
+        if (type_ == INT) {
+            int_keys_.push_back(intval);
+        } else {  // STRING
+            heap_.insert(heap_.end(), charval, charval + intval);
+            key_offsets_.push_back(heap_.size());
+        }
+    }
+
+    addrs_.push_back(addr);
+    return true;
+}
+
+void IndexMirror::finish()
+{
+    if (!postings_.empty()) {
+        std::sort(addrs_.begin() + postings_.back(), addrs_.end());
+    }
+    postings_.push_back(addrs_.size());
+}
+
+std::size_t IndexMirror::numKeys() const
+{
+    return postings_.size() - 1;
+}
+
+std::size_t IndexMirror::numAddrs() const
+{
+    return addrs_.size();
+}
+
+std::pair<const uint64_t *, const uint64_t *>
+IndexMirror::findEqual(const uint32_t intval, const char *charval) const
+{
+    std::size_t i = searchKey(intval, charval, false);
+    if (i == numKeys() || compareKey(intval, charval, i)) {
+        return std::pair<const uint64_t *, const uint64_t *>();
+    }
+
+    return std::make_pair(&addrs_[0] + postings_[i],
+                          &addrs_[0] + postings_[i + 1]);
+}
+
+std::pair<const uint64_t *, const uint64_t *>
+IndexMirror::findGreater(const uint32_t intval, const char *charval) const
+{
+    std::size_t i = searchKey(intval, charval, true);
+    if (i == numKeys()) {
+        return std::pair<const uint64_t *, const uint64_t *>();
+    }
+
+    return std::make_pair(&addrs_[0] + postings_[i],
+                          &addrs_[0] + addrs_.size());
+}
+
+std::size_t IndexMirror::searchKey(const uint32_t intval,
+                                   const char *charval,
+                                   const bool greater) const
+{
+    std::size_t lo = 0;
+    std::size_t hi = numKeys();
+
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        int cmp = compareKey(intval, charval, mid);
+        if (cmp > 0 || (greater && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+int IndexMirror::compareKey(const uint32_t intval, const char *charval,
+                            const std::size_t i) const
+{
+    if (type_ == INT) {
+        return Operator::compareKey(INT, intval, NULL, int_keys_[i], NULL);
+    }
+    return Operator::compareKey(STRING, intval, charval,
+                                key_offsets_[i + 1] - key_offsets_[i],
+                                &heap_[0] + key_offsets_[i]);
+}
+
+uint64_t IndexMirror::space() const
+{
+    return 4 * (static_cast<uint64_t>(int_keys_.capacity())
+                + key_offsets_.capacity() + postings_.capacity())
+           + heap_.capacity() + 8 * static_cast<uint64_t>(addrs_.capacity());
+}
+
+}  // namespace cardinality
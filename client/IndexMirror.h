@@ -0,0 +1,127 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_INDEXMIRROR_H_
+#define CARDINALITY_INDEXMIRROR_H_
+
+#include <string>
+#include <vector>
+#include <utility>  // std::pair
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Represent a read-only copy of a secondary index, built during
+// pretreatment since indexes never change after loading. Keys are kept
+// in a sorted array, and the addresses of each key in a sorted run of
+// a posting array, so that IndexScan finds addresses by binary search
+// without transactions or index locks.
+class IndexMirror {
+public:
+    typedef boost::shared_ptr<const IndexMirror> Ptr;
+
+    // Copy the index of the given name and key type as long as
+    // MIRROR_SPACE_LIMIT allows. Gives up if the copy cannot finish by
+    // the given deadline. Returns NULL if no mirror has been built.
+    static Ptr build(const std::string &, const ValueType,
+                     const boost::system_time &);
+
+    // Index the given column of a file that has no secondary index, as
+    // long as both COLUMN_SPACE_LIMIT and MIRROR_SPACE_LIMIT allow.
+    // Gives up if the index cannot be built by the given deadline.
+    // Returns NULL if no index has been built.
+    static Ptr buildColumn(const std::string &, const ColID, const ValueType,
+                           const boost::system_time &);
+
+    // destructor
+    ~IndexMirror();
+
+    // accessors
+    std::size_t numKeys() const;
+    std::size_t numAddrs() const;
+
+    // Find the addresses of the entries whose keys are equal to or
+    // greater than the given key. A STRING key is given by its length
+    // and characters. The addresses of each key are sorted.
+    std::pair<const uint64_t *, const uint64_t *>
+        findEqual(const uint32_t, const char * = NULL) const;
+    std::pair<const uint64_t *, const uint64_t *>
+        findGreater(const uint32_t, const char * = NULL) const;
+
+private:
+    // constructor called by build()
+    explicit IndexMirror(const ValueType);
+
+    // non-copyable
+    IndexMirror(const IndexMirror &);
+    IndexMirror& operator=(const IndexMirror &);
+
+    // Append an entry given by its key and address. A STRING key is
+    // given by its length and characters.
+    // Returns false if the entries are not in ascending order.
+    bool append(const uint32_t, const char *, const uint64_t);
+
+    // Sort the addresses of the last key and close the postings.
+    void finish();
+
+    // Compare the given key with the i-th key.
+    int compareKey(const uint32_t, const char *, const std::size_t) const;
+
+    // Returns the position of the first key not less than (or greater
+    // than if the flag is set) the given key.
+    std::size_t searchKey(const uint32_t, const char *, const bool) const;
+
+    // Returns the number of bytes used by this mirror.
+    uint64_t space() const;
+
+    ValueType type_;
+    std::vector<uint32_t> int_keys_;
+    std::vector<uint32_t> key_offsets_;  // offsets into heap_, STRING only
+    std::vector<char> heap_;
+    std::vector<uint32_t> postings_;  // offsets into addrs_
+    std::vector<uint64_t> addrs_;
+
+    // space used by mirrors of this node
+    static uint64_t space_used_;
+    static uint64_t column_space_used_;
+    static boost::mutex space_mutex_;
+
+    // constants
+    static const uint64_t MIRROR_SPACE_LIMIT = 2ULL << 30;
+    static const uint64_t COLUMN_SPACE_LIMIT = 512ULL << 20;
+    static const uint32_t MIRROR_CHECK_INTERVAL = 65536;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_INDEXMIRROR_H_
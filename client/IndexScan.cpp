@@ -30,9 +30,10 @@
 #include "client/IndexScan.h"
 #include <cstring>
 #include <stdexcept>  // std::runtime_error
-#include <algorithm>  // std::sort, std::min
+#include <algorithm>  // std::sort, std::min, std::max
 #include <google/protobuf/wire_format_lite_inl.h>
 #include "client/IOManager.h"
+#include "client/JoinIndex.h"
 
 
 namespace cardinality {
@@ -43,7 +44,9 @@ IndexScan::IndexScan(const NodeID n, const char *f, const char *a,
     : Scan(n, f, a, t, p, q),
       index_col_(), index_col_type_(),
       comp_op_(), value_(NULL), index_col_id_(),
-      index_(), addrs_(), i_()
+      index_(), mirror_(), fence_(), addrs_(), i_(),
+      prefetch_pos_(), prefetch_end_(),
+      lookup_values_(), lookup_pos_()
 {
     if (col) {  // nested-loop index join
         const char *dot = std::strchr(col, '.');
@@ -57,18 +60,25 @@ IndexScan::IndexScan(const NodeID n, const char *f, const char *a,
         index_col_type_ = getColType(col);
         index_col_id_ = getInputColID(col);
     } else {
-        for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
-            ColName col = table_->fieldsName[gteq_conds_[i].get<1>()];
-            if (col[0] == '_') {
-                index_col_ = table_->tableName;
-                index_col_ += '.';
-                index_col_ += col;
-                comp_op_ = gteq_conds_[i].get<2>();
-                value_ = gteq_conds_[i].get<0>();
-                index_col_type_ = value_->type;
-                index_col_id_ = gteq_conds_[i].get<1>();
-                gteq_conds_.erase(gteq_conds_.begin() + i);
-                break;
+        // an indexed column first, and then a column indexed by the
+        // client during pretreatment
+        for (int pass = 0; pass < 2 && index_col_.empty(); ++pass) {
+            for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+                ColID id = gteq_conds_[i].get<1>();
+                ColName col = table_->fieldsName[id];
+                if ((pass == 0)
+                    ? col[0] == '_'
+                    : stats_ && stats_->hasColumnIndex(id)) {
+                    index_col_ = table_->tableName;
+                    index_col_ += '.';
+                    index_col_ += col;
+                    comp_op_ = gteq_conds_[i].get<2>();
+                    value_ = gteq_conds_[i].get<0>();
+                    index_col_type_ = value_->type;
+                    index_col_id_ = id;
+                    gteq_conds_.erase(gteq_conds_.begin() + i);
+                    break;
+                }
             }
         }
 
@@ -82,7 +92,9 @@ IndexScan::IndexScan(google::protobuf::io::CodedInputStream *input)
     : Scan(input),
       index_col_(), index_col_type_(),
       comp_op_(), value_(NULL), index_col_id_(),
-      index_(), addrs_(), i_()
+      index_(), mirror_(), fence_(), addrs_(), i_(),
+      prefetch_pos_(), prefetch_end_(),
+      lookup_values_(), lookup_pos_()
 {
     Deserialize(input);
 }
@@ -91,8 +103,14 @@ IndexScan::IndexScan(const IndexScan &x)
     : Scan(x),
       index_col_(x.index_col_), index_col_type_(x.index_col_type_),
       comp_op_(x.comp_op_), value_(x.value_), index_col_id_(x.index_col_id_),
-      index_(), addrs_(), i_()
+      index_(), mirror_(), fence_(), addrs_(), i_(),
+      prefetch_pos_(), prefetch_end_(),
+      lookup_values_(), lookup_pos_()
 {
+    // copy objects allocated by Deserialize()
+    if (alias_.empty() && value_) {
+        value_ = new Value(*value_);
+    }
 }
 
 IndexScan::~IndexScan()
@@ -115,29 +133,42 @@ void IndexScan::Open(const Chunk *join_value)
     file_.open(filename_.c_str(), std::ifstream::in | std::ifstream::binary);
 #else
     file_ = IOManager::instance()->openFile(filename_);
+    openColumnStore();
 #endif
     input_tuple_.reserve(num_input_cols_);
-    openIndex(index_col_.c_str(), &index_);
+    initParse();
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    if (index_col_id_ == 0) {
+        fence_ = IOManager::instance()->openFenceIndex(filename_);
+    }
+#endif
+    if (!fence_) {
+        mirror_ = IOManager::instance()->openIndexMirror(index_col_);
+    }
+    if (!fence_ && !mirror_) {
+        mirror_ = IOManager::instance()->openColumnIndex(filename_,
+                                                         index_col_id_);
+    }
+    if (!fence_ && !mirror_) {
+        openIndex(index_col_.c_str(), &index_);
+    }
 
     ReOpen(join_value);
 }
 
 void IndexScan::ReOpen(const Chunk *join_value)
 {
-    TxnState *txn;
-    Record record;
-    bool check_index_cond = true;
     uint32_t key_intval;
     const char *key_charval = NULL;
 
-    record.val.type = index_col_type_;
+    resetCardCount();
+
     if (index_col_type_ == INT) {
         if (join_value) {
             key_intval = parseInt(join_value);
         } else {
             key_intval = value_->intVal;
         }
-        record.val.intVal = key_intval;
     } else {  // STRING
         if (join_value) {
             key_charval = join_value->first;
@@ -146,12 +177,64 @@ void IndexScan::ReOpen(const Chunk *join_value)
             key_charval = value_->charVal;
             key_intval = value_->intVal;
         }
-        std::memcpy(record.val.charVal, key_charval, key_intval);
-        record.val.charVal[key_intval] = '\0';
     }
 
     addrs_.clear();
     i_ = 0;
+    prefetch_pos_ = 0;
+    prefetch_end_ = NULL;
+
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    if (fence_) {
+        std::pair<uint64_t, uint64_t> range
+            = (comp_op_ == EQ)
+              ? fence_->findEqual(key_intval, key_charval)
+              : fence_->findGreater(key_intval, key_charval);
+        const char *pos = file_.first + range.first;
+        while (pos < file_.first + range.second) {
+            addrs_.push_back(pos - file_.first);
+            pos = 1 + static_cast<const char *>(rawmemchr(pos, '\n'));
+        }
+    } else
+#endif
+    if (mirror_) {
+        std::pair<const uint64_t *, const uint64_t *> range
+            = (comp_op_ == EQ)
+              ? mirror_->findEqual(key_intval, key_charval)
+              : mirror_->findGreater(key_intval, key_charval);
+        addrs_.assign(range.first, range.second);
+        if (comp_op_ == GT) {
+            std::sort(addrs_.begin(), addrs_.end());
+        }
+    } else {
+        probeIndex(key_intval, key_charval);
+    }
+
+    // every num_slices_-th tuple belongs to this slice
+    if (num_slices_ > 1) {
+        std::size_t n = 0;
+        for (std::size_t j = slice_; j < addrs_.size(); j += num_slices_) {
+            addrs_[n++] = addrs_[j];
+        }
+        addrs_.resize(n);
+    }
+}
+
+// Look up the index for the addresses matching the given key.
+void IndexScan::probeIndex(const uint32_t key_intval,
+                           const char *key_charval)
+{
+    TxnState *txn;
+    Record record;
+    bool check_index_cond = true;
+
+    record.val.type = index_col_type_;
+    if (index_col_type_ == INT) {
+        record.val.intVal = key_intval;
+    } else {  // STRING
+        std::memcpy(record.val.charVal, key_charval, key_intval);
+        record.val.charVal[key_intval] = '\0';
+    }
 
     beginTransaction(&txn);
     ErrCode ec = get(index_, txn, &record);
@@ -223,27 +306,136 @@ commit:
 
 bool IndexScan::GetNext(Tuple &tuple)
 {
+    bool match;
+
     while (i_ < addrs_.size()) {
 #ifdef DISABLE_MEMORY_MAPPED_IO
         file_.seekg(addrs_[i_++], std::ios::beg);
         file_.getline(buffer_.get(), 4096);
-        parseLine(buffer_.get());
+        parseLine(buffer_.get(), match);
 #else
-        parseLine(file_.first + addrs_[i_++]);
+        prefetchAhead();
+        if (store_ && !execStoreFilter(store_->findRow(addrs_[i_]))) {
+            ++i_;
+            continue;
+        }
+        parseLine(file_.first + addrs_[i_++], match);
 #endif
 
-        if (execFilter(input_tuple_)) {
+        if (match && execFilter(input_tuple_)) {
             execProject(input_tuple_, tuple);
             return false;
         }
     }
 
-    return true;
+    return finishOutput(true);
+}
+
+bool IndexScan::GetNextBatch(TupleBatch &batch)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    return Operator::GetNextBatch(batch);
+#else
+    bool done;
+
+    do {
+        input_batch_.reset(num_parsed_cols_);
+        while (i_ < addrs_.size()
+               && input_batch_.num_rows < OPERATOR_BATCHSIZE) {
+            prefetchAhead();
+            if (store_ && !execStoreFilter(store_->findRow(addrs_[i_]))) {
+                ++i_;
+                continue;
+            }
+            parseLine(file_.first + addrs_[i_++], input_batch_);
+        }
+        done = i_ == addrs_.size();
+
+        input_batch_.selectAll();
+        execFilter(input_batch_);
+    } while (input_batch_.sel.empty() && !done);
+
+    execProject(input_batch_, batch);
+    return finishOutput(done);
+#endif
+}
+
+#ifndef DISABLE_MEMORY_MAPPED_IO
+// Prefetch the lines of the next INDEXSCAN_PREFETCH_DEPTH addresses after
+// the current one, so that the kernel reads them while the current line
+// is being processed. Nearby lines are prefetched by a single call, and
+// prefetching resumes when half of the prefetched lines are consumed.
+void IndexScan::prefetchAhead()
+{
+    if (prefetch_pos_ > i_ + INDEXSCAN_PREFETCH_DEPTH / 2) {
+        return;
+    }
+
+    std::size_t end = std::min(i_ + 1 + INDEXSCAN_PREFETCH_DEPTH,
+                               addrs_.size());
+    const char *run_begin = NULL;
+    const char *run_end = NULL;
+
+    for (prefetch_pos_ = std::max(prefetch_pos_, i_ + 1);
+         prefetch_pos_ < end; ++prefetch_pos_) {
+        const char *line = std::max(file_.first + addrs_[prefetch_pos_],
+                                    prefetch_end_);
+        const char *line_end
+            = std::min(file_.first + addrs_[prefetch_pos_]
+                       + INDEXSCAN_PREFETCH_SIZE, file_.second);
+        if (line >= line_end) {
+            continue;
+        }
+
+        if (run_begin && line - run_end > INDEXSCAN_PREFETCH_GAP) {
+            IOManager::prefetch(run_begin, run_end);
+            run_begin = NULL;
+        }
+        if (run_begin == NULL) {
+            run_begin = line;
+        }
+        run_end = prefetch_end_ = line_end;
+    }
+
+    if (run_begin) {
+        IOManager::prefetch(run_begin, run_end);
+    }
+}
+#endif
+
+void IndexScan::OpenLookup(const std::vector<Chunk> &join_values)
+{
+    lookup_values_ = join_values;
+    lookup_pos_ = 0;
+    Open(&lookup_values_[0]);
+}
+
+void IndexScan::ReOpenLookup(const std::vector<Chunk> &join_values)
+{
+    lookup_values_ = join_values;
+    lookup_pos_ = 0;
+    ReOpen(&lookup_values_[0]);
+}
+
+// The join values are looked up one by one.
+bool IndexScan::GetNextLookup(Tuple &tuple, uint32_t &pos)
+{
+    while (GetNext(tuple)) {
+        if (++lookup_pos_ == lookup_values_.size()) {
+            return true;
+        }
+        ReOpen(&lookup_values_[lookup_pos_]);
+    }
+
+    pos = lookup_pos_;
+    return false;
 }
 
 void IndexScan::Close()
 {
-    closeIndex(index_);
+    if (!fence_ && !mirror_) {
+        closeIndex(index_);
+    }
 #ifdef DISABLE_MEMORY_MAPPED_IO
     file_.close();
     buffer_.reset();
@@ -356,6 +548,24 @@ void IndexScan::print(std::ostream &os, const int tab, const double lcard) const
     os << std::endl;
 }
 
+// Only the inner plan of nested-loop index join has no constant.
+std::string IndexScan::getJoinIndexKey(const ColID) const
+{
+    if (value_) {
+        return std::string();
+    }
+    return JoinIndex::getKey(filename_, index_col_id_);
+}
+
+void IndexScan::rebind(const Query *from, const Query *to)
+{
+    Scan::rebind(from, to);
+
+    if (value_) {
+        value_ = rebindValue(value_, from, to);
+    }
+}
+
 // Mackert and Lohman,
 // Index Scans Using a Finite LRU Buffer: A Validated I/O Model,
 // ACM Transactions on Database Systems, Vol. 14, No. 3, September 1989, p.411
@@ -395,16 +605,17 @@ double IndexScan::estCost(const double lcard) const
                 seq_pages = MACKERT_LOHMAN(stats_->num_pages_, 1.0);
             } else {
                 double num_dups = stats_->num_distinct_values_[0]
-                                  / stats_->num_distinct_values_[index_col_id_];
+                                  * estSelectivity(index_col_id_, value_, EQ);
                 random_pages = MACKERT_LOHMAN(stats_->num_pages_, num_dups);
             }
         } else {  // GT
+            double sel = estSelectivity(index_col_id_, value_, GT);
             if (index_col_id_ == 0) {
-                seq_pages = stats_->num_pages_ * SELECTIVITY_GT;
+                seq_pages = stats_->num_pages_ * sel;
             } else {
                 random_pages = MACKERT_LOHMAN(stats_->num_pages_,
                                               stats_->num_distinct_values_[0]
-                                              * SELECTIVITY_GT);
+                                              * sel);
             }
         }
     }
@@ -415,22 +626,16 @@ double IndexScan::estCost(const double lcard) const
 
 double IndexScan::estCardinality(const bool nlij) const
 {
-    double card = stats_->num_distinct_values_[0];
+    double card = stats_->num_distinct_values_[0] * card_factor_;
 
     if (value_) {
-        if (comp_op_ == EQ) {
-            card /= stats_->num_distinct_values_[index_col_id_];
-        } else {  // GT
-            card *= SELECTIVITY_GT;
-        }
+        card *= estSelectivity(index_col_id_, value_, comp_op_);
     }
 
     for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
-        if (gteq_conds_[i].get<2>() == EQ) {
-            card /= stats_->num_distinct_values_[gteq_conds_[i].get<1>()];
-        } else {  // GT
-            card *= SELECTIVITY_GT;
-        }
+        card *= estSelectivity(gteq_conds_[i].get<1>(),
+                               gteq_conds_[i].get<0>(),
+                               gteq_conds_[i].get<2>());
     }
 
     if (!join_conds_.empty()) {
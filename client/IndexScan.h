@@ -32,7 +32,10 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>  // std::ptrdiff_t
 #include "client/Scan.h"
+#include "client/IndexMirror.h"
+#include "client/FenceIndex.h"
 #include "lib/index/include/server.h"
 
 
@@ -53,7 +56,11 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
+    void OpenLookup(const std::vector<Chunk> &);
+    void ReOpenLookup(const std::vector<Chunk> &);
+    bool GetNextLookup(Tuple &, uint32_t &);
 
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
@@ -62,12 +69,24 @@ public:
 
     // plan exploration
     void print(std::ostream &, const int, const double) const;
+    std::string getJoinIndexKey(const ColID) const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estCost(const double = 0.0) const;
     double estCardinality(const bool = false) const;
 
 protected:
+    // helper for ReOpen()
+    void probeIndex(const uint32_t, const char *);
+
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    // helper for GetNext()
+    void prefetchAhead();
+#endif
+
     // operator description
     std::string index_col_;
     ValueType index_col_type_;
@@ -77,8 +96,19 @@ protected:
 
     // execution states
     Index *index_;
+    IndexMirror::Ptr mirror_;
+    FenceIndex::Ptr fence_;
     std::vector<uint64_t> addrs_;
     std::size_t i_;
+    std::size_t prefetch_pos_;
+    const char *prefetch_end_;
+    std::vector<Chunk> lookup_values_;
+    uint32_t lookup_pos_;
+
+    // constants
+    static const std::size_t INDEXSCAN_PREFETCH_DEPTH = 16;
+    static const std::size_t INDEXSCAN_PREFETCH_SIZE = 512;
+    static const std::ptrdiff_t INDEXSCAN_PREFETCH_GAP = 65536;
 
 private:
     IndexScan& operator=(const IndexScan &);
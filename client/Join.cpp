@@ -30,6 +30,7 @@
 #include "client/Join.h"
 #include <cstring>
 #include <algorithm>  // std::max
+#include <set>
 #include "client/PartStats.h"
 
 
@@ -41,7 +42,8 @@ Join::Join(const NodeID n, Operator::Ptr l, Operator::Ptr r,
       left_child_(l),
       right_child_(r),
       join_conds_(),
-      left_tuple_(), right_tuple_()
+      left_tuple_(), right_tuple_(),
+      left_batch_(), right_batch_()
 {
     initProject(q);
     initFilter(q, x);
@@ -52,7 +54,8 @@ Join::Join(google::protobuf::io::CodedInputStream *input)
       left_child_(),
       right_child_(),
       join_conds_(),
-      left_tuple_(), right_tuple_()
+      left_tuple_(), right_tuple_(),
+      left_batch_(), right_batch_()
 {
     Deserialize(input);
 }
@@ -62,7 +65,8 @@ Join::Join(const Join &x)
       left_child_(x.left_child_->clone()),
       right_child_(x.right_child_->clone()),
       join_conds_(x.join_conds_),
-      left_tuple_(), right_tuple_()
+      left_tuple_(), right_tuple_(),
+      left_batch_(), right_batch_()
 {
 }
 
@@ -70,6 +74,28 @@ Join::~Join()
 {
 }
 
+void Join::setBloomFilter(const ColID cid,
+                          boost::shared_ptr<const BloomFilter> filter)
+{
+    if (selected_input_col_ids_[cid] < left_child_->numOutputCols()) {
+        left_child_->setBloomFilter(selected_input_col_ids_[cid], filter);
+    } else {
+        right_child_->setBloomFilter(selected_input_col_ids_[cid]
+                                     - left_child_->numOutputCols(), filter);
+    }
+}
+
+// Each result has exactly one left tuple, so only the left input is split.
+void Join::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    left_child_->setSlice(slice, num_slices);
+}
+
+void Join::setSliceCursor(boost::shared_ptr<SliceCursor> cursor)
+{
+    left_child_->setSliceCursor(cursor);
+}
+
 uint8_t *Join::SerializeToArray(uint8_t *target) const
 {
     using google::protobuf::io::CodedOutputStream;
@@ -192,8 +218,9 @@ bool Join::execFilter(const Tuple &left_tuple,
 
 void Join::execProject(const Tuple &left_tuple,
                        const Tuple &right_tuple,
-                       Tuple &output_tuple) const
+                       Tuple &output_tuple)
 {
+    ++num_output_tuples_;
     output_tuple.clear();
 
     for (ColID i = 0; i < numOutputCols(); ++i) {
@@ -206,6 +233,30 @@ void Join::execProject(const Tuple &left_tuple,
     }
 }
 
+// Append a row to the batch. The values of the right tuple are copied
+// into the batch if requested.
+void Join::execProject(const Tuple &left_tuple,
+                       const Tuple &right_tuple,
+                       TupleBatch &output_batch,
+                       const bool copy_right)
+{
+    ++num_output_tuples_;
+    for (ColID i = 0; i < numOutputCols(); ++i) {
+        if (selected_input_col_ids_[i] < left_child_->numOutputCols()) {
+            output_batch.cols[i].push_back(
+                left_tuple[selected_input_col_ids_[i]]);
+        } else if (copy_right) {
+            output_batch.copyValue(i, right_tuple[selected_input_col_ids_[i]
+                                   - left_child_->numOutputCols()]);
+        } else {
+            output_batch.cols[i].push_back(
+                right_tuple[selected_input_col_ids_[i]
+                            - left_child_->numOutputCols()]);
+        }
+    }
+    ++output_batch.num_rows;
+}
+
 bool Join::hasCol(const ColName col) const
 {
     return right_child_->hasCol(col) || left_child_->hasCol(col);
@@ -222,7 +273,7 @@ ColID Join::getInputColID(const ColName col) const
 
 std::pair<const PartStats *, ColID> Join::getPartStats(const ColID cid) const
 {
-    if (selected_input_col_ids_[cid] > left_child_->numOutputCols()) {
+    if (selected_input_col_ids_[cid] >= left_child_->numOutputCols()) {
         return right_child_->getPartStats(selected_input_col_ids_[cid]
                                           - left_child_->numOutputCols());
     } else {
@@ -239,10 +290,21 @@ ValueType Join::getColType(const ColName col) const
     }
 }
 
+bool Join::isSortedOn(const ColID) const
+{
+    return false;
+}
+
+void Join::rebind(const Query *from, const Query *to)
+{
+    left_child_->rebind(from, to);
+    right_child_->rebind(from, to);
+}
+
 double Join::estCardinality(const bool) const
 {
     double card = left_child_->estCardinality()
-                  * right_child_->estCardinality();
+                  * right_child_->estCardinality() * card_factor_;
 
     std::pair<const PartStats *, ColID> left_stats;
     std::pair<const PartStats *, ColID> right_stats;
@@ -280,4 +342,80 @@ double Join::estColSize(const ColID cid) const
     }
 }
 
+// The aliases of both inputs are merged in sorted order.
+std::string Join::getTableSet() const
+{
+    std::string inputs(left_child_->getTableSet());
+    inputs += ',';
+    inputs += right_child_->getTableSet();
+
+    std::set<std::string> aliases;
+    for (std::size_t begin = 0; begin <= inputs.size(); ) {
+        std::size_t end = inputs.find(',', begin);
+        if (end == std::string::npos) {
+            end = inputs.size();
+        }
+        if (end > begin) {
+            aliases.insert(inputs.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+
+    std::string table_set;
+    for (std::set<std::string>::const_iterator it = aliases.begin();
+         it != aliases.end(); ++it) {
+        if (!table_set.empty()) {
+            table_set += ',';
+        }
+        table_set += *it;
+    }
+
+    return table_set;
+}
+
+void Join::getCardEstimates(std::vector<CardEstimate> &estimates) const
+{
+    estimates.push_back(
+        CardEstimate(getTableSet(), estCardinality() / card_factor_));
+    left_child_->getCardEstimates(estimates);
+    right_child_->getCardEstimates(estimates);
+}
+
+void Join::getCardCounts(std::vector<CardCount> &counts) const
+{
+    getCardCounts(counts, true, true);
+}
+
+// A join is sliced if its outer-most input is.
+void Join::getCardCounts(std::vector<CardCount> &counts,
+                         const bool left_complete,
+                         const bool right_complete) const
+{
+    std::size_t self = counts.size();
+    CardCount count = { num_output_tuples_, output_done_, false };
+    counts.push_back(count);
+
+    left_child_->getCardCounts(counts);
+    std::size_t right = counts.size();
+    if (right > self + 1) {
+        counts[self].sliced = counts[self + 1].sliced;
+    }
+    right_child_->getCardCounts(counts);
+
+    for (std::size_t i = self + 1; i < counts.size(); ++i) {
+        if (!(i < right ? left_complete : right_complete)) {
+            counts[i].complete = false;
+        }
+    }
+}
+
+void Join::setCardCorrections(const CardCorrections &corrections)
+{
+    left_child_->setCardCorrections(corrections);
+    right_child_->setCardCorrections(corrections);
+
+    CardCorrections::const_iterator it = corrections.find(getTableSet());
+    card_factor_ = (it != corrections.end()) ? it->second : 1.0;
+}
+
 }  // namespace cardinality
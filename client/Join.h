@@ -30,6 +30,7 @@
 #ifndef CARDINALITY_JOIN_H_
 #define CARDINALITY_JOIN_H_
 
+#include <string>
 #include <vector>
 #include <boost/tuple/tuple.hpp>
 #include "client/Project.h"
@@ -46,6 +47,11 @@ public:
     Join(const Join &);
     ~Join();
 
+    // query execution
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
+    void setSliceCursor(boost::shared_ptr<SliceCursor>);
+
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
     int ByteSize() const;
@@ -56,19 +62,39 @@ public:
     ColID getInputColID(const ColName) const;
     std::pair<const PartStats *, ColID> getPartStats(const ColID) const;
     ValueType getColType(const ColName) const;
+    bool isSortedOn(const ColID) const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estCardinality(const bool = false) const;
     double estTupleSize() const;
     double estColSize(const ColID) const;
 
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
+
 protected:
     // helper for the constructor
     void initFilter(const Query *q, const int);
 
     // helpers for GetNext()
     bool execFilter(const Tuple &, const Tuple &) const;
-    void execProject(const Tuple &, const Tuple &, Tuple &) const;
+    void execProject(const Tuple &, const Tuple &, Tuple &);
+
+    // helper for GetNextBatch()
+    void execProject(const Tuple &, const Tuple &, TupleBatch &,
+                     const bool);
+
+    // helper for getCardCounts()
+    // Counts of an input are marked incomplete unless the flag is set,
+    // for an input whose results are not all seen by this join.
+    void getCardCounts(std::vector<CardCount> &, const bool,
+                       const bool) const;
 
     // operator description
     Operator::Ptr left_child_;
@@ -78,6 +104,8 @@ protected:
     // execution states
     Tuple left_tuple_;
     Tuple right_tuple_;
+    TupleBatch left_batch_;
+    TupleBatch right_batch_;
 
 private:
     Join& operator=(const Join &);
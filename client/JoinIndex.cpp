@@ -0,0 +1,395 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/JoinIndex.h"
+#include <cstdio>
+#include <cstdlib>  // std::strtoul
+#include <cstring>
+#include <algorithm>  // std::sort, std::lower_bound, std::equal_range
+#include <boost/filesystem/operations.hpp>
+#include "client/IOManager.h"
+#include "client/Tokenizer.h"
+
+
+namespace cardinality {
+
+// contents of the meta file, which is written after the pairs
+struct JoinIndexMeta {
+    uint64_t left_size;
+    int64_t left_time;
+    uint64_t right_size;
+    int64_t right_time;
+    uint64_t num_pairs;
+};
+
+// a join value of a row and the file offset of the row
+struct JoinKey {
+    Chunk value;
+    uint32_t intval;
+    uint64_t offset;
+};
+
+// Order join keys by value, and by offset among equal values.
+class LessJoinKey {
+public:
+    explicit LessJoinKey(const ValueType type) : type_(type) {}
+
+    bool operator()(const JoinKey &a, const JoinKey &b) const
+    {
+        int cmp = compare(a, b);
+        return cmp < 0 || (cmp == 0 && a.offset < b.offset);
+    }
+
+    int compare(const JoinKey &a, const JoinKey &b) const
+    {
+        if (type_ == INT) {
+            return Operator::compareKey(INT, a.intval, NULL, b.intval, NULL);
+        }
+        return Operator::compareKey(STRING, a.value.second, a.value.first,
+                                    b.value.second, b.value.first);
+    }
+
+private:
+    ValueType type_;
+};
+
+// Order join keys by value only.
+class LessJoinValue {
+public:
+    explicit LessJoinValue(const ValueType type) : less_(type) {}
+
+    bool operator()(const JoinKey &a, const JoinKey &b) const
+    {
+        return less_.compare(a, b) < 0;
+    }
+
+private:
+    LessJoinKey less_;
+};
+
+// Read the join value of the given column from the line at pos.
+// Returns the start of the next line, or NULL if the line is too short.
+static const char *readJoinKey(const char *pos, const char *end,
+                               const ColID col, const ValueType type,
+                               std::vector<const char *> &delims,
+                               JoinKey &key)
+{
+    if (splitLine(pos, end, col + 1, '\n', &delims[0]) == NULL) {
+        return NULL;
+    }
+
+    const char *value = (col == 0) ? pos : delims[col - 1] + 1;
+    key.value = Chunk(value, delims[col] - value);
+    key.intval = (type == INT) ? Operator::parseInt(&key.value) : 0;
+    key.offset = 0;
+
+    if (*delims[col] == '\n') {
+        return delims[col] + 1;
+    }
+    const char *eol = static_cast<const char *>(
+                          std::memchr(delims[col], '\n', end - delims[col]));
+    return eol ? eol + 1 : end;
+}
+
+JoinIndex::JoinIndex()
+    : num_pairs_(),
+      pairs_(),
+      file_()
+{
+}
+
+JoinIndex::~JoinIndex()
+{
+}
+
+std::string JoinIndex::getName(const std::string &left_key,
+                               const std::string &right_key)
+{
+    return left_key + '|' + right_key;
+}
+
+std::string JoinIndex::getKey(const std::string &filename, const ColID col)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "|%u", static_cast<unsigned>(col));
+    return filename + buf;
+}
+
+bool JoinIndex::fitsInMemory(const double num_rows)
+{
+    return num_rows * sizeof(JoinKey) <= JOIN_MEMORY_LIMIT;
+}
+
+// The right rows are sorted by their join values, and each left row
+// is looked up by binary search, so that the pairs come out sorted by
+// the left offset.
+bool JoinIndex::build(const std::string &name, const ValueType type,
+                      const boost::system_time &deadline)
+{
+    namespace fs = boost::filesystem;
+
+    std::string left_file;
+    std::string right_file;
+    ColID left_col;
+    ColID right_col;
+    if (!parseName(name, left_file, left_col, right_file, right_col)) {
+        return false;
+    }
+
+    // a join index of a previous run may be out of date
+    std::string dir = getIndexDir(name);
+    boost::system::error_code ec;
+    fs::remove_all(dir, ec);
+
+    // space is reserved chunk by chunk as the pairs are written
+    IOManager *io = IOManager::instance();
+    uint64_t reserved = 0;
+
+    bool ok = true;
+    uint64_t num_pairs = 0;
+    std::FILE *out = NULL;
+
+    try {
+        boost::iostreams::mapped_file_source left(left_file);
+        boost::iostreams::mapped_file_source right(right_file);
+
+        // sort the join values of the right rows
+        std::vector<JoinKey> keys;
+        std::vector<const char *> delims(std::max(left_col, right_col) + 1);
+        for (const char *pos = right.begin(); ok && pos < right.end(); ) {
+            if (keys.size() % JOIN_CHECK_INTERVAL == 0
+                && boost::get_system_time() > deadline) {
+                ok = false;
+                break;
+            }
+            // grow the keys within JOIN_MEMORY_LIMIT
+            if (keys.size() == keys.capacity()) {
+                uint64_t capacity = 2 * keys.size() + JOIN_CHECK_INTERVAL;
+                if (capacity * sizeof(JoinKey) > JOIN_MEMORY_LIMIT) {
+                    capacity = JOIN_MEMORY_LIMIT / sizeof(JoinKey);
+                }
+                if (capacity <= keys.size()) {
+                    ok = false;
+                    break;
+                }
+                keys.reserve(capacity);
+            }
+            JoinKey key;
+            const char *next = readJoinKey(pos, right.end(), right_col, type,
+                                           delims, key);
+            if (next == NULL) {
+                ok = false;
+                break;
+            }
+            key.offset = pos - right.begin();
+            keys.push_back(key);
+            pos = next;
+        }
+        std::sort(keys.begin(), keys.end(), LessJoinKey(type));
+
+        // look up the join value of each left row
+        fs::create_directories(dir, ec);
+        ok = ok && (out = std::fopen((dir + "/pairs").c_str(), "wb"));
+        uint32_t num_rows = 0;
+        for (const char *pos = left.begin(); ok && pos < left.end();
+             ++num_rows) {
+            if (num_rows % JOIN_CHECK_INTERVAL == 0
+                && boost::get_system_time() > deadline) {
+                ok = false;
+                break;
+            }
+            JoinKey key;
+            const char *next = readJoinKey(pos, left.end(), left_col, type,
+                                           delims, key);
+            if (next == NULL) {
+                ok = false;
+                break;
+            }
+
+            std::pair<std::vector<JoinKey>::const_iterator,
+                      std::vector<JoinKey>::const_iterator> range
+                = std::equal_range(keys.begin(), keys.end(), key,
+                                   LessJoinValue(type));
+            uint64_t size = (num_pairs + (range.second - range.first))
+                            * sizeof(Pair);
+            while (ok && size > reserved) {
+                ok = io->reserveSpace(JOIN_SPACE_CHUNK);
+                if (ok) {
+                    reserved += JOIN_SPACE_CHUNK;
+                }
+            }
+            for (; ok && range.first != range.second; ++range.first) {
+                Pair pair;
+                pair.left = pos - left.begin();
+                pair.right = range.first->offset;
+                ok = std::fwrite(&pair, sizeof(pair), 1, out) == 1;
+                ++num_pairs;
+            }
+            pos = next;
+        }
+    } catch (...) {
+        ok = false;
+    }
+
+    if (out && std::fclose(out)) {
+        ok = false;
+    }
+
+    // the meta file marks the join index complete
+    if (ok) {
+        JoinIndexMeta meta;
+        meta.left_size = fs::file_size(left_file, ec);
+        meta.left_time = fs::last_write_time(left_file, ec);
+        meta.right_size = fs::file_size(right_file, ec);
+        meta.right_time = fs::last_write_time(right_file, ec);
+        meta.num_pairs = num_pairs;
+
+        out = std::fopen((dir + "/meta.tmp").c_str(), "wb");
+        ok = out && std::fwrite(&meta, sizeof(meta), 1, out) == 1;
+        ok = out && !std::fclose(out) && ok;
+        if (ok) {
+            fs::rename(dir + "/meta.tmp", dir + "/meta", ec);
+            ok = !ec;
+        }
+    }
+
+    if (ok) {
+        io->releaseSpace(reserved - num_pairs * sizeof(Pair));
+    } else {
+        io->releaseSpace(reserved);
+        fs::remove_all(dir, ec);
+    }
+
+    return ok;
+}
+
+JoinIndex::Ptr JoinIndex::open(const std::string &name)
+{
+    namespace fs = boost::filesystem;
+
+    std::string left_file;
+    std::string right_file;
+    ColID left_col;
+    ColID right_col;
+    if (!parseName(name, left_file, left_col, right_file, right_col)) {
+        return Ptr();
+    }
+
+    std::string dir = getIndexDir(name);
+
+    JoinIndexMeta meta;
+    std::FILE *in = std::fopen((dir + "/meta").c_str(), "rb");
+    if (in == NULL) {
+        return Ptr();
+    }
+    bool ok = std::fread(&meta, sizeof(meta), 1, in) == 1;
+    std::fclose(in);
+
+    boost::system::error_code ec;
+    if (!ok
+        || meta.left_size != fs::file_size(left_file, ec)
+        || meta.left_time != fs::last_write_time(left_file, ec)
+        || meta.right_size != fs::file_size(right_file, ec)
+        || meta.right_time != fs::last_write_time(right_file, ec)) {
+        return Ptr();
+    }
+
+    boost::shared_ptr<JoinIndex> index(new JoinIndex());
+    index->num_pairs_ = meta.num_pairs;
+    if (meta.num_pairs > 0) {
+        try {
+            index->file_.open(dir + "/pairs");
+        } catch (...) {
+            return Ptr();
+        }
+        if (index->file_.size() != meta.num_pairs * sizeof(Pair)) {
+            return Ptr();
+        }
+        index->pairs_ = reinterpret_cast<const Pair *>(index->file_.data());
+    }
+
+    return index;
+}
+
+std::size_t JoinIndex::numPairs() const
+{
+    return num_pairs_;
+}
+
+const JoinIndex::Pair &JoinIndex::getPair(const std::size_t i) const
+{
+    return pairs_[i];
+}
+
+std::size_t JoinIndex::findPair(const uint64_t offset) const
+{
+    std::size_t lo = 0;
+    std::size_t hi = num_pairs_;
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (pairs_[mid].left < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// A name consists of the left file, the left column, the right file and
+// the right column, separated by '|'.
+bool JoinIndex::parseName(const std::string &name,
+                          std::string &left_file, ColID &left_col,
+                          std::string &right_file, ColID &right_col)
+{
+    std::size_t p1 = name.find('|');
+    std::size_t p2 = (p1 == std::string::npos)
+                     ? p1 : name.find('|', p1 + 1);
+    std::size_t p3 = (p2 == std::string::npos)
+                     ? p2 : name.find('|', p2 + 1);
+    if (p3 == std::string::npos) {
+        return false;
+    }
+
+    left_file = name.substr(0, p1);
+    left_col = std::strtoul(name.c_str() + p1 + 1, NULL, 10);
+    right_file = name.substr(p2 + 1, p3 - p2 - 1);
+    right_col = std::strtoul(name.c_str() + p3 + 1, NULL, 10);
+    return true;
+}
+
+std::string JoinIndex::getIndexDir(const std::string &name)
+{
+    std::string dir(name);
+    std::replace(dir.begin(), dir.end(), '/', '_');
+    std::replace(dir.begin(), dir.end(), '|', '_');
+    return std::string(IOManager::SPACE_DIR) + "/join_" + dir;
+}
+
+}  // namespace cardinality
@@ -0,0 +1,118 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_JOININDEX_H_
+#define CARDINALITY_JOININDEX_H_
+
+#include <string>
+#include <vector>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "client/Operator.h"
+
+
+namespace cardinality {
+
+// Represent the precomputed equi-join of two partitions on the same node,
+// built during pretreatment in IOManager::SPACE_DIR for the join
+// conditions of the preset queries. Each matching pair of rows is kept
+// as the file offsets of its left and right rows, sorted by the left
+// offset, so that PairJoin reads the left file in order and fetches
+// only the right rows that join, without probing an index.
+class JoinIndex {
+public:
+    typedef boost::shared_ptr<const JoinIndex> Ptr;
+
+    struct Pair {
+        uint64_t left;
+        uint64_t right;
+    };
+
+    // Returns the name of a join index given the keys of its inputs, and
+    // the key of a join input given a file and a column.
+    static std::string getName(const std::string &, const std::string &);
+    static std::string getKey(const std::string &, const ColID);
+
+    // Returns true if the join values of a right partition of the given
+    // estimated number of rows can be sorted within JOIN_MEMORY_LIMIT.
+    static bool fitsInMemory(const double);
+
+    // Build the join index of the given name on join columns of the given
+    // type as long as IOManager::reserveSpace() and JOIN_MEMORY_LIMIT
+    // allow. Gives up if the build cannot finish by the given deadline.
+    // Returns true if a join index has been built.
+    static bool build(const std::string &, const ValueType,
+                      const boost::system_time &);
+
+    // Open the join index of the given name.
+    // Returns NULL if there is no join index or it is out of date.
+    // Called by IOManager::openJoinIndex().
+    static Ptr open(const std::string &);
+
+    // destructor
+    ~JoinIndex();
+
+    // accessors
+    std::size_t numPairs() const;
+    const Pair &getPair(const std::size_t) const;
+
+    // Returns the position of the first pair whose left offset is equal
+    // to or greater than the given offset.
+    std::size_t findPair(const uint64_t) const;
+
+private:
+    // constructor called by open()
+    JoinIndex();
+
+    // non-copyable
+    JoinIndex(const JoinIndex &);
+    JoinIndex& operator=(const JoinIndex &);
+
+    // Split a join index name into the files and columns of its inputs.
+    // Returns false if the name is malformed.
+    static bool parseName(const std::string &, std::string &, ColID &,
+                          std::string &, ColID &);
+
+    // Returns the directory holding the join index of the given name.
+    static std::string getIndexDir(const std::string &);
+
+    std::size_t num_pairs_;
+    const Pair *pairs_;
+    boost::iostreams::mapped_file_source file_;
+
+    // constants
+    static const uint64_t JOIN_SPACE_CHUNK = 64ULL << 20;
+    static const uint64_t JOIN_MEMORY_LIMIT = 512ULL << 20;
+    static const uint32_t JOIN_CHECK_INTERVAL = 65536;
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_JOININDEX_H_
@@ -0,0 +1,300 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/MergeJoin.h"
+#include <cstring>
+#include <stdexcept>  // std::runtime_error
+#include <algorithm>  // std::max, std::min
+
+
+namespace cardinality {
+
+MergeJoin::MergeJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
+                     const Query *q, const int x)
+    : Join(n, l, r, q, x),
+      merge_cond_(),
+      state_(), left_done_(), right_done_(),
+      group_(), group_pos_(), group_tuple_(),
+      blocks_(), block_pos_(), block_end_()
+{
+    initMergeCond();
+}
+
+MergeJoin::MergeJoin(google::protobuf::io::CodedInputStream *input)
+    : Join(input),
+      merge_cond_(),
+      state_(), left_done_(), right_done_(),
+      group_(), group_pos_(), group_tuple_(),
+      blocks_(), block_pos_(), block_end_()
+{
+    Deserialize(input);
+}
+
+MergeJoin::MergeJoin(const MergeJoin &x)
+    : Join(x),
+      merge_cond_(x.merge_cond_),
+      state_(), left_done_(), right_done_(),
+      group_(), group_pos_(), group_tuple_(),
+      blocks_(), block_pos_(), block_end_()
+{
+}
+
+MergeJoin::~MergeJoin()
+{
+}
+
+Operator::Ptr MergeJoin::clone() const
+{
+    return boost::make_shared<MergeJoin>(*this);
+}
+
+void MergeJoin::Open(const Chunk *)
+{
+    resetCardCount();
+    state_ = STATE_OPEN;
+    left_tuple_.reserve(left_child_->numOutputCols());
+    right_tuple_.reserve(right_child_->numOutputCols());
+    group_tuple_.reserve(right_child_->numOutputCols());
+    left_child_->Open();
+    right_child_->Open();
+}
+
+void MergeJoin::ReOpen(const Chunk *)
+{
+    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+}
+
+bool MergeJoin::GetNext(Tuple &tuple)
+{
+    const ColID left_cid = join_conds_[merge_cond_].get<0>();
+    const ColID right_cid = join_conds_[merge_cond_].get<1>();
+    const std::size_t num_cols = right_child_->numOutputCols();
+
+    for (;;) {
+        switch (state_) {
+        case STATE_OPEN:
+            left_done_ = left_child_->GetNext(left_tuple_);
+            right_done_ = left_done_ || right_child_->GetNext(right_tuple_);
+            state_ = STATE_GETNEXT;
+
+        case STATE_GETNEXT:
+            if (left_done_) {
+                return finishOutput(true);
+            }
+
+            // the next left tuple may have the same key as the last one
+            if (!group_.empty()) {
+                if (compareKeys(left_tuple_[left_cid],
+                                group_[right_cid]) == 0) {
+                    group_pos_ = 0;
+                    state_ = STATE_SWEEPGROUP;
+                    break;
+                }
+                clearGroup();
+            }
+
+            for (;;) {
+                if (right_done_) {
+                    return finishOutput(true);
+                }
+
+                int cmp = compareKeys(left_tuple_[left_cid],
+                                      right_tuple_[right_cid]);
+                if (cmp < 0) {
+                    if ((left_done_ = left_child_->GetNext(left_tuple_))) {
+                        return finishOutput(true);
+                    }
+                } else if (cmp > 0) {
+                    right_done_ = right_child_->GetNext(right_tuple_);
+                } else {
+                    break;
+                }
+            }
+
+            // buffer all right tuples with this key
+            do {
+                storeGroup(right_tuple_);
+                right_done_ = right_child_->GetNext(right_tuple_);
+            } while (!right_done_
+                     && compareKeys(group_[right_cid],
+                                    right_tuple_[right_cid]) == 0);
+            group_pos_ = 0;
+            state_ = STATE_SWEEPGROUP;
+
+        case STATE_SWEEPGROUP:
+            while (group_pos_ < group_.size()) {
+                std::vector<Chunk>::const_iterator it
+                    = group_.begin() + group_pos_;
+                group_tuple_.assign(it, it + num_cols);
+                group_pos_ += num_cols;
+
+                if (execFilter(left_tuple_, group_tuple_)) {
+                    execProject(left_tuple_, group_tuple_, tuple);
+                    return false;
+                }
+            }
+
+            left_done_ = left_child_->GetNext(left_tuple_);
+            state_ = STATE_GETNEXT;
+            break;
+        }
+    }
+
+    return false;
+}
+
+void MergeJoin::Close()
+{
+    clearGroup();
+    blocks_.clear();
+    block_pos_ = block_end_ = NULL;
+
+    right_child_->Close();
+    left_child_->Close();
+}
+
+uint8_t *MergeJoin::SerializeToArray(uint8_t *target) const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    target = CodedOutputStream::WriteTagToArray(TAG_MERGEJOIN, target);
+
+    target = Join::SerializeToArray(target);
+
+    return target;
+}
+
+int MergeJoin::ByteSize() const
+{
+    int total_size = 1 + Join::ByteSize();
+
+    return total_size;
+}
+
+void MergeJoin::Deserialize(google::protobuf::io::CodedInputStream *input)
+{
+    initMergeCond();
+}
+
+void MergeJoin::print(std::ostream &os, const int tab, const double) const
+{
+    os << std::string(4 * tab, ' ');
+    os << "MergeJoin@" << node_id();
+    os << " #cols=" << numOutputCols();
+    os << " len=" << estTupleSize();
+    os << " card=" << estCardinality();
+    os << " cost=" << estCost();
+    os << std::endl;
+
+    left_child_->print(os, tab + 1);
+    right_child_->print(os, tab + 1);
+}
+
+// The order of the left plan is preserved, and the join column of
+// the right plan has the same order as that of the left plan.
+bool MergeJoin::isSortedOn(const ColID cid) const
+{
+    ColID input_cid = selected_input_col_ids_[cid];
+    if (input_cid < left_child_->numOutputCols()) {
+        return left_child_->isSortedOn(input_cid);
+    } else {
+        return input_cid - left_child_->numOutputCols()
+               == join_conds_[merge_cond_].get<1>();
+    }
+}
+
+double MergeJoin::estCost(const double) const
+{
+    return left_child_->estCost() + right_child_->estCost();
+}
+
+// The join condition given to the constructor is marked by Join so that
+// execFilter() skips it, since matching keys are already equal.
+void MergeJoin::initMergeCond()
+{
+    for (merge_cond_ = 0; merge_cond_ < join_conds_.size(); ++merge_cond_) {
+        if (join_conds_[merge_cond_].get<3>()) {
+            return;
+        }
+    }
+
+    throw std::runtime_error("merge join condition not found");
+}
+
+// Compare join values in the order of data files.
+int MergeJoin::compareKeys(const Chunk &a, const Chunk &b) const
+{
+    if (!join_conds_[merge_cond_].get<2>()) {  // INT
+        uint32_t x = parseInt(&a);
+        uint32_t y = parseInt(&b);
+        return (x < y) ? -1 : (x > y);
+    } else {  // STRING
+        int cmp = std::memcmp(a.first, b.first, std::min(a.second, b.second));
+        if (cmp == 0) {
+            cmp = (a.second < b.second) ? -1 : (a.second > b.second);
+        }
+        return cmp;
+    }
+}
+
+// Copy the given right tuple into the current group.
+void MergeJoin::storeGroup(const Tuple &t)
+{
+    std::size_t len = 0;
+    for (std::size_t i = 0; i < t.size(); ++i) {
+        len += t[i].second + 1;
+    }
+
+    if (block_pos_ + len > block_end_) {
+        std::size_t size = std::max<std::size_t>(MERGEJOIN_BLOCKSIZE, len);
+        blocks_.push_back(boost::shared_array<char>(new char[size]));
+        block_pos_ = blocks_.back().get();
+        block_end_ = block_pos_ + size;
+    }
+
+    for (std::size_t i = 0; i < t.size(); ++i) {
+        std::memcpy(block_pos_, t[i].first, t[i].second);
+        block_pos_[t[i].second] = '\0';
+        group_.push_back(Chunk(block_pos_, t[i].second));
+        block_pos_ += t[i].second + 1;
+    }
+}
+
+// Empty the current group, keeping the first block for the next one.
+void MergeJoin::clearGroup()
+{
+    group_.clear();
+    if (!blocks_.empty()) {
+        blocks_.resize(1);
+        block_pos_ = blocks_[0].get();
+        block_end_ = block_pos_ + MERGEJOIN_BLOCKSIZE;
+    }
+}
+
+}  // namespace cardinality
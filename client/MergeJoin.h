@@ -0,0 +1,99 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_MERGEJOIN_H_
+#define CARDINALITY_MERGEJOIN_H_
+
+#include <boost/shared_array.hpp>
+#include "client/Join.h"
+
+
+namespace cardinality {
+
+class MergeJoin: public Join {
+public:
+    // constructor, destructor
+    MergeJoin(const NodeID, Operator::Ptr, Operator::Ptr,
+              const Query *, const int);
+    explicit MergeJoin(google::protobuf::io::CodedInputStream *);
+    MergeJoin(const MergeJoin &);
+    ~MergeJoin();
+    Operator::Ptr clone() const;
+
+    // query execution
+    void Open(const Chunk * = NULL);
+    void ReOpen(const Chunk * = NULL);
+    bool GetNext(Tuple &);
+    void Close();
+
+    // serialization
+    uint8_t *SerializeToArray(uint8_t *) const;
+    int ByteSize() const;
+    void Deserialize(google::protobuf::io::CodedInputStream *);
+
+    // plan exploration
+    void print(std::ostream &, const int, const double) const;
+    bool isSortedOn(const ColID) const;
+
+    // cost estimation
+    double estCost(const double = 0.0) const;
+
+protected:
+    // helper for the constructors
+    void initMergeCond();
+
+    // helpers for GetNext()
+    int compareKeys(const Chunk &, const Chunk &) const;
+    void storeGroup(const Tuple &);
+    void clearGroup();
+
+    // operator description
+    std::size_t merge_cond_;            // index into join_conds_
+
+    // execution states
+    enum { STATE_OPEN, STATE_GETNEXT, STATE_SWEEPGROUP } state_;
+    bool left_done_;
+    bool right_done_;
+    std::vector<Chunk> group_;          // right tuples with the same key
+    std::size_t group_pos_;
+    Tuple group_tuple_;
+    std::vector<boost::shared_array<char> > blocks_;
+    char *block_pos_;
+    char *block_end_;
+
+    // constants
+    static const int MERGEJOIN_BLOCKSIZE = 65536;
+
+private:
+    MergeJoin& operator=(const MergeJoin &);
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_MERGEJOIN_H_
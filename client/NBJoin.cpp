@@ -38,7 +38,7 @@ namespace cardinality {
 NBJoin::NBJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
                const Query *q)
     : Join(n, l, r, q),
-      state_(), left_done_(),
+      state_(), left_done_(), right_done_(), right_pos_(),
       left_tuples_(),
       left_tuples_it_(),
       left_tuples_end_(),
@@ -48,7 +48,7 @@ NBJoin::NBJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
 
 NBJoin::NBJoin(google::protobuf::io::CodedInputStream *input)
     : Join(input),
-      state_(), left_done_(),
+      state_(), left_done_(), right_done_(), right_pos_(),
       left_tuples_(),
       left_tuples_it_(),
       left_tuples_end_(),
@@ -59,7 +59,7 @@ NBJoin::NBJoin(google::protobuf::io::CodedInputStream *input)
 
 NBJoin::NBJoin(const NBJoin &x)
     : Join(x),
-      state_(), left_done_(),
+      state_(), left_done_(), right_done_(), right_pos_(),
       left_tuples_(),
       left_tuples_it_(),
       left_tuples_end_(),
@@ -78,6 +78,7 @@ Operator::Ptr NBJoin::clone() const
 
 void NBJoin::Open(const Chunk *)
 {
+    resetCardCount();
     main_buffer_.reset(new char[NBJOIN_BUFSIZE]);
     left_tuples_.reset(new multimap());
 
@@ -97,90 +98,22 @@ bool NBJoin::GetNext(Tuple &tuple)
     for (;;) {
         switch (state_) {
         case STATE_OPEN:
-        case STATE_REOPEN: {
-            for (char *pos = main_buffer_.get();
-                 pos - main_buffer_.get() < NBJOIN_BUFSIZE - 512
-                 && !(left_done_ = left_child_->GetNext(left_tuple_)); ) {
-                for (std::size_t i = 0; i < left_tuple_.size(); ++i) {
-                    uint32_t len = left_tuple_[i].second;
-                    if (pos + len < main_buffer_.get() + NBJOIN_BUFSIZE) {
-                        std::memcpy(pos, left_tuple_[i].first, len);
-                        pos[len] = '\0';
-                        left_tuple_[i].first = pos;
-                        pos += len + 1;
-                    } else {  // main_buffer_ doesn't have enough space
-                        int overflow_len = len + 1;
-                        for (std::size_t j = i + 1;
-                             j < left_tuple_.size(); ++j) {
-                            overflow_len += left_tuple_[j].second + 1;
-                        }
-                        overflow_buffer_.reset(new char[overflow_len]);
-                        pos = overflow_buffer_.get();
-                        for (; i < left_tuple_.size(); ++i) {
-                            uint32_t len = left_tuple_[i].second;
-                            std::memcpy(pos, left_tuple_[i].first, len);
-                            pos[len] = '\0';
-                            left_tuple_[i].first = pos;
-                            pos += len + 1;
-                        }
-                        pos = main_buffer_.get() + NBJOIN_BUFSIZE;
-                    }
-                }
-
-                if (join_conds_.empty()) {  // cross product
-                    left_tuples_->insert(std::pair<uint64_t, Tuple>(
-                        0, left_tuple_));
-                } else if (join_conds_[0].get<2>()) {  // STRING
-                    ColID cid = join_conds_[0].get<0>();
-                    left_tuples_->insert(std::pair<uint64_t, Tuple>(
-                        hashString(left_tuple_[cid]), left_tuple_));
-                } else {  // INT
-                    ColID cid = join_conds_[0].get<0>();
-                    left_tuples_->insert(std::pair<uint64_t, Tuple>(
-                        parseInt(&left_tuple_[cid]), left_tuple_));
-                }
-            }
-
-            if (left_tuples_->empty()) {
-                return true;
-            }
-
-            if (state_ == STATE_OPEN) {
-                right_child_->Open();
-            } else {  // STATE_REOPEN
-                right_child_->ReOpen();
+        case STATE_REOPEN:
+            if (!fillBuffer()) {
+                return finishOutput(true);
             }
-            state_ = STATE_GETNEXT;
-        }
 
         case STATE_GETNEXT:
             if (right_child_->GetNext(right_tuple_)) {
                 left_tuples_->clear();
                 if (left_done_) {
-                    return true;
+                    return finishOutput(true);
                 }
                 state_ = STATE_REOPEN;
                 break;
             }
 
-            if (join_conds_.empty()) {  // cross product
-                left_tuples_it_ = left_tuples_->begin();
-                left_tuples_end_ = left_tuples_->end();
-            } else if (join_conds_[0].get<2>()) {  // STRING
-                ColID cid = join_conds_[0].get<1>();
-                std::pair<multimap::const_iterator,
-                          multimap::const_iterator> range
-                    = left_tuples_->equal_range(hashString(right_tuple_[cid]));
-                left_tuples_it_ = range.first;
-                left_tuples_end_ = range.second;
-            } else {  // INT
-                ColID cid = join_conds_[0].get<1>();
-                std::pair<multimap::const_iterator,
-                          multimap::const_iterator> range
-                    = left_tuples_->equal_range(parseInt(&right_tuple_[cid]));
-                left_tuples_it_ = range.first;
-                left_tuples_end_ = range.second;
-            }
+            probeBuffer(right_tuple_);
             state_ = STATE_SWEEPBUFFER;
 
         case STATE_SWEEPBUFFER:
@@ -199,6 +132,141 @@ bool NBJoin::GetNext(Tuple &tuple)
     return false;
 }
 
+// The output refers to the buffered outer tuples and the current inner
+// batch, so both are replaced only by a call that starts with an empty
+// output.
+bool NBJoin::GetNextBatch(TupleBatch &batch)
+{
+    batch.reset(numOutputCols());
+
+    for (;;) {
+        if (state_ == STATE_OPEN || state_ == STATE_REOPEN) {
+            if (!fillBuffer()) {
+                return finishOutput(true);
+            }
+        }
+
+        if (right_pos_ == right_batch_.sel.size()) {
+            if (batch.num_rows > 0) {
+                break;
+            }
+            if (right_done_) {
+                left_tuples_->clear();
+                if (left_done_) {
+                    return finishOutput(true);
+                }
+                state_ = STATE_REOPEN;
+                continue;
+            }
+            right_done_ = right_child_->GetNextBatch(right_batch_);
+            right_pos_ = 0;
+            continue;
+        }
+
+        right_batch_.getTuple(right_pos_++, right_tuple_);
+        probeBuffer(right_tuple_);
+        for (; left_tuples_it_ != left_tuples_end_; ++left_tuples_it_) {
+            if (execFilter(left_tuples_it_->second, right_tuple_)) {
+                execProject(left_tuples_it_->second, right_tuple_, batch,
+                            false);
+            }
+        }
+
+        if (batch.num_rows >= OPERATOR_BATCHSIZE) {
+            break;
+        }
+    }
+
+    batch.selectAll();
+    return false;
+}
+
+// Buffer the next block of outer tuples and (re)open the inner plan.
+// Returns false if the outer plan has no more tuples.
+bool NBJoin::fillBuffer()
+{
+    for (char *pos = main_buffer_.get();
+         pos - main_buffer_.get() < NBJOIN_BUFSIZE - 512
+         && !(left_done_ = left_child_->GetNext(left_tuple_)); ) {
+        for (std::size_t i = 0; i < left_tuple_.size(); ++i) {
+            uint32_t len = left_tuple_[i].second;
+            if (pos + len < main_buffer_.get() + NBJOIN_BUFSIZE) {
+                std::memcpy(pos, left_tuple_[i].first, len);
+                pos[len] = '\0';
+                left_tuple_[i].first = pos;
+                pos += len + 1;
+            } else {  // main_buffer_ doesn't have enough space
+                int overflow_len = len + 1;
+                for (std::size_t j = i + 1; j < left_tuple_.size(); ++j) {
+                    overflow_len += left_tuple_[j].second + 1;
+                }
+                overflow_buffer_.reset(new char[overflow_len]);
+                pos = overflow_buffer_.get();
+                for (; i < left_tuple_.size(); ++i) {
+                    uint32_t len = left_tuple_[i].second;
+                    std::memcpy(pos, left_tuple_[i].first, len);
+                    pos[len] = '\0';
+                    left_tuple_[i].first = pos;
+                    pos += len + 1;
+                }
+                pos = main_buffer_.get() + NBJOIN_BUFSIZE;
+            }
+        }
+
+        if (join_conds_.empty()) {  // cross product
+            left_tuples_->insert(std::pair<uint64_t, Tuple>(
+                0, left_tuple_));
+        } else if (join_conds_[0].get<2>()) {  // STRING
+            ColID cid = join_conds_[0].get<0>();
+            left_tuples_->insert(std::pair<uint64_t, Tuple>(
+                hashString(left_tuple_[cid]), left_tuple_));
+        } else {  // INT
+            ColID cid = join_conds_[0].get<0>();
+            left_tuples_->insert(std::pair<uint64_t, Tuple>(
+                parseInt(&left_tuple_[cid]), left_tuple_));
+        }
+    }
+
+    if (left_tuples_->empty()) {
+        return false;
+    }
+
+    if (state_ == STATE_OPEN) {
+        right_child_->Open();
+    } else {  // STATE_REOPEN
+        right_child_->ReOpen();
+    }
+    state_ = STATE_GETNEXT;
+    right_batch_.reset(right_child_->numOutputCols());
+    right_pos_ = 0;
+    right_done_ = false;
+
+    return true;
+}
+
+// Find the buffered outer tuples that may match the given inner tuple.
+void NBJoin::probeBuffer(const Tuple &right_tuple)
+{
+    if (join_conds_.empty()) {  // cross product
+        left_tuples_it_ = left_tuples_->begin();
+        left_tuples_end_ = left_tuples_->end();
+    } else if (join_conds_[0].get<2>()) {  // STRING
+        ColID cid = join_conds_[0].get<1>();
+        std::pair<multimap::const_iterator,
+                  multimap::const_iterator> range
+            = left_tuples_->equal_range(hashString(right_tuple[cid]));
+        left_tuples_it_ = range.first;
+        left_tuples_end_ = range.second;
+    } else {  // INT
+        ColID cid = join_conds_[0].get<1>();
+        std::pair<multimap::const_iterator,
+                  multimap::const_iterator> range
+            = left_tuples_->equal_range(parseInt(&right_tuple[cid]));
+        left_tuples_it_ = range.first;
+        left_tuples_end_ = range.second;
+    }
+}
+
 void NBJoin::Close()
 {
     left_tuples_.reset();
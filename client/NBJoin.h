@@ -52,6 +52,7 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
 
     // serialization
@@ -66,12 +67,16 @@ public:
     double estCost(const double = 0.0) const;
 
 protected:
-    // helper for GetNext()
+    // helpers for GetNext() and GetNextBatch()
+    bool fillBuffer();
+    void probeBuffer(const Tuple &);
     static uint64_t hashString(const Chunk &);
 
     // execution states
     enum { STATE_OPEN, STATE_REOPEN, STATE_GETNEXT, STATE_SWEEPBUFFER } state_;
     bool left_done_;
+    bool right_done_;
+    uint32_t right_pos_;                // position in right_batch_
     typedef std::tr1::unordered_multimap<uint64_t, Tuple> multimap;
     boost::scoped_ptr<multimap> left_tuples_;
     multimap::const_iterator left_tuples_it_;
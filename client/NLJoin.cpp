@@ -29,6 +29,7 @@
 
 #include "client/NLJoin.h"
 #include <stdexcept>  // std::runtime_error
+#include <vector>
 
 
 namespace cardinality {
@@ -37,7 +38,9 @@ NLJoin::NLJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
                const Query *q, const int x, const char *idxJoinCol)
     : Join(n, l, r, q, x),
       index_join_col_id_(NOT_INDEX_JOIN),
-      state_()
+      state_(),
+      batched_(), left_done_(), left_pos_(),
+      batch_buffer_(), batch_lengths_(), batch_tuples_(), batch_values_()
 {
     if (idxJoinCol) {
         index_join_col_id_ = getInputColID(idxJoinCol);
@@ -47,7 +50,9 @@ NLJoin::NLJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
 NLJoin::NLJoin(google::protobuf::io::CodedInputStream *input)
     : Join(input),
       index_join_col_id_(),
-      state_()
+      state_(),
+      batched_(), left_done_(), left_pos_(),
+      batch_buffer_(), batch_lengths_(), batch_tuples_(), batch_values_()
 {
     Deserialize(input);
 }
@@ -55,7 +60,9 @@ NLJoin::NLJoin(google::protobuf::io::CodedInputStream *input)
 NLJoin::NLJoin(const NLJoin &x)
     : Join(x),
       index_join_col_id_(x.index_join_col_id_),
-      state_()
+      state_(),
+      batched_(), left_done_(), left_pos_(),
+      batch_buffer_(), batch_lengths_(), batch_tuples_(), batch_values_()
 {
 }
 
@@ -70,9 +77,15 @@ Operator::Ptr NLJoin::clone() const
 
 void NLJoin::Open(const Chunk *)
 {
+    resetCardCount();
     state_ = STATE_OPEN;
     left_tuple_.reserve(left_child_->numOutputCols());
     right_tuple_.reserve(right_child_->numOutputCols());
+    batched_ = index_join_col_id_ != NOT_INDEX_JOIN
+               && right_child_->isRemoteLookup();
+    left_done_ = false;
+    left_batch_.reset(left_child_->numOutputCols());
+    left_pos_ = 0;
     left_child_->Open();
 }
 
@@ -83,10 +96,14 @@ void NLJoin::ReOpen(const Chunk *)
 
 bool NLJoin::GetNext(Tuple &tuple)
 {
+    if (batched_) {
+        return GetNextRemote(tuple);
+    }
+
     for (;;) {
         if (state_ == STATE_OPEN) {
             if (left_child_->GetNext(left_tuple_)) {
-                return true;
+                return finishOutput(true);
             }
             state_ = STATE_GETNEXT;
             if (index_join_col_id_ == NOT_INDEX_JOIN) {
@@ -96,7 +113,7 @@ bool NLJoin::GetNext(Tuple &tuple)
             }
         } else if (state_ == STATE_REOPEN) {
             if (left_child_->GetNext(left_tuple_)) {
-                return true;
+                return finishOutput(true);
             }
             state_ = STATE_GETNEXT;
             if (index_join_col_id_ == NOT_INDEX_JOIN) {
@@ -119,6 +136,140 @@ bool NLJoin::GetNext(Tuple &tuple)
     return false;
 }
 
+// Outer tuples are taken a batch at a time. The output refers to the
+// values of the current outer batch, so the next outer batch is taken
+// only by a call that starts with an empty output.
+bool NLJoin::GetNextBatch(TupleBatch &batch)
+{
+    if (batched_) {
+        return Operator::GetNextBatch(batch);
+    }
+
+    batch.reset(numOutputCols());
+
+    for (;;) {
+        if (left_pos_ == left_batch_.sel.size()) {
+            if (batch.num_rows > 0 || left_done_) {
+                break;
+            }
+            left_done_ = left_child_->GetNextBatch(left_batch_);
+            left_pos_ = 0;
+            continue;
+        }
+
+        left_batch_.getTuple(left_pos_++, left_tuple_);
+        const Chunk *join_value = NULL;
+        if (index_join_col_id_ != NOT_INDEX_JOIN) {
+            join_value = &left_tuple_[index_join_col_id_];
+        }
+        if (state_ == STATE_OPEN) {
+            right_child_->Open(join_value);
+            state_ = STATE_REOPEN;
+        } else {
+            right_child_->ReOpen(join_value);
+        }
+
+        bool right_done;
+        do {
+            right_done = right_child_->GetNextBatch(right_batch_);
+            for (std::size_t k = 0; k < right_batch_.sel.size(); ++k) {
+                right_batch_.getTuple(k, right_tuple_);
+                if (execFilter(left_tuple_, right_tuple_)) {
+                    execProject(left_tuple_, right_tuple_, batch, true);
+                }
+            }
+        } while (!right_done);
+
+        if (batch.num_rows >= OPERATOR_BATCHSIZE) {
+            break;
+        }
+    }
+
+    batch.fixCopies();
+    batch.selectAll();
+
+    return finishOutput(left_done_ && left_pos_ == left_batch_.sel.size());
+}
+
+// Look up the join values of up to NLJOIN_BATCHSIZE outer tuples in a
+// single request, and pair the results with the outer tuples by the
+// positions of their join values.
+bool NLJoin::GetNextRemote(Tuple &tuple)
+{
+    for (;;) {
+        if (state_ == STATE_OPEN) {
+            if (!fillBatch()) {
+                return finishOutput(true);
+            }
+            state_ = STATE_GETNEXT;
+            right_child_->OpenLookup(batch_values_);
+        } else if (state_ == STATE_REOPEN) {
+            if (!fillBatch()) {
+                return finishOutput(true);
+            }
+            state_ = STATE_GETNEXT;
+            right_child_->ReOpenLookup(batch_values_);
+        }
+
+        std::size_t num_cols = left_child_->numOutputCols();
+        uint32_t pos;
+        while (!right_child_->GetNextLookup(right_tuple_, pos)) {
+            std::vector<Chunk>::const_iterator it
+                = batch_tuples_.begin() + pos * num_cols;
+            left_tuple_.assign(it, it + num_cols);
+            if (execFilter(left_tuple_, right_tuple_)) {
+                execProject(left_tuple_, right_tuple_, tuple);
+                return false;
+            }
+        }
+
+        state_ = STATE_REOPEN;
+    }
+
+    return false;
+}
+
+// Copy the next batch of outer tuples.
+// Returns false if the outer plan has no more tuples.
+bool NLJoin::fillBatch()
+{
+    std::size_t num_cols = left_child_->numOutputCols();
+
+    batch_buffer_.clear();
+    batch_lengths_.clear();
+    while (!left_done_
+           && batch_lengths_.size() < NLJOIN_BATCHSIZE * num_cols) {
+        if (left_child_->GetNext(left_tuple_)) {
+            left_done_ = true;
+            break;
+        }
+        for (std::size_t i = 0; i < num_cols; ++i) {
+            batch_buffer_.insert(batch_buffer_.end(), left_tuple_[i].first,
+                                 left_tuple_[i].first + left_tuple_[i].second);
+            batch_buffer_.push_back('\0');
+            batch_lengths_.push_back(left_tuple_[i].second);
+        }
+    }
+
+    if (batch_lengths_.empty()) {
+        return false;
+    }
+
+    // pointers are taken after the buffer stops growing
+    batch_tuples_.resize(batch_lengths_.size());
+    batch_values_.resize(batch_lengths_.size() / num_cols);
+    const char *pos = batch_buffer_.data();
+    for (std::size_t i = 0; i < batch_lengths_.size(); ++i) {
+        batch_tuples_[i] = Chunk(pos, batch_lengths_[i]);
+        pos += batch_lengths_[i] + 1;
+    }
+    for (std::size_t i = 0; i < batch_values_.size(); ++i) {
+        batch_values_[i] = batch_tuples_[i * num_cols + index_join_col_id_];
+    }
+
+    return true;
+}
+
 void NLJoin::Close()
 {
     if (state_ != STATE_OPEN) {
@@ -171,10 +322,24 @@ void NLJoin::print(std::ostream &os, const int tab, const double) const
     right_child_->print(os, tab + 1, left_child_->estCardinality());
 }
 
+// The order of the outer plan is preserved.
+bool NLJoin::isSortedOn(const ColID cid) const
+{
+    return selected_input_col_ids_[cid] < left_child_->numOutputCols()
+           && left_child_->isSortedOn(selected_input_col_ids_[cid]);
+}
+
 double NLJoin::estCost(const double) const
 {
     double lcard = left_child_->estCardinality();
     return left_child_->estCost() + lcard * right_child_->estCost(lcard);
 }
 
+// The inner plan is reopened for each join value, so its counts cover
+// only the last join value.
+void NLJoin::getCardCounts(std::vector<CardCount> &counts) const
+{
+    Join::getCardCounts(counts, true, false);
+}
+
 }  // namespace cardinality
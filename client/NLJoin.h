@@ -49,6 +49,7 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
 
     // serialization
@@ -58,17 +59,35 @@ public:
 
     // plan exploration
     void print(std::ostream &, const int, const double) const;
+    bool isSortedOn(const ColID) const;
 
     // cost estimation
     double estCost(const double = 0.0) const;
 
+    // cardinality feedback
+    void getCardCounts(std::vector<CardCount> &) const;
+
 protected:
+    // helpers for GetNext() with a remote inner plan
+    bool GetNextRemote(Tuple &);
+    bool fillBatch();
+
     // operator description
     ColID index_join_col_id_;
     static const ColID NOT_INDEX_JOIN = 0xffff;
 
     // execution states
     enum { STATE_OPEN, STATE_REOPEN, STATE_GETNEXT } state_;
+    bool batched_;                      // join values are looked up in batches
+    bool left_done_;
+    uint32_t left_pos_;                 // position in left_batch_
+    std::vector<char> batch_buffer_;    // copies of outer tuples
+    std::vector<uint32_t> batch_lengths_;
+    std::vector<Chunk> batch_tuples_;   // outer tuples, column by column
+    std::vector<Chunk> batch_values_;   // their join values
+
+    // constants
+    static const std::size_t NLJOIN_BATCHSIZE = 1024;
 
 private:
     NLJoin& operator=(const NLJoin &);
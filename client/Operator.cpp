@@ -28,17 +28,88 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "client/Operator.h"
+#include <cstring>  // std::memcmp
+#include <algorithm>  // std::min
+#include <stdexcept>  // std::runtime_error
 #include <boost/spirit/include/qi.hpp>
 #include "client/SeqScan.h"
 #include "client/IndexScan.h"
 #include "client/NLJoin.h"
+#include "client/PairJoin.h"
 #include "client/NBJoin.h"
+#include "client/HashJoin.h"
+#include "client/MergeJoin.h"
 #include "client/Remote.h"
 #include "client/Union.h"
+#include "client/Exchange.h"
 
 
 namespace cardinality {
 
+TupleBatch::TupleBatch()
+    : cols(), sel(), num_rows(),
+      buffer(), copies()
+{
+}
+
+void TupleBatch::reset(const ColID num_cols)
+{
+    cols.resize(num_cols);
+    for (ColID i = 0; i < num_cols; ++i) {
+        cols[i].clear();
+    }
+    sel.clear();
+    num_rows = 0;
+    buffer.clear();
+    copies.clear();
+}
+
+void TupleBatch::selectAll()
+{
+    sel.resize(num_rows);
+    for (uint32_t i = 0; i < num_rows; ++i) {
+        sel[i] = i;
+    }
+}
+
+void TupleBatch::copyValue(const ColID cid, const Chunk &value)
+{
+    buffer.insert(buffer.end(), value.first, value.first + value.second);
+    buffer.push_back('\0');
+    copies.push_back(std::make_pair(cid, cols[cid].size()));
+    cols[cid].push_back(Chunk(NULL, value.second));
+}
+
+// Pointers are taken after the buffer stops growing.
+void TupleBatch::fixCopies()
+{
+    const char *pos = buffer.data();
+    for (std::size_t i = 0; i < copies.size(); ++i) {
+        Chunk &value = cols[copies[i].first][copies[i].second];
+        value.first = pos;
+        pos += value.second + 1;
+    }
+    copies.clear();
+}
+
+void TupleBatch::getTuple(const uint32_t i, Tuple &tuple) const
+{
+    tuple.clear();
+    for (std::size_t c = 0; c < cols.size(); ++c) {
+        tuple.push_back(cols[c][sel[i]]);
+    }
+}
+
+SliceCursor::SliceCursor(const uint32_t b, const uint32_t s)
+    : base(b), stride(s), next(0)
+{
+}
+
+uint32_t SliceCursor::claim()
+{
+    return base + __sync_fetch_and_add(&next, 1) * stride;
+}
+
 Operator::Operator(const NodeID n)
     : node_id_(n)
 {
@@ -77,6 +148,61 @@ int Operator::ByteSize() const
     return total_size;
 }
 
+bool Operator::GetNextBatch(TupleBatch &batch)
+{
+    Tuple tuple;
+    bool done = false;
+
+    batch.reset(numOutputCols());
+    while (batch.num_rows < OPERATOR_BATCHSIZE) {
+        if ((done = GetNext(tuple))) {
+            break;
+        }
+        for (ColID i = 0; i < tuple.size(); ++i) {
+            batch.copyValue(i, tuple[i]);
+        }
+        ++batch.num_rows;
+    }
+    batch.fixCopies();
+    batch.selectAll();
+
+    return done;
+}
+
+void Operator::OpenLookup(const std::vector<Chunk> &)
+{
+    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+}
+
+void Operator::ReOpenLookup(const std::vector<Chunk> &)
+{
+    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+}
+
+bool Operator::GetNextLookup(Tuple &, uint32_t &)
+{
+    throw std::runtime_error(BOOST_CURRENT_FUNCTION);
+}
+
+void Operator::setSliceCursor(boost::shared_ptr<SliceCursor>)
+{
+}
+
+int Operator::pollDescriptor() const
+{
+    return -1;
+}
+
+bool Operator::isRemoteLookup() const
+{
+    return false;
+}
+
+std::string Operator::getJoinIndexKey(const ColID) const
+{
+    return std::string();
+}
+
 void Operator::Deserialize(google::protobuf::io::CodedInputStream *input)
 {
     input->ReadVarint32(&node_id_);
@@ -97,6 +223,66 @@ uint32_t Operator::parseInt(const Chunk *c)
     return intval;
 }
 
+uint64_t Operator::hashValue(const Chunk &c, const ValueType type,
+                             const uint64_t hash)
+{
+    uint64_t h = hash;
+
+    if (type == STRING) {
+        for (uint32_t i = 0; i < c.second; ++i) {
+            h = (h ^ static_cast<uint8_t>(c.first[i])) * 1099511628211ULL;
+        }
+    } else {  // INT
+        h = (h ^ parseInt(&c)) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+// finalizer of MurmurHash3
+uint64_t Operator::finishHash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+int Operator::compareKey(const ValueType type,
+                         const uint32_t a_intval, const char *a_charval,
+                         const uint32_t b_intval, const char *b_charval)
+{
+    if (type == INT) {
+        return (a_intval > b_intval) - (a_intval < b_intval);
+    }
+
+    int cmp = std::memcmp(a_charval, b_charval,
+                          std::min(a_intval, b_intval));
+    if (cmp == 0) {
+        cmp = (a_intval > b_intval) - (a_intval < b_intval);
+    }
+    return cmp;
+}
+
+Value *Operator::rebindValue(Value *v, const Query *from, const Query *to)
+{
+    if (v >= from->restrictionEqualValues
+        && v < from->restrictionEqualValues + from->nbRestrictionsEqual) {
+        return to->restrictionEqualValues
+               + (v - from->restrictionEqualValues);
+    }
+    if (v >= from->restrictionGreaterThanValues
+        && v < from->restrictionGreaterThanValues
+               + from->nbRestrictionsGreaterThan) {
+        return to->restrictionGreaterThanValues
+               + (v - from->restrictionGreaterThanValues);
+    }
+    return v;
+}
+
 Operator::Ptr Operator::parsePlan(google::protobuf::io::CodedInputStream *input)
 {
     uint32_t operator_type;
@@ -121,6 +307,14 @@ Operator::Ptr Operator::parsePlan(google::protobuf::io::CodedInputStream *input)
         plan = boost::make_shared<NBJoin>(input);
         break;
 
+    case TAG_HASHJOIN:
+        plan = boost::make_shared<HashJoin>(input);
+        break;
+
+    case TAG_MERGEJOIN:
+        plan = boost::make_shared<MergeJoin>(input);
+        break;
+
     case TAG_REMOTE:
         plan = boost::make_shared<Remote>(input);
         break;
@@ -128,6 +322,14 @@ Operator::Ptr Operator::parsePlan(google::protobuf::io::CodedInputStream *input)
     case TAG_UNION:
         plan = boost::make_shared<Union>(input);
         break;
+
+    case TAG_EXCHANGE:
+        plan = boost::make_shared<Exchange>(input);
+        break;
+
+    case TAG_PAIRJOIN:
+        plan = boost::make_shared<PairJoin>(input);
+        break;
     }
 
     return plan;
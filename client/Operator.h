@@ -30,6 +30,8 @@
 #ifndef CARDINALITY_OPERATOR_H_
 #define CARDINALITY_OPERATOR_H_
 
+#include <map>
+#include <string>
 #include <vector>
 #include <utility>  // std::pair
 #include <iostream>  // std::ostream
@@ -49,9 +51,70 @@ typedef uint32_t NodeID;
 typedef std::pair<const char *, uint32_t> Chunk;
 typedef std::vector<Chunk> Tuple;
 
+// A batch of tuples passed column by column by GetNextBatch().
+// The i-th tuple of the batch consists of cols[c][sel[i]] of every
+// column c, so that a filter drops tuples by shrinking the selection
+// vector without touching the values.
+struct TupleBatch {
+    std::vector<std::vector<Chunk> > cols;
+    std::vector<uint32_t> sel;
+    uint32_t num_rows;                  // rows in cols, selected or not
+
+    // values copied by copyValue()
+    std::vector<char> buffer;
+    std::vector<std::pair<ColID, uint32_t> > copies;
+
+    TupleBatch();
+
+    // Empty the batch and set the number of columns.
+    void reset(const ColID);
+
+    // Select all rows in cols.
+    void selectAll();
+
+    // Append a copy of the given value to the given column.
+    // The copy is valid once fixCopies() is called after the last
+    // call to copyValue().
+    void copyValue(const ColID, const Chunk &);
+    void fixCopies();
+
+    // Get the i-th tuple of the batch.
+    void getTuple(const uint32_t, Tuple &) const;
+};
+
+// Shared by the slices of an input to claim its blocks dynamically,
+// so that faster slices take over more blocks. The k-th call to claim()
+// returns block base + k * stride.
+struct SliceCursor {
+    const uint32_t base;
+    const uint32_t stride;
+    uint32_t next;
+
+    SliceCursor(const uint32_t, const uint32_t);
+
+    // Claim the next block atomically.
+    uint32_t claim();
+};
+
+// typedef's for cardinality feedback
+// A table set is the sorted aliases of the tables whose join an operator
+// produces, separated by commas, e.g. "a,b".
+typedef std::pair<std::string, double> CardEstimate;  // table set, tuples
+typedef std::map<std::string, double> CardCorrections;  // table set, factor
+
+// The actual number of tuples returned by an operator.
+struct CardCount {
+    uint64_t num_tuples;
+    bool complete;                      // all result tuples were returned
+    bool sliced;                        // restricted by setSlice()
+};
+
 // defined in PartStats.cpp
 class PartStats;
 
+// defined in BloomFilter.cpp
+class BloomFilter;
+
 // Abstract base class for physical operators.
 class Operator {
 public:
@@ -92,10 +155,58 @@ public:
     // once GetNext() returns true.
     virtual bool GetNext(Tuple &) = 0;
 
+    // Get the next batch of about OPERATOR_BATCHSIZE tuples.
+    // Returns true if there is no more result tuple after the batch.
+    // The batch is empty only if true is returned.
+    // The values are valid until the next call to GetNextBatch().
+    // The caller should not mix GetNext() and GetNextBatch() until the
+    // plan is reopened. The default implementation copies the tuples
+    // returned by GetNext().
+    virtual bool GetNextBatch(TupleBatch &);
+
     // Close this plan.
     // The caller should ensure that this is open.
     virtual void Close() = 0;
 
+    // Drop tuples whose value of the given output column is not in the
+    // given Bloom filter, as close to the scans as possible.
+    // Remote ships the filter to the remote node along with the plan.
+    // The caller should ensure that this is called before Open().
+    virtual void setBloomFilter(const ColID,
+                                boost::shared_ptr<const BloomFilter>) = 0;
+
+    // Restrict the outer-most input of this plan to the given slice out of
+    // the given number of slices, so that the results of all slices add
+    // up to the results of the whole plan. Called by Exchange.
+    // The caller should ensure that this is called before Open().
+    virtual void setSlice(const uint32_t, const uint32_t) = 0;
+
+    // Let the slices of the outer-most input share the given cursor,
+    // which overrides the slice given by setSlice(). Ignored unless the
+    // input is a local SeqScan. Called by Exchange after setSlice().
+    virtual void setSliceCursor(boost::shared_ptr<SliceCursor>);
+
+    // Open this plan for a batch of join values for nested-loop index
+    // join, so that Remote looks them up in a single request.
+    // Implemented by IndexScan, Remote and Union; others throw
+    // std::runtime_error.
+    // The caller should ensure that the batch is not empty and that the
+    // join values are valid until the next call to (Re)OpenLookup().
+    virtual void OpenLookup(const std::vector<Chunk> &);
+
+    // Equivalent to Close() followed by OpenLookup().
+    virtual void ReOpenLookup(const std::vector<Chunk> &);
+
+    // Get the next tuple and the position of its join value in the batch.
+    // Tuples are returned in ascending order of the position.
+    // Returns true if there is no more result tuple for the batch.
+    virtual bool GetNextLookup(Tuple &, uint32_t &);
+
+    // Returns a file descriptor to wait for before calling GetNext(),
+    // or -1 if GetNext() does not wait for data from another node.
+    // Used by Union to read from the fastest of its children.
+    virtual int pollDescriptor() const;
+
     // Serialization -------------------------------------------------
 
     // Serialize this plan to the provided buffer.
@@ -145,6 +256,27 @@ public:
     // Throws std::runtime_error if the column is not found.
     virtual ColID getOutputColID(const ColName) const = 0;
 
+    // Returns true if output tuples are sorted in ascending order of
+    // the given output column. Data files are sorted on the primary key.
+    virtual bool isSortedOn(const ColID) const = 0;
+
+    // Returns true if join values passed to Open() are sent to another
+    // node, in which case nested-loop index join uses OpenLookup().
+    virtual bool isRemoteLookup() const;
+
+    // Returns the key of this plan as an input of a join index: the file
+    // and the column of the given output column of a SeqScan, or the
+    // file and the index column of an IndexScan for nested-loop index
+    // join. Returns an empty string for other plans.
+    virtual std::string getJoinIndexKey(const ColID) const;
+
+    // Plan Caching --------------------------------------------------
+
+    // Replace the constants taken from the first query by the
+    // corresponding constants of the second query.
+    // The caller should ensure that both queries have the same shape.
+    virtual void rebind(const Query *, const Query *) = 0;
+
     // Cost Estimation -----------------------------------------------
 
     // Estimate cost for executing this plan.
@@ -163,6 +295,29 @@ public:
     // Estimate the size of a particular column.
     virtual double estColSize(const ColID) const = 0;
 
+    // Cardinality Feedback ------------------------------------------
+
+    // Returns the table set of this plan, or an empty string if it
+    // produces no tuples.
+    virtual std::string getTableSet() const = 0;
+
+    // Append the table set and the estimated cardinality of each scan
+    // and join in this plan in pre-order. The estimates are taken
+    // before the correction of the operator itself, so that the ratio
+    // of the actual cardinality to the estimate is its new correction.
+    // The table set is empty if no estimate is available.
+    virtual void getCardEstimates(std::vector<CardEstimate> &) const = 0;
+
+    // Append the actual cardinality of each scan and join in this plan
+    // in the same order as getCardEstimates(). Counts of a remote plan
+    // are those reported by the remote node along with the end of its
+    // results. The caller should ensure that this is open.
+    virtual void getCardCounts(std::vector<CardCount> &) const = 0;
+
+    // Scale the estimated cardinality of each scan and join in this plan
+    // by the correction for its table set, if any.
+    virtual void setCardCorrections(const CardCorrections &) = 0;
+
     // Others --------------------------------------------------------
 
     // Accessor
@@ -171,14 +326,39 @@ public:
     // Parse an integer from a Chunk.
     static uint32_t parseInt(const Chunk *);
 
+    // Hash a value of the given type with FNV-1a, continuing from the
+    // hash of the previous values so that several columns can be hashed
+    // together. Integers are hashed by value so that e.g. "07" and "7"
+    // collide. finishHash() spreads the bits over the whole word.
+    static uint64_t hashValue(const Chunk &, const ValueType,
+                              const uint64_t = HASH_OFFSET_BASIS);
+    static uint64_t finishHash(uint64_t);
+
+    // Compare two keys of the given type, each given by its value if
+    // INT, or by its length and characters if STRING. Integers are
+    // compared as unsigned values and strings byte by byte, as IndexScan
+    // did with the results of getNext().
+    static int compareKey(const ValueType, const uint32_t, const char *,
+                          const uint32_t, const char *);
+
     // Construct a plan from the given serialized stream produced by
     // Remote::Open() using deserialization constructors.
     static Operator::Ptr parsePlan(google::protobuf::io::CodedInputStream *);
 
 protected:
+    // Helper for rebind().
+    // Returns the constant of the second query that corresponds to
+    // the given constant of the first query.
+    static Value *rebindValue(Value *, const Query *, const Query *);
+
     // Tags indicating operator types in a serialized plan.
     enum { TAG_SEQSCAN, TAG_INDEXSCAN, TAG_NLJOIN, TAG_NBJOIN,
-	   TAG_REMOTE, TAG_UNION };
+	   TAG_REMOTE, TAG_UNION, TAG_HASHJOIN, TAG_MERGEJOIN,
+	   TAG_EXCHANGE, TAG_PAIRJOIN };
+
+    // constants
+    static const uint32_t OPERATOR_BATCHSIZE = 1024;
+    static const uint64_t HASH_OFFSET_BASIS = 14695981039346656037ULL;
 
     // operator description
     NodeID node_id_;
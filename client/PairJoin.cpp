@@ -0,0 +1,261 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/PairJoin.h"
+#include "client/Scan.h"
+#include "client/IOManager.h"
+
+
+namespace cardinality {
+
+PairJoin::PairJoin(const NodeID n, Operator::Ptr l, Operator::Ptr r,
+                   const Query *q, const int x, const char *idxJoinCol)
+    : NLJoin(n, l, r, q, x, idxJoinCol),
+      slice_(0), num_slices_(1),
+      index_(), left_scan_(), right_scan_(), cursor_(),
+      block_(), pos_(), block_end_(), left_offset_(), left_match_()
+{
+}
+
+PairJoin::PairJoin(google::protobuf::io::CodedInputStream *input)
+    : NLJoin(input),
+      slice_(), num_slices_(),
+      index_(), left_scan_(), right_scan_(), cursor_(),
+      block_(), pos_(), block_end_(), left_offset_(), left_match_()
+{
+    Deserialize(input);
+}
+
+PairJoin::PairJoin(const PairJoin &x)
+    : NLJoin(x),
+      slice_(x.slice_), num_slices_(x.num_slices_),
+      index_(), left_scan_(), right_scan_(), cursor_(),
+      block_(), pos_(), block_end_(), left_offset_(), left_match_()
+{
+}
+
+PairJoin::~PairJoin()
+{
+}
+
+Operator::Ptr PairJoin::clone() const
+{
+    return boost::make_shared<PairJoin>(*this);
+}
+
+// Both inputs are scans if they have join index keys.
+void PairJoin::Open(const Chunk *join_value)
+{
+    index_.reset();
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    std::string left_key = left_child_->getJoinIndexKey(index_join_col_id_);
+    std::string right_key = right_child_->getJoinIndexKey(0);
+    if (!left_key.empty() && !right_key.empty()) {
+        index_ = IOManager::instance()->openJoinIndex(
+                     JoinIndex::getName(left_key, right_key));
+    }
+#endif
+    if (!index_) {
+        NLJoin::Open(join_value);
+        return;
+    }
+
+    resetCardCount();
+    left_scan_ = static_cast<Scan *>(left_child_.get());
+    right_scan_ = static_cast<Scan *>(right_child_.get());
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    left_scan_->OpenRows();
+    right_scan_->OpenRows();
+#endif
+    left_offset_ = ~0ULL;
+    left_match_ = false;
+    seekBlock(cursor_ ? cursor_->claim() : slice_);
+}
+
+bool PairJoin::GetNext(Tuple &tuple)
+{
+    if (!index_) {
+        return NLJoin::GetNext(tuple);
+    }
+
+    while (nextPair()) {
+        if (execFilter(left_tuple_, right_tuple_)) {
+            execProject(left_tuple_, right_tuple_, tuple);
+            return false;
+        }
+    }
+
+    return finishOutput(true);
+}
+
+// The values of both tuples point into the memory-mapped files, so
+// neither of them is copied into the batch.
+bool PairJoin::GetNextBatch(TupleBatch &batch)
+{
+    if (!index_) {
+        return NLJoin::GetNextBatch(batch);
+    }
+
+    batch.reset(numOutputCols());
+
+    bool done = false;
+    while (batch.num_rows < OPERATOR_BATCHSIZE) {
+        if (!nextPair()) {
+            done = true;
+            break;
+        }
+        if (execFilter(left_tuple_, right_tuple_)) {
+            execProject(left_tuple_, right_tuple_, batch, false);
+        }
+    }
+
+    batch.selectAll();
+
+    return finishOutput(done);
+}
+
+// Fetch the rows of the next pair satisfying the restrictions of both
+// inputs into left_tuple_ and right_tuple_. A left row is fetched once
+// for all its pairs, and the right rows only if it matches.
+// Returns false if there are no more pairs in the slice.
+bool PairJoin::nextPair()
+{
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    for (;;) {
+        if (pos_ == block_end_) {
+            if (block_end_ == index_->numPairs()) {
+                return false;
+            }
+            seekBlock(cursor_ ? cursor_->claim() : block_ + num_slices_);
+            continue;
+        }
+
+        const JoinIndex::Pair &pair = index_->getPair(pos_++);
+        if (pair.left != left_offset_) {
+            left_offset_ = pair.left;
+            left_match_ = left_scan_->GetRow(pair.left, left_tuple_);
+        }
+        if (left_match_ && right_scan_->GetRow(pair.right, right_tuple_)) {
+            return true;
+        }
+    }
+#else
+    return false;
+#endif
+}
+
+// If the join is split into slices, the left file is split into blocks
+// of PAIRJOIN_BLOCKSIZE bytes, which are assigned to the slices in the
+// same way as SeqScan does. A pair belongs to the block where its left
+// row starts.
+void PairJoin::seekBlock(const uint32_t block)
+{
+    block_ = block;
+    pos_ = index_->findPair(static_cast<uint64_t>(block)
+                            * PAIRJOIN_BLOCKSIZE);
+    block_end_ = index_->findPair(static_cast<uint64_t>(block + 1)
+                                  * PAIRJOIN_BLOCKSIZE);
+}
+
+void PairJoin::Close()
+{
+    if (!index_) {
+        NLJoin::Close();
+    }
+}
+
+void PairJoin::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    slice_ = slice;
+    num_slices_ = num_slices;
+    NLJoin::setSlice(slice, num_slices);
+}
+
+void PairJoin::setSliceCursor(boost::shared_ptr<SliceCursor> cursor)
+{
+    cursor_ = cursor;
+    NLJoin::setSliceCursor(cursor);
+}
+
+uint8_t *PairJoin::SerializeToArray(uint8_t *target) const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    target = CodedOutputStream::WriteTagToArray(TAG_PAIRJOIN, target);
+
+    target = Join::SerializeToArray(target);
+
+    target = CodedOutputStream::WriteLittleEndian32ToArray(
+                 index_join_col_id_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(slice_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(num_slices_, target);
+
+    return target;
+}
+
+int PairJoin::ByteSize() const
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    int total_size = NLJoin::ByteSize();
+
+    total_size += CodedOutputStream::VarintSize32(slice_);
+    total_size += CodedOutputStream::VarintSize32(num_slices_);
+
+    return total_size;
+}
+
+void PairJoin::Deserialize(google::protobuf::io::CodedInputStream *input)
+{
+    input->ReadVarint32(&slice_);
+    input->ReadVarint32(&num_slices_);
+}
+
+void PairJoin::print(std::ostream &os, const int tab, const double) const
+{
+    os << std::string(4 * tab, ' ');
+    os << "PairJoin@" << node_id();
+    os << " #cols=" << numOutputCols();
+    os << " len=" << estTupleSize();
+    os << " card=" << estCardinality();
+    os << " cost=" << estCost();
+    os << std::endl;
+
+    left_child_->print(os, tab + 1);
+    right_child_->print(os, tab + 1, left_child_->estCardinality());
+}
+
+// Through a join index, the left input returns only the rows with
+// matches.
+void PairJoin::getCardCounts(std::vector<CardCount> &counts) const
+{
+    Join::getCardCounts(counts, !index_, false);
+}
+
+}  // namespace cardinality
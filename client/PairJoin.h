@@ -0,0 +1,104 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CARDINALITY_PAIRJOIN_H_
+#define CARDINALITY_PAIRJOIN_H_
+
+#include "client/NLJoin.h"
+#include "client/JoinIndex.h"
+
+
+namespace cardinality {
+
+class Scan;
+
+// Nested-loop index join of a SeqScan and an IndexScan on the same node,
+// which walks the join index of their files if pretreatment has built
+// one, instead of probing the inner index for every outer tuple. The
+// outer file is read in order, and only the outer rows with matches and
+// their inner rows are fetched. Falls back to NLJoin otherwise.
+class PairJoin: public NLJoin {
+public:
+    // constructor, destructor
+    PairJoin(const NodeID, Operator::Ptr, Operator::Ptr,
+             const Query *, const int, const char *);
+    explicit PairJoin(google::protobuf::io::CodedInputStream *);
+    PairJoin(const PairJoin &);
+    ~PairJoin();
+    Operator::Ptr clone() const;
+
+    // query execution
+    void Open(const Chunk * = NULL);
+    bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
+    void Close();
+    void setSlice(const uint32_t, const uint32_t);
+    void setSliceCursor(boost::shared_ptr<SliceCursor>);
+
+    // serialization
+    uint8_t *SerializeToArray(uint8_t *) const;
+    int ByteSize() const;
+    void Deserialize(google::protobuf::io::CodedInputStream *);
+
+    // plan exploration
+    void print(std::ostream &, const int, const double) const;
+
+    // cardinality feedback
+    void getCardCounts(std::vector<CardCount> &) const;
+
+protected:
+    // helpers for GetNext()
+    bool nextPair();
+    void seekBlock(const uint32_t);
+
+    // operator description
+    uint32_t slice_;
+    uint32_t num_slices_;
+
+    // execution states
+    JoinIndex::Ptr index_;
+    Scan *left_scan_;
+    Scan *right_scan_;
+    boost::shared_ptr<SliceCursor> cursor_;
+    uint32_t block_;
+    std::size_t pos_;                   // next pair
+    std::size_t block_end_;             // end of the pairs of block_
+    uint64_t left_offset_;              // offset of left_tuple_
+    bool left_match_;
+
+    // constants
+    static const std::size_t PAIRJOIN_BLOCKSIZE = 1048576;
+
+private:
+    PairJoin& operator=(const PairJoin &);
+};
+
+}  // namespace cardinality
+
+#endif  // CARDINALITY_PAIRJOIN_H_
@@ -29,19 +29,28 @@
 
 #include "client/PartStats.h"
 #include <string>
+#include <utility>  // std::pair
+#include <functional>  // std::greater
 #include <cstring>
-#include <algorithm>  // std::min
+#include <cmath>  // std::log, std::pow
+#include <algorithm>  // std::min, std::max, std::sort, std::upper_bound
 #include <boost/filesystem/operations.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/spirit/include/qi.hpp>
 #include <google/protobuf/wire_format_lite_inl.h>
-#include "lib/index/include/server.h"
+#include "client/HyperLogLog.h"
+#include "client/Tokenizer.h"
 
 
 namespace cardinality {
 
 static const int PAGE_SIZE = 4096;
 
+Histogram::Histogram()
+    : mcvs(), mcv_fracs(), bounds(), other_frac(), other_distinct()
+{
+}
+
 PartStats::PartStats(const Table *table, const int part_no)
     : part_no_(part_no),
       num_pages_(),
@@ -49,37 +58,36 @@ PartStats::PartStats(const Table *table, const int part_no)
       col_lengths_(table->nbFields),
       min_pkey_(),
       max_pkey_(),
+      histograms_(),
+      column_indexes_(table->nbFields),
+      zones_(),
       next_(NULL)
 {
+    std::vector<ValueType> types(table->fieldsType,
+                                 table->fieldsType + table->nbFields);
     init(table->partitions[part_no].fileName,
          table->nbFields,
          table->fieldsType[0]);
-#ifdef ENABLE_NUM_DISTINCT_VALUES
-    std::vector<std::string> fieldnames;
-    fieldnames.reserve(table->nbFields);
-    for (int i = 0; i < table->nbFields; ++i) {
-        fieldnames.push_back(table->fieldsName[i]);
-    }
-    init2(table->tableName, fieldnames);
-#endif
+    initNumDistinctValues(table->partitions[part_no].fileName, types);
+    initHistograms(table->partitions[part_no].fileName, types);
 }
 
-PartStats::PartStats(const std::string &tablename,
-                     const std::string &filename,
-                     const ValueType pkey_type,
-                     const std::vector<std::string> &fieldnames)
+PartStats::PartStats(const std::string &filename,
+                     const std::vector<ValueType> &types)
     : part_no_(0),
       num_pages_(),
-      num_distinct_values_(fieldnames.size(), 20.0),
-      col_lengths_(fieldnames.size()),
+      num_distinct_values_(types.size(), 20.0),
+      col_lengths_(types.size()),
       min_pkey_(),
       max_pkey_(),
+      histograms_(),
+      column_indexes_(types.size()),
+      zones_(),
       next_(NULL)
 {
-    init(filename, fieldnames.size(), pkey_type);
-#ifdef ENABLE_NUM_DISTINCT_VALUES
-    init2(tablename, fieldnames);
-#endif
+    init(filename, types.size(), types[0]);
+    initNumDistinctValues(filename, types);
+    initHistograms(filename, types);
 }
 
 PartStats::PartStats(google::protobuf::io::CodedInputStream *input)
@@ -89,6 +97,9 @@ PartStats::PartStats(google::protobuf::io::CodedInputStream *input)
       col_lengths_(),
       min_pkey_(),
       max_pkey_(),
+      histograms_(),
+      column_indexes_(),
+      zones_(),
       next_(NULL)
 {
     Deserialize(input);
@@ -101,6 +112,9 @@ PartStats::PartStats()
       col_lengths_(),
       min_pkey_(),
       max_pkey_(),
+      histograms_(),
+      column_indexes_(),
+      zones_(),
       next_(NULL)
 {
 }
@@ -143,6 +157,48 @@ uint8_t *PartStats::SerializeToArray(uint8_t *target) const
                      max_pkey_.charVal, len, target);
     }
 
+    target = CodedOutputStream::WriteVarint32ToArray(
+                 histograms_.size(), target);
+    for (std::size_t i = 0; i < histograms_.size(); ++i) {
+        const Histogram &h = histograms_[i];
+        target = CodedOutputStream::WriteVarint32ToArray(h.mcvs.size(), target);
+        for (std::size_t j = 0; j < h.mcvs.size(); ++j) {
+            target = CodedOutputStream::WriteVarint32ToArray(
+                         h.mcvs[j].size(), target);
+            target = CodedOutputStream::WriteStringToArray(h.mcvs[j], target);
+            target = WireFormatLite::WriteDoubleNoTagToArray(
+                         h.mcv_fracs[j], target);
+        }
+        target = CodedOutputStream::WriteVarint32ToArray(
+                     h.bounds.size(), target);
+        for (std::size_t j = 0; j < h.bounds.size(); ++j) {
+            target = CodedOutputStream::WriteVarint32ToArray(
+                         h.bounds[j].size(), target);
+            target = CodedOutputStream::WriteStringToArray(h.bounds[j], target);
+        }
+        target = WireFormatLite::WriteDoubleNoTagToArray(h.other_frac, target);
+        target = WireFormatLite::WriteDoubleNoTagToArray(h.other_distinct,
+                                                         target);
+    }
+
+    target = CodedOutputStream::WriteVarint32ToArray(
+                 column_indexes_.size(), target);
+    for (std::size_t i = 0; i < column_indexes_.size(); ++i) {
+        *target++ = column_indexes_[i];
+    }
+
+    target = CodedOutputStream::WriteVarint32ToArray(zones_.size(), target);
+    for (std::size_t i = 0; i < zones_.size(); ++i) {
+        target = CodedOutputStream::WriteVarint32ToArray(zones_[i].size(),
+                                                         target);
+        for (std::size_t j = 0; j < zones_[i].size(); ++j) {
+            target = CodedOutputStream::WriteVarint32ToArray(
+                         zones_[i][j].first, target);
+            target = CodedOutputStream::WriteVarint32ToArray(
+                         zones_[i][j].second, target);
+        }
+    }
+
     return target;
 }
 
@@ -174,6 +230,33 @@ int PartStats::ByteSize() const
         total_size += len;
     }
 
+    total_size += WireFormatLite::UInt32Size(histograms_.size());
+    for (std::size_t i = 0; i < histograms_.size(); ++i) {
+        const Histogram &h = histograms_[i];
+        total_size += WireFormatLite::UInt32Size(h.mcvs.size());
+        for (std::size_t j = 0; j < h.mcvs.size(); ++j) {
+            total_size += WireFormatLite::StringSize(h.mcvs[j]);
+            total_size += 8;
+        }
+        total_size += WireFormatLite::UInt32Size(h.bounds.size());
+        for (std::size_t j = 0; j < h.bounds.size(); ++j) {
+            total_size += WireFormatLite::StringSize(h.bounds[j]);
+        }
+        total_size += 8 + 8;
+    }
+
+    total_size += WireFormatLite::UInt32Size(column_indexes_.size());
+    total_size += column_indexes_.size();
+
+    total_size += WireFormatLite::UInt32Size(zones_.size());
+    for (std::size_t i = 0; i < zones_.size(); ++i) {
+        total_size += WireFormatLite::UInt32Size(zones_[i].size());
+        for (std::size_t j = 0; j < zones_[i].size(); ++j) {
+            total_size += WireFormatLite::UInt32Size(zones_[i][j].first);
+            total_size += WireFormatLite::UInt32Size(zones_[i][j].second);
+        }
+    }
+
     return total_size;
 }
 
@@ -215,6 +298,48 @@ void PartStats::Deserialize(google::protobuf::io::CodedInputStream *input)
         input->ReadRaw(max_pkey_.charVal, temp);
         max_pkey_.charVal[temp] = '\0';
     }
+
+    input->ReadVarint32(&size);
+    histograms_.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        Histogram &h = histograms_[i];
+        input->ReadVarint32(&temp);
+        h.mcvs.resize(temp);
+        h.mcv_fracs.resize(temp);
+        for (std::size_t j = 0; j < h.mcvs.size(); ++j) {
+            WireFormatLite::ReadString(input, &h.mcvs[j]);
+            WireFormatLite::ReadPrimitive<double, WireFormatLite::TYPE_DOUBLE>(
+                input, &h.mcv_fracs[j]);
+        }
+        input->ReadVarint32(&temp);
+        h.bounds.resize(temp);
+        for (std::size_t j = 0; j < h.bounds.size(); ++j) {
+            WireFormatLite::ReadString(input, &h.bounds[j]);
+        }
+        WireFormatLite::ReadPrimitive<double, WireFormatLite::TYPE_DOUBLE>(
+            input, &h.other_frac);
+        WireFormatLite::ReadPrimitive<double, WireFormatLite::TYPE_DOUBLE>(
+            input, &h.other_distinct);
+    }
+
+    input->ReadVarint32(&size);
+    column_indexes_.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        uint8_t flag = 0;
+        input->ReadRaw(&flag, 1);
+        column_indexes_[i] = flag;
+    }
+
+    input->ReadVarint32(&size);
+    zones_.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        input->ReadVarint32(&temp);
+        zones_[i].resize(temp);
+        for (std::size_t j = 0; j < zones_[i].size(); ++j) {
+            input->ReadVarint32(&zones_[i][j].first);
+            input->ReadVarint32(&zones_[i][j].second);
+        }
+    }
 }
 
 static inline void extractPrimaryKey(const char *pos,
@@ -294,48 +419,320 @@ void PartStats::init(const std::string filename,
     num_distinct_values_[0] = file_size / tuple_length;
 }
 
-void PartStats::init2(const std::string tablename,
-                      const std::vector<std::string> &fieldnames)
+// Sampled blocks go alternately to two sketches of each column. If the
+// file is larger than the sample, the number of distinct values is
+// extrapolated assuming that it grows as a power of the sample size, from
+// a constant for columns with few values to a linear growth for keys.
+// The exponent is given by the growth from half of the sample to the
+// whole sample.
+void PartStats::initNumDistinctValues(const std::string filename,
+                                      const std::vector<ValueType> &types)
 {
-    Index *index;
-    TxnState *txn;
-    Record record;
-    Value value;
+    std::size_t file_size = boost::filesystem::file_size(filename);
+    if (file_size == 0) {
+        return;
+    }
 
-    for (std::size_t i = 1; i < fieldnames.size(); ++i) {
-        if (fieldnames[i].empty() || fieldnames[i][0] != '_') {
-            continue;
+    boost::iostreams::mapped_file_source file(filename);
+
+    std::size_t num_blocks = NDV_SAMPLE_BLOCKS;
+    std::size_t block_size = NDV_SAMPLE_SIZE / NDV_SAMPLE_BLOCKS;
+    if (file_size <= NDV_SAMPLE_SIZE) {
+        num_blocks = 1;
+        block_size = file_size;
+    }
+
+    std::vector<HyperLogLog> sketches[2];
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        sketches[0].push_back(HyperLogLog(types[i]));
+        sketches[1].push_back(HyperLogLog(types[i]));
+    }
+
+    std::vector<const char *> delims(types.size());
+    std::size_t num_rows = 0;
+    std::size_t sample_size = 0;
+
+    for (std::size_t b = 0; b < num_blocks; ++b) {
+        // sketch the rows starting in the block
+        const char *pos = file.begin() + b * (file_size / num_blocks);
+        const char *block_end = pos + block_size;
+        if (pos > file.begin()) {
+            pos = static_cast<const char *>(
+                      std::memchr(pos - 1, '\n', file.end() - pos + 1));
+            if (pos == NULL) {
+                break;
+            }
+            ++pos;
+        }
+        const char *block_begin = pos;
+
+        while (pos < block_end) {
+            if (splitLine(pos, file.end(), types.size(), '\n', &delims[0])
+                == NULL) {
+                break;
+            }
+            for (std::size_t i = 0; i < types.size(); ++i) {
+                sketches[b % 2][i].insert(Chunk(pos, delims[i] - pos));
+                pos = delims[i] + 1;
+            }
+            ++num_rows;
         }
+        sample_size += pos - block_begin;
+    }
+
+    if (num_rows == 0) {
+        return;
+    }
 
-        std::string index_col = tablename + "." + fieldnames[i];
+    double scale = static_cast<double>(file_size) / sample_size;
+    num_distinct_values_[0] = num_rows * scale;
+
+    for (std::size_t i = 1; i < types.size(); ++i) {
+        HyperLogLog whole(sketches[0][i]);
+        whole.merge(sketches[1][i]);
+        double ndv = whole.estimate();
+
+        if (sample_size < file_size) {
+            double half = (sketches[0][i].estimate()
+                           + sketches[1][i].estimate()) / 2;
+            double growth = (half > 0) ? std::log(ndv / half) / std::log(2.0)
+                                       : 0.0;
+            growth = std::min(std::max(growth, 0.0), 1.0);
+            ndv *= std::pow(scale, growth);
+        }
 
-        std::size_t num_values = 0;
-        std::size_t num_distinct_values = 0;
+        num_distinct_values_[i] = std::min(std::max(ndv, 1.0),
+                                           num_distinct_values_[0]);
+    }
+}
 
-        openIndex(index_col.c_str(), &index);
-        beginTransaction(&txn);
+// Encode an INT value in 4 big-endian bytes, which sort like the value.
+static inline std::string encodeInt(const uint32_t intval)
+{
+    std::string s(4, '\0');
+    s[0] = static_cast<char>(intval >> 24);
+    s[1] = static_cast<char>(intval >> 16);
+    s[2] = static_cast<char>(intval >> 8);
+    s[3] = static_cast<char>(intval);
+    return s;
+}
 
-        while (getNext(index, txn, &record) == SUCCESS) {
-            ++num_values;
-            if (record.val.type == INT) {
-                if (record.val.intVal != value.intVal) {
-                    value.intVal = record.val.intVal;
-                    ++num_distinct_values;
-                }
+static inline uint32_t decodeInt(const std::string &s)
+{
+    const uint8_t *buf = reinterpret_cast<const uint8_t *>(s.data());
+    return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+static inline std::string encodeValue(const Value *v)
+{
+    if (v->type == INT) {
+        return encodeInt(v->intVal);
+    } else {  // STRING
+        return std::string(v->charVal);
+    }
+}
+
+// Rows are sampled at evenly spaced offsets, so that every row is
+// sampled if the file is small.
+void PartStats::initHistograms(const std::string filename,
+                               const std::vector<ValueType> &types)
+{
+    std::size_t file_size = boost::filesystem::file_size(filename);
+    if (file_size == 0) {
+        return;
+    }
+
+    boost::iostreams::mapped_file_source file(filename);
+    std::vector<std::vector<std::string> > samples(types.size());
+    std::vector<const char *> delims(types.size());
+    std::size_t step = std::max<std::size_t>(
+                           1, file_size / HISTOGRAM_SAMPLE_SIZE);
+    const char *prev = NULL;
+
+    for (std::size_t offset = 0; offset < file_size; offset += step) {
+        // sample the first row starting at or after the offset
+        const char *pos = file.begin() + offset;
+        if (offset > 0) {
+            const char *eol = static_cast<const char *>(
+                                  std::memchr(pos - 1, '\n',
+                                              file.end() - pos + 1));
+            if (eol == NULL || eol + 1 == file.end()) {
+                break;
+            }
+            pos = eol + 1;
+        }
+        if (pos == prev) {
+            continue;
+        }
+        prev = pos;
+
+        if (splitLine(pos, file.end(), types.size(), '\n', &delims[0])
+            == NULL) {
+            break;
+        }
+
+        for (std::size_t i = 0; i < types.size(); ++i) {
+            if (types[i] == INT) {
+                uint32_t intval = 0;
+                const char *digits = pos;
+                boost::spirit::qi::parse(digits, delims[i],
+                                         boost::spirit::uint_, intval);
+                samples[i].push_back(encodeInt(intval));
             } else {  // STRING
-                if (std::strcmp(record.val.charVal, value.charVal)) {
-                    std::strcpy(value.charVal, record.val.charVal);
-                    ++num_distinct_values;
-                }
+                samples[i].push_back(std::string(pos, delims[i]));
             }
+            pos = delims[i] + 1;
+        }
+    }
+
+    histograms_.resize(types.size());
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        buildHistogram(samples[i], num_distinct_values_[i], histograms_[i]);
+    }
+}
+
+// Values occurring in more than one bucket's worth of the sample become
+// the most common values. The number of distinct other values in the
+// partition is derived from that of the column.
+void PartStats::buildHistogram(std::vector<std::string> &values,
+                               const double num_distinct_values,
+                               Histogram &h)
+{
+    std::size_t n = values.size();
+    if (n == 0) {
+        return;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    // count the occurrences of each distinct value
+    std::vector<std::pair<std::size_t, std::size_t> > runs;  // count, first
+    for (std::size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && values[j] == values[i]; ++j) {
+        }
+        runs.push_back(std::make_pair(j - i, i));
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t> > by_count(runs);
+    std::sort(by_count.begin(), by_count.end(),
+              std::greater<std::pair<std::size_t, std::size_t> >());
+
+    std::vector<bool> is_mcv(n);
+    std::size_t num_mcvs = by_count.size();
+    if (num_mcvs > HISTOGRAM_NUM_MCVS) {
+        num_mcvs = HISTOGRAM_NUM_MCVS;
+    }
+    for (std::size_t k = 0; k < num_mcvs; ++k) {
+        if (by_count[k].first < 2
+            || by_count[k].first * HISTOGRAM_NUM_BUCKETS < n) {
+            break;
         }
+        h.mcvs.push_back(values[by_count[k].second]);
+        h.mcv_fracs.push_back(static_cast<double>(by_count[k].first) / n);
+        is_mcv[by_count[k].second] = true;
+    }
 
-        commitTransaction(txn);
-        closeIndex(index);
+    // the other values in sorted order
+    std::vector<std::string> others;
+    std::size_t num_distinct = 0;
+    for (std::size_t k = 0; k < runs.size(); ++k) {
+        if (is_mcv[runs[k].second]) {
+            continue;
+        }
+        others.insert(others.end(), runs[k].first, values[runs[k].second]);
+        ++num_distinct;
+    }
 
-        num_distinct_values_[i] = num_distinct_values;
-        num_distinct_values_[0] = num_values;
+    h.other_frac = static_cast<double>(others.size()) / n;
+    if (others.empty()) {
+        return;
     }
+
+    std::size_t num_buckets = others.size();
+    if (num_buckets > HISTOGRAM_NUM_BUCKETS) {
+        num_buckets = HISTOGRAM_NUM_BUCKETS;
+    }
+    for (std::size_t b = 0; b <= num_buckets; ++b) {
+        h.bounds.push_back(others[b * (others.size() - 1) / num_buckets]);
+    }
+
+    h.other_distinct = std::min(
+                           std::max<double>(
+                               num_distinct,
+                               num_distinct_values - h.mcvs.size()),
+                           std::max<double>(
+                               num_distinct,
+                               num_distinct_values_[0] * h.other_frac));
+}
+
+bool PartStats::hasHistogram(const std::size_t col) const
+{
+    return col < histograms_.size()
+           && (!histograms_[col].mcvs.empty()
+               || !histograms_[col].bounds.empty());
+}
+
+bool PartStats::hasColumnIndex(const std::size_t col) const
+{
+    return col < column_indexes_.size() && column_indexes_[col];
+}
+
+// A value out of the range of the histogram matches no other values.
+// The estimates are at least a row.
+double PartStats::estSelectivityEq(const std::size_t col,
+                                   const Value *value) const
+{
+    const Histogram &h = histograms_[col];
+    std::string v(encodeValue(value));
+    double min_sel = 1.0 / std::max(num_distinct_values_[0], 1.0);
+
+    for (std::size_t j = 0; j < h.mcvs.size(); ++j) {
+        if (h.mcvs[j] == v) {
+            return h.mcv_fracs[j];
+        }
+    }
+
+    if (h.bounds.empty() || v < h.bounds.front() || v > h.bounds.back()) {
+        return min_sel;
+    }
+    return std::max(h.other_frac / h.other_distinct, min_sel);
+}
+
+// Within the bucket containing the value, INT values are assumed to be
+// uniformly distributed, and STRING values to be in the middle.
+double PartStats::estSelectivityGt(const std::size_t col,
+                                   const Value *value) const
+{
+    const Histogram &h = histograms_[col];
+    std::string v(encodeValue(value));
+    double sel = 0.0;
+
+    for (std::size_t j = 0; j < h.mcvs.size(); ++j) {
+        if (h.mcvs[j] > v) {
+            sel += h.mcv_fracs[j];
+        }
+    }
+
+    if (!h.bounds.empty() && v < h.bounds.back()) {
+        if (v < h.bounds.front()) {
+            sel += h.other_frac;
+        } else {
+            std::size_t num_buckets = h.bounds.size() - 1;
+            std::size_t b = std::upper_bound(h.bounds.begin(),
+                                             h.bounds.end(), v)
+                            - h.bounds.begin() - 1;
+            double within = 0.5;
+            if (value->type == INT) {
+                double lo = decodeInt(h.bounds[b]);
+                double hi = decodeInt(h.bounds[b + 1]);
+                within = (hi - value->intVal) / (hi - lo);
+            }
+            sel += h.other_frac * (num_buckets - b - 1 + within)
+                   / num_buckets;
+        }
+    }
+
+    return std::max(sel, 1.0 / std::max(num_distinct_values_[0], 1.0));
 }
 
 }  // namespace cardinality
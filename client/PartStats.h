@@ -32,12 +32,27 @@
 
 #include <vector>
 #include <string>
+#include <utility>  // std::pair
 #include <google/protobuf/io/coded_stream.h>
 #include "include/client.h"
 
 
 namespace cardinality {
 
+// Represent the distribution of a column in a sample of rows: the most
+// common values with their fractions of rows, and an equi-depth histogram
+// of the other values. Values are kept as strings that sort in the order
+// of the column, where INT values take 4 big-endian bytes.
+struct Histogram {
+    std::vector<std::string> mcvs;
+    std::vector<double> mcv_fracs;
+    std::vector<std::string> bounds;    // bucket boundaries
+    double other_frac;                  // fraction of rows not in mcvs
+    double other_distinct;              // distinct values not in mcvs
+
+    Histogram();
+};
+
 // Represent statistics information for a partition
 class PartStats {
 public:
@@ -45,8 +60,7 @@ public:
     PartStats(const Table *, const int);
 
     // constructor called by Connection::handle_stats() at slaves
-    PartStats(const std::string &, const std::string &,
-              const ValueType, const std::vector<std::string> &);
+    PartStats(const std::string &, const std::vector<ValueType> &);
 
     // constructor called by startPreTreatmentSlave() at the master
     PartStats(google::protobuf::io::CodedInputStream *);
@@ -62,6 +76,17 @@ public:
     int ByteSize() const;
     void Deserialize(google::protobuf::io::CodedInputStream *);
 
+    // Estimate the fraction of rows whose values of the given column are
+    // equal to or greater than the given value using the histogram.
+    // Valid only if hasHistogram() returns true for the column.
+    bool hasHistogram(const std::size_t) const;
+    double estSelectivityEq(const std::size_t, const Value *) const;
+    double estSelectivityGt(const std::size_t, const Value *) const;
+
+    // Returns true if the column has an index built by
+    // IOManager::buildColumnIndex() on the node of the partition.
+    bool hasColumnIndex(const std::size_t) const;
+
     // partition information
     // TODO: make these variables private and add accessors
     int part_no_;
@@ -70,6 +95,11 @@ public:
     std::vector<double> col_lengths_;
     Value min_pkey_;
     Value max_pkey_;
+    std::vector<Histogram> histograms_;
+    std::vector<bool> column_indexes_;
+    // smallest and largest keys of the zones of each column in the column
+    // store, coarsened by ColumnStore::build(); empty for other columns
+    std::vector<std::vector<std::pair<uint32_t, uint32_t> > > zones_;
     const PartStats *next_;
 
 private:
@@ -81,8 +111,24 @@ private:
     // by examining a first few pages in the file.
     void init(const std::string, const int, const ValueType);
 
-    // Get the number of distinct values by scanning indexes.
-    void init2(const std::string, const std::vector<std::string> &);
+    // Estimate the number of rows and the numbers of distinct values of
+    // all columns with HyperLogLog sketches of blocks sampled evenly
+    // across the file.
+    void initNumDistinctValues(const std::string,
+                               const std::vector<ValueType> &);
+
+    // Build histograms of all columns from rows sampled evenly across
+    // the file.
+    void initHistograms(const std::string, const std::vector<ValueType> &);
+    void buildHistogram(std::vector<std::string> &, const double,
+                        Histogram &);
+
+    // constants
+    static const std::size_t HISTOGRAM_SAMPLE_SIZE = 4096;
+    static const std::size_t HISTOGRAM_NUM_BUCKETS = 32;
+    static const std::size_t HISTOGRAM_NUM_MCVS = 16;
+    static const std::size_t NDV_SAMPLE_SIZE = 16 << 20;
+    static const std::size_t NDV_SAMPLE_BLOCKS = 64;
 };
 
 }  // namespace cardinality
@@ -36,20 +36,24 @@ namespace cardinality {
 
 Project::Project(const NodeID n)
     : Operator(n),
-      selected_input_col_ids_()
+      selected_input_col_ids_(), card_factor_(1.0),
+      num_output_tuples_(), output_done_()
 {
 }
 
 Project::Project(google::protobuf::io::CodedInputStream *input)
     : Operator(input),
-      selected_input_col_ids_()
+      selected_input_col_ids_(), card_factor_(1.0),
+      num_output_tuples_(), output_done_()
 {
     Deserialize(input);
 }
 
 Project::Project(const Project &x)
     : Operator(x),
-      selected_input_col_ids_(x.selected_input_col_ids_)
+      selected_input_col_ids_(x.selected_input_col_ids_),
+      card_factor_(x.card_factor_),
+      num_output_tuples_(), output_done_()
 {
 }
 
@@ -114,6 +118,18 @@ ColID Project::getOutputColID(const ColName col) const
            - selected_input_col_ids_.begin();
 }
 
+void Project::resetCardCount()
+{
+    num_output_tuples_ = 0;
+    output_done_ = false;
+}
+
+bool Project::finishOutput(const bool done)
+{
+    output_done_ = done;
+    return done;
+}
+
 void Project::initProject(const Query *q)
 {
     std::set<std::string> selected_cols;
@@ -57,8 +57,19 @@ protected:
     // helper for the constructor
     void initProject(const Query *);
 
+    // helpers for cardinality feedback
+    // Called by Open() and ReOpen(), and with the return value of
+    // GetNext() or GetNextBatch(), which is passed through.
+    void resetCardCount();
+    bool finishOutput(const bool);
+
     // operator description
     std::vector<ColID> selected_input_col_ids_;
+    double card_factor_;                // correction of estCardinality()
+
+    // execution states
+    uint64_t num_output_tuples_;
+    bool output_done_;
 
 private:
     Project& operator=(const Project &);
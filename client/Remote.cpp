@@ -28,10 +28,10 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "client/Remote.h"
-#include <cstring>
 #include <boost/asio/write.hpp>
-#include <boost/asio/read_until.hpp>
+#include <boost/asio/read.hpp>
 #include "client/IOManager.h"
+#include "client/BloomFilter.h"
 
 
 namespace cardinality {
@@ -43,7 +43,9 @@ Remote::Remote(const NodeID n, Operator::Ptr c,
       ip_address_(i),
       socket_reuse_(),
       socket_(),
-      buffer_()
+      buffer_(),
+      frame_(), frame_pos_(), frame_end_(), child_counts_(),
+      bloom_filter_(), bloom_col_id_()
 {
 }
 
@@ -53,7 +55,9 @@ Remote::Remote(google::protobuf::io::CodedInputStream *input)
       ip_address_(),
       socket_reuse_(),
       socket_(),
-      buffer_()
+      buffer_(),
+      frame_(), frame_pos_(), frame_end_(), child_counts_(),
+      bloom_filter_(), bloom_col_id_()
 {
     Deserialize(input);
 }
@@ -64,7 +68,9 @@ Remote::Remote(const Remote &x)
       ip_address_(x.ip_address_),
       socket_reuse_(),
       socket_(),
-      buffer_()
+      buffer_(),
+      frame_(), frame_pos_(), frame_end_(), child_counts_(),
+      bloom_filter_(), bloom_col_id_()
 {
 }
 
@@ -91,17 +97,21 @@ void Remote::ReOpen(const Chunk *join_value)
     using google::protobuf::io::CodedOutputStream;
 
     socket_reuse_ = false;
+    frame_pos_ = frame_end_ = NULL;
+    child_counts_.clear();
 
     uint32_t plan_size = child_->ByteSize();
     int total_size = 5 + plan_size;
     if (join_value) {
         total_size += 4 + join_value->second;
+    } else if (bloom_filter_) {
+        total_size += 8 + bloom_filter_->ByteSize();
     }
 
     uint8_t *target = boost::asio::buffer_cast<uint8_t *>(
                           buffer_->prepare(total_size));
 
-    *target++ = (!join_value) ? 'Q' : 'P';
+    *target++ = join_value ? 'P' : (bloom_filter_ ? 'F' : 'Q');
 
     target = CodedOutputStream::WriteLittleEndian32ToArray(plan_size, target);
     target = child_->SerializeToArray(target);
@@ -111,6 +121,59 @@ void Remote::ReOpen(const Chunk *join_value)
                      join_value->second, target);
         target = CodedOutputStream::WriteRawToArray(
                      join_value->first, join_value->second, target);
+    } else if (bloom_filter_) {
+        target = CodedOutputStream::WriteLittleEndian32ToArray(
+                     bloom_col_id_, target);
+        target = CodedOutputStream::WriteLittleEndian32ToArray(
+                     bloom_filter_->ByteSize(), target);
+        target = bloom_filter_->SerializeToArray(target);
+    }
+
+    buffer_->commit(total_size);
+
+    boost::asio::write(*socket_, *buffer_);
+    buffer_->consume(total_size);
+}
+
+void Remote::OpenLookup(const std::vector<Chunk> &join_values)
+{
+    socket_ = IOManager::instance()->connectSocket(
+                  child_->node_id(), ip_address_);
+    buffer_.reset(new boost::asio::streambuf());
+
+    ReOpenLookup(join_values);
+}
+
+// Send the plan followed by all join values in a single request.
+void Remote::ReOpenLookup(const std::vector<Chunk> &join_values)
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    socket_reuse_ = false;
+    frame_pos_ = frame_end_ = NULL;
+    child_counts_.clear();
+
+    uint32_t plan_size = child_->ByteSize();
+    int total_size = 5 + plan_size + 4;
+    for (std::size_t i = 0; i < join_values.size(); ++i) {
+        total_size += 4 + join_values[i].second;
+    }
+
+    uint8_t *target = boost::asio::buffer_cast<uint8_t *>(
+                          buffer_->prepare(total_size));
+
+    *target++ = 'B';
+
+    target = CodedOutputStream::WriteLittleEndian32ToArray(plan_size, target);
+    target = child_->SerializeToArray(target);
+
+    target = CodedOutputStream::WriteLittleEndian32ToArray(
+                 join_values.size(), target);
+    for (std::size_t i = 0; i < join_values.size(); ++i) {
+        target = CodedOutputStream::WriteLittleEndian32ToArray(
+                     join_values[i].second, target);
+        target = CodedOutputStream::WriteRawToArray(
+                     join_values[i].first, join_values[i].second, target);
     }
 
     buffer_->commit(total_size);
@@ -121,45 +184,170 @@ void Remote::ReOpen(const Chunk *join_value)
 
 bool Remote::GetNext(Tuple &tuple)
 {
+    return readTuple(tuple, NULL);
+}
+
+// Rows of a batch request are prefixed by the position of their join
+// value.
+bool Remote::GetNextLookup(Tuple &tuple, uint32_t &pos)
+{
+    return readTuple(tuple, &pos);
+}
+
+// Decode the next row of the current frame in place. A new frame is
+// received only when the current one has been consumed, so the chunks
+// stay valid until the next call.
+bool Remote::readTuple(Tuple &tuple, uint32_t *lookup_pos)
+{
+    using google::protobuf::io::CodedInputStream;
+
+    if (frame_pos_ == frame_end_ && !readFrame()) {
+        return true;
+    }
+
+    tuple.clear();
+
+    const uint8_t *pos = frame_pos_;
+    if (lookup_pos) {
+        pos = CodedInputStream::ReadLittleEndian32FromArray(pos, lookup_pos);
+    }
+
+    for (ColID i = 0; i < child_->numOutputCols(); ++i) {
+        uint32_t len;
+        pos = readLength(pos, &len);
+        tuple.push_back(std::make_pair(reinterpret_cast<const char *>(pos),
+                                       len));
+        pos += len;
+    }
+    frame_pos_ = pos;
+
+    return false;
+}
+
+// A batch holds the rest of the current frame, up to OPERATOR_BATCHSIZE
+// rows, so that the values stay valid until the next call.
+bool Remote::GetNextBatch(TupleBatch &batch)
+{
+    batch.reset(child_->numOutputCols());
+
+    if (frame_pos_ == frame_end_ && !readFrame()) {
+        return true;
+    }
+
+    const uint8_t *pos = frame_pos_;
+    while (pos < frame_end_ && batch.num_rows < OPERATOR_BATCHSIZE) {
+        for (ColID i = 0; i < child_->numOutputCols(); ++i) {
+            uint32_t len;
+            pos = readLength(pos, &len);
+            batch.cols[i].push_back(
+                std::make_pair(reinterpret_cast<const char *>(pos), len));
+            pos += len;
+        }
+        ++batch.num_rows;
+    }
+    frame_pos_ = pos;
+    batch.selectAll();
+
+    return false;
+}
+
+// Receive the next frame.
+// Returns false if there is no more frame.
+bool Remote::readFrame()
+{
+    using google::protobuf::io::CodedInputStream;
+
+    if (socket_reuse_) {
+        return false;
+    }
+
     boost::system::error_code error;
-    std::size_t size = boost::asio::read_until(*socket_, *buffer_, '\n', error);
+    uint8_t header[4];
+    boost::asio::read(*socket_, boost::asio::buffer(header), error);
     if (error) {
         if (error == boost::asio::error::eof) {
-            return true;
+            return false;
         }
         throw boost::system::system_error(error);
     }
 
-    tuple.clear();
-
+    uint32_t size;
+    CodedInputStream::ReadLittleEndian32FromArray(&header[0], &size);
     if (size == 0) {
+        socket_reuse_ = true;
+        readCardCounts();
         return false;
     }
 
-    boost::asio::streambuf::const_buffers_type line_buffer = buffer_->data();
-    buffer_->consume(size);
-    const char *pos = boost::asio::buffer_cast<const char *>(line_buffer);
+    frame_.resize(size);
+    boost::asio::read(*socket_, boost::asio::buffer(frame_));
+    frame_pos_ = &frame_[0];
+    frame_end_ = frame_pos_ + size;
 
-    if (*pos == '|') {
-        socket_reuse_ = true;
-        return true;
+    return true;
+}
+
+// Receive the actual cardinalities of the remote plan, which follow the
+// empty frame at the end of its results. They are decoded from a buffer
+// of their own, leaving the last frame intact.
+void Remote::readCardCounts()
+{
+    using google::protobuf::io::CodedInputStream;
+
+    uint8_t header[4];
+    boost::asio::read(*socket_, boost::asio::buffer(header));
+
+    uint32_t size;
+    CodedInputStream::ReadLittleEndian32FromArray(&header[0], &size);
+    std::vector<uint8_t> message(size);
+    boost::asio::read(*socket_, boost::asio::buffer(message));
+
+    CodedInputStream input(message.data(), size);
+    uint32_t num_counts;
+    input.ReadVarint32(&num_counts);
+    child_counts_.resize(num_counts);
+    for (uint32_t i = 0; i < num_counts; ++i) {
+        google::protobuf::uint64 num_tuples;
+        uint32_t flags;
+        input.ReadVarint64(&num_tuples);
+        input.ReadVarint32(&flags);
+        child_counts_[i].num_tuples = num_tuples;
+        child_counts_[i].complete = flags & 1;
+        child_counts_[i].sliced = flags & 2;
     }
+}
 
-    for (ColID i = 0; i < child_->numOutputCols(); ++i) {
-        const char *delim
-            = static_cast<const char *>(
-                  rawmemchr(pos,
-                            (i == child_->numOutputCols() - 1) ? '\n' : '|'));
-        tuple.push_back(std::make_pair(pos, delim - pos));
-        pos = delim + 1;
+// Decode a varint-encoded value length.
+const uint8_t *Remote::readLength(const uint8_t *pos, uint32_t *len)
+{
+    *len = *pos++;
+    if (*len & 0x80) {
+        *len &= 0x7f;
+        for (int shift = 7; ; shift += 7) {
+            *len |= static_cast<uint32_t>(*pos & 0x7f) << shift;
+            if (!(*pos++ & 0x80)) {
+                break;
+            }
+        }
     }
+    return pos;
+}
 
-    return false;
+// Returns -1 if GetNext() can proceed without blocking.
+int Remote::pollDescriptor() const
+{
+    if (frame_pos_ != frame_end_ || socket_reuse_) {
+        return -1;
+    }
+
+    return socket_->native_handle();
 }
 
 void Remote::Close()
 {
     buffer_.reset();
+    std::vector<uint8_t>().swap(frame_);
+    frame_pos_ = frame_end_ = NULL;
 
     if (socket_reuse_) {
         IOManager::instance()->closeSocket(child_->node_id(), socket_);
@@ -169,6 +357,19 @@ void Remote::Close()
     socket_.reset();
 }
 
+void Remote::setBloomFilter(const ColID cid,
+                            boost::shared_ptr<const BloomFilter> filter)
+{
+    bloom_filter_ = filter;
+    bloom_col_id_ = cid;
+}
+
+// The slice is sent as a part of the child plan.
+void Remote::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    child_->setSlice(slice, num_slices);
+}
+
 uint8_t *Remote::SerializeToArray(uint8_t *target) const
 {
     using google::protobuf::io::CodedOutputStream;
@@ -244,13 +445,27 @@ ColID Remote::getOutputColID(const ColName col) const
     return child_->getOutputColID(col);
 }
 
+bool Remote::isSortedOn(const ColID cid) const
+{
+    return child_->isSortedOn(cid);
+}
+
+bool Remote::isRemoteLookup() const
+{
+    return true;
+}
+
+void Remote::rebind(const Query *from, const Query *to)
+{
+    child_->rebind(from, to);
+}
+
 double Remote::estCost(const double lcard) const
 {
     // TODO: looking up a remote index should be penalized.
     return child_->estCost(lcard)
-           + COST_NET_XFER_BYTE
-             * child_->estTupleSize()
-             * child_->estCardinality(lcard > 0.0);
+           + estXferCost(child_->estTupleSize()
+                         * child_->estCardinality(lcard > 0.0));
 }
 
 double Remote::estCardinality(const bool) const
@@ -268,4 +483,36 @@ double Remote::estColSize(const ColID cid) const
     return child_->estColSize(cid);
 }
 
+double Remote::estXferCost(const double num_bytes)
+{
+    return COST_NET_XFER_BYTE * num_bytes;
+}
+
+std::string Remote::getTableSet() const
+{
+    return child_->getTableSet();
+}
+
+void Remote::getCardEstimates(std::vector<CardEstimate> &estimates) const
+{
+    child_->getCardEstimates(estimates);
+}
+
+// Until all results are received, the counts of the local copy of the
+// remote plan, which is never opened, are reported.
+void Remote::getCardCounts(std::vector<CardCount> &counts) const
+{
+    if (socket_reuse_) {
+        counts.insert(counts.end(), child_counts_.begin(),
+                      child_counts_.end());
+    } else {
+        child_->getCardCounts(counts);
+    }
+}
+
+void Remote::setCardCorrections(const CardCorrections &corrections)
+{
+    child_->setCardCorrections(corrections);
+}
+
 }  // namespace cardinality
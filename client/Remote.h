@@ -30,6 +30,8 @@
 #ifndef CARDINALITY_REMOTE_H_
 #define CARDINALITY_REMOTE_H_
 
+#include <string>
+#include <vector>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/streambuf.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
@@ -54,7 +56,14 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
+    void OpenLookup(const std::vector<Chunk> &);
+    void ReOpenLookup(const std::vector<Chunk> &);
+    bool GetNextLookup(Tuple &, uint32_t &);
+    int pollDescriptor() const;
 
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
@@ -69,14 +78,32 @@ public:
     ValueType getColType(const ColName) const;
     ColID numOutputCols() const;
     ColID getOutputColID(const ColName) const;
+    bool isSortedOn(const ColID) const;
+    bool isRemoteLookup() const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estCost(const double = 0.0) const;
     double estCardinality(const bool = false) const;
     double estTupleSize() const;
     double estColSize(const ColID) const;
+    static double estXferCost(const double);
+
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
 
 protected:
+    // helpers for GetNext(), GetNextBatch() and GetNextLookup()
+    bool readTuple(Tuple &, uint32_t *);
+    bool readFrame();
+    void readCardCounts();
+    static const uint8_t *readLength(const uint8_t *, uint32_t *);
+
     // operator description
     Operator::Ptr child_;
     boost::asio::ip::address_v4 ip_address_;
@@ -85,6 +112,12 @@ protected:
     bool socket_reuse_;
     tcpsocket_ptr socket_;
     boost::scoped_ptr<boost::asio::streambuf> buffer_;
+    std::vector<uint8_t> frame_;
+    const uint8_t *frame_pos_;
+    const uint8_t *frame_end_;
+    std::vector<CardCount> child_counts_;  // reported by the remote node
+    boost::shared_ptr<const BloomFilter> bloom_filter_;
+    ColID bloom_col_id_;
 
     // constants
     static const double COST_NET_XFER_BYTE = 0.0025;
@@ -30,8 +30,10 @@
 #include "client/Scan.h"
 #include <cstring>
 #include <stdexcept>  // std::runtime_error
-#include <algorithm>  // std::min
+#include <algorithm>  // std::min, std::max, std::sort
 #include <google/protobuf/wire_format_lite_inl.h>
+#include "client/IOManager.h"
+#include "client/Tokenizer.h"
 
 
 namespace cardinality {
@@ -42,12 +44,17 @@ Scan::Scan(const NodeID n, const char *f, const char *a,
       filename_(f),
       gteq_conds_(), join_conds_(),
       num_input_cols_(t->nbFields),
+      slice_(0), num_slices_(1),
       alias_(a), table_(t), stats_(p),
       file_(),
 #ifdef DISABLE_MEMORY_MAPPED_IO
       buffer_(),
+#else
+      store_(),
 #endif
-      input_tuple_()
+      input_tuple_(), input_batch_(),
+      num_parsed_cols_(), restriction_order_(), delims_(),
+      bloom_filter_(), bloom_col_id_()
 {
     initProject(q);
     initFilter(q);
@@ -58,12 +65,17 @@ Scan::Scan(google::protobuf::io::CodedInputStream *input)
       filename_(),
       gteq_conds_(), join_conds_(),
       num_input_cols_(),
+      slice_(), num_slices_(),
       alias_(), table_(), stats_(),
       file_(),
 #ifdef DISABLE_MEMORY_MAPPED_IO
       buffer_(),
+#else
+      store_(),
 #endif
-      input_tuple_()
+      input_tuple_(), input_batch_(),
+      num_parsed_cols_(), restriction_order_(), delims_(),
+      bloom_filter_(), bloom_col_id_()
 {
     Deserialize(input);
 }
@@ -73,13 +85,24 @@ Scan::Scan(const Scan &x)
       filename_(x.filename_),
       gteq_conds_(x.gteq_conds_), join_conds_(x.join_conds_),
       num_input_cols_(x.num_input_cols_),
+      slice_(x.slice_), num_slices_(x.num_slices_),
       alias_(x.alias_), table_(x.table_), stats_(x.stats_),
       file_(),
 #ifdef DISABLE_MEMORY_MAPPED_IO
       buffer_(),
+#else
+      store_(),
 #endif
-      input_tuple_()
+      input_tuple_(), input_batch_(),
+      num_parsed_cols_(), restriction_order_(), delims_(),
+      bloom_filter_(), bloom_col_id_()
 {
+    // copy objects allocated by Deserialize()
+    if (alias_.empty()) {
+        for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+            gteq_conds_[i].get<0>() = new Value(*gteq_conds_[i].get<0>());
+        }
+    }
 }
 
 Scan::~Scan()
@@ -92,6 +115,19 @@ Scan::~Scan()
     }
 }
 
+void Scan::setBloomFilter(const ColID cid,
+                          boost::shared_ptr<const BloomFilter> filter)
+{
+    bloom_filter_ = filter;
+    bloom_col_id_ = selected_input_col_ids_[cid];
+}
+
+void Scan::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    slice_ = slice;
+    num_slices_ = num_slices;
+}
+
 uint8_t *Scan::SerializeToArray(uint8_t *target) const
 {
     using google::protobuf::io::CodedOutputStream;
@@ -134,6 +170,9 @@ uint8_t *Scan::SerializeToArray(uint8_t *target) const
 
     target = CodedOutputStream::WriteVarint32ToArray(num_input_cols_, target);
 
+    target = CodedOutputStream::WriteVarint32ToArray(slice_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(num_slices_, target);
+
     return target;
 }
 
@@ -170,6 +209,9 @@ int Scan::ByteSize() const
 
     total_size += CodedOutputStream::VarintSize32(num_input_cols_);
 
+    total_size += CodedOutputStream::VarintSize32(slice_);
+    total_size += CodedOutputStream::VarintSize32(num_slices_);
+
     return total_size;
 }
 
@@ -217,6 +259,9 @@ void Scan::Deserialize(google::protobuf::io::CodedInputStream *input)
     }
 
     input->ReadVarint32(&num_input_cols_);
+
+    input->ReadVarint32(&slice_);
+    input->ReadVarint32(&num_slices_);
 }
 
 void Scan::initFilter(const Query *q)
@@ -252,88 +297,298 @@ void Scan::initFilter(const Query *q)
     }
 }
 
-const char * Scan::parseLine(const char *pos)
+// Only the columns up to the last referenced one are parsed, and only if
+// the restrictions are satisfied.
+const char * Scan::parseLine(const char *pos, bool &match)
 {
-    input_tuple_.clear();
+    const char *next = splitLine(pos, match);
 
-    for (std::size_t i = 0; i < num_input_cols_ - 1; ++i) {
-        const char *delim = static_cast<const char *>(rawmemchr(pos, '|'));
-        input_tuple_.push_back(std::make_pair(pos, delim - pos));
-        pos = delim + 1;
+    if (match) {
+        input_tuple_.clear();
+        for (std::size_t i = 0; i < num_parsed_cols_; ++i) {
+            input_tuple_.push_back(std::make_pair(pos, delims_[i] - pos));
+            pos = delims_[i] + 1;
+        }
     }
 
+    return next;
+}
+
+// Decide which columns are parsed and in which order the restrictions
+// are evaluated.
+void Scan::initParse()
+{
+    ColID last_col = 0;
+    for (std::size_t i = 0; i < selected_input_col_ids_.size(); ++i) {
+        last_col = std::max(last_col, selected_input_col_ids_[i]);
+    }
+    for (std::size_t i = 0; i < join_conds_.size(); ++i) {
+        last_col = std::max(last_col, join_conds_[i].get<0>());
+        last_col = std::max(last_col, join_conds_[i].get<1>());
+    }
+
+    // evaluate restrictions from left to right
+    restriction_order_.clear();
+    for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+        restriction_order_.push_back(
+            std::make_pair(gteq_conds_[i].get<1>(), i));
+        last_col = std::max(last_col, gteq_conds_[i].get<1>());
+    }
+    std::sort(restriction_order_.begin(), restriction_order_.end());
+
+    num_parsed_cols_ = last_col + 1;
+    delims_.resize(num_parsed_cols_);
+}
+
+// Find the delimiters of a line in delims_ while evaluating restrictions
+// as soon as their columns are found. Stops at a rejecting restriction
+// or after num_parsed_cols_ columns. Returns the start of the next line.
+const char * Scan::splitLine(const char *pos, bool &match)
+{
 #ifdef DISABLE_MEMORY_MAPPED_IO
-    const char *delim = static_cast<const char *>(rawmemchr(pos, '\0'));
+    const char eol = '\0';
 #else
-    const char *delim = static_cast<const char *>(rawmemchr(pos, '\n'));
+    const char eol = '\n';
 #endif
-    input_tuple_.push_back(std::make_pair(pos, delim - pos));
-    return delim + 1;
+    const char *line = pos;
+    uint32_t num_split = 0;
+    match = true;
+
+    for (std::size_t k = 0; k < restriction_order_.size(); ++k) {
+        ColID cid = restriction_order_[k].first;
+        if (cid >= num_split) {
+            pos = splitFields(pos, num_split, cid + 1, eol);
+            num_split = cid + 1;
+        }
+
+        const char *value = (cid == 0) ? line : delims_[cid - 1] + 1;
+        if (!matchRestriction(restriction_order_[k].second,
+                              std::make_pair(value, delims_[cid] - value))) {
+            match = false;
+            break;
+        }
+    }
+
+    if (match && num_split < num_parsed_cols_) {
+        pos = splitFields(pos, num_split, num_parsed_cols_, eol);
+        num_split = num_parsed_cols_;
+    }
+
+    // skip the rest of the line
+    if (*delims_[num_split - 1] != eol) {
+        pos = 1 + static_cast<const char *>(rawmemchr(pos, eol));
+    }
+    return pos;
+}
+
+// Find the delimiters of the given range of columns.
+const char * Scan::splitFields(const char *pos, const uint32_t begin,
+                               const uint32_t end, const char eol)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    const char *next = cardinality::splitLine(pos, buffer_.get() + 4096,
+                                              end - begin, eol,
+                                              &delims_[begin]);
+#else
+    const char *next = cardinality::splitLine(pos, file_.second,
+                                              end - begin, eol,
+                                              &delims_[begin]);
+#endif
+    if (next == NULL) {
+        throw std::runtime_error("incomplete line");
+    }
+    return next;
 }
 
+// Restrictions have been evaluated by parseLine().
 bool Scan::execFilter(const Tuple &tuple) const
 {
+    for (std::size_t i = 0; i < join_conds_.size(); ++i) {
+        if (!matchJoin(i, tuple[join_conds_[i].get<0>()],
+                       tuple[join_conds_[i].get<1>()])) {
+            return false;
+        }
+    }
+
+    if (bloom_filter_ && !bloom_filter_->mayContain(tuple[bloom_col_id_])) {
+        return false;
+    }
+
+    return true;
+}
+
+void Scan::execProject(const Tuple &input_tuple, Tuple &output_tuple)
+{
+    ++num_output_tuples_;
+    output_tuple.clear();
+
+    for (std::size_t i = 0; i < selected_input_col_ids_.size(); ++i) {
+        output_tuple.push_back(input_tuple[selected_input_col_ids_[i]]);
+    }
+}
+
+// Returns true if the given value satisfies the i-th restriction.
+bool Scan::matchRestriction(const std::size_t i, const Chunk &value) const
+{
+    const Value *constant = gteq_conds_[i].get<0>();
+
+    if (constant->type == INT) {
+        int cmp = constant->intVal - parseInt(&value);
+        return (gteq_conds_[i].get<2>() == EQ) ? cmp == 0 : cmp < 0;
+    }
+
+    // STRING
+    if (gteq_conds_[i].get<2>() == EQ) {
+        return constant->intVal == value.second
+               && !std::memcmp(constant->charVal, value.first, value.second);
+    } else {  // GT
+        int cmp = std::memcmp(constant->charVal, value.first,
+                              std::min(constant->intVal, value.second));
+        return cmp < 0 || (cmp == 0 && constant->intVal < value.second);
+    }
+}
+
+// Returns true if the given values satisfy the i-th join condition.
+bool Scan::matchJoin(const std::size_t i,
+                     const Chunk &value1, const Chunk &value2) const
+{
+    if (!join_conds_[i].get<2>()) {  // INT
+        return parseInt(&value1) == parseInt(&value2);
+    } else {  // STRING
+        return value1.second == value2.second
+               && !std::memcmp(value1.first, value2.first, value2.second);
+    }
+}
+
+#ifndef DISABLE_MEMORY_MAPPED_IO
+// Parse a line into a new row of the batch unless it fails restrictions.
+// The values point into the memory-mapped file.
+const char * Scan::parseLine(const char *pos, TupleBatch &batch)
+{
+    bool match;
+    const char *next = splitLine(pos, match);
+
+    if (match) {
+        for (std::size_t i = 0; i < num_parsed_cols_; ++i) {
+            batch.cols[i].push_back(std::make_pair(pos, delims_[i] - pos));
+            pos = delims_[i] + 1;
+        }
+        ++batch.num_rows;
+    }
+
+    return next;
+}
+
+void Scan::OpenRows()
+{
+    resetCardCount();
+    file_ = IOManager::instance()->openFile(filename_);
+    openColumnStore();
+    input_tuple_.reserve(num_input_cols_);
+    initParse();
+}
+
+// Rows rejected by the column store are not parsed.
+bool Scan::GetRow(const uint64_t offset, Tuple &tuple)
+{
+    if (store_ && !execStoreFilter(store_->findRow(offset))) {
+        return false;
+    }
+
+    bool match;
+    parseLine(file_.first + offset, match);
+    if (match && execFilter(input_tuple_)) {
+        execProject(input_tuple_, tuple);
+        return true;
+    }
+    return false;
+}
+
+// Use the column store only if it has a column to be filtered.
+void Scan::openColumnStore()
+{
+    store_ = IOManager::instance()->openColumnStore(filename_);
+    if (!store_) {
+        return;
+    }
+
     for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
-        if (gteq_conds_[i].get<0>()->type == INT) {
-            int cmp = gteq_conds_[i].get<0>()->intVal
-                      - parseInt(&tuple[gteq_conds_[i].get<1>()]);
-            if ((gteq_conds_[i].get<2>() == EQ && cmp != 0)
-                || (gteq_conds_[i].get<2>() == GT && cmp >= 0)) {
+        if (store_->hasCol(gteq_conds_[i].get<1>())) {
+            return;
+        }
+    }
+    store_.reset();
+}
+
+// Returns false if the given row of the column store fails one of the
+// restrictions on its columns. Rows passing the test are parsed and
+// filtered as usual.
+bool Scan::execStoreFilter(const uint32_t row) const
+{
+    for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+        ColID cid = gteq_conds_[i].get<1>();
+        if (!store_->hasCol(cid)) {
+            continue;
+        }
+
+        const Value *constant = gteq_conds_[i].get<0>();
+        if (constant->type == INT) {
+            int cmp = constant->intVal - store_->getInt(cid, row);
+            if ((gteq_conds_[i].get<2>() == EQ) ? cmp != 0 : cmp >= 0) {
                 return false;
             }
-        } else {  // STRING
-            if (gteq_conds_[i].get<2>() == EQ) {
-                if ((gteq_conds_[i].get<0>()->intVal
-                     != tuple[gteq_conds_[i].get<1>()].second)
-                    || (std::memcmp(gteq_conds_[i].get<0>()->charVal,
-                                    tuple[gteq_conds_[i].get<1>()].first,
-                                    tuple[gteq_conds_[i].get<1>()].second))) {
-                    return false;
-                }
-            } else {  // GT
-                int cmp = std::memcmp(
-                              gteq_conds_[i].get<0>()->charVal,
-                              tuple[gteq_conds_[i].get<1>()].first,
-                              std::min(gteq_conds_[i].get<0>()->intVal,
-                                       tuple[gteq_conds_[i].get<1>()].second));
-                if (cmp > 0
-                    || (cmp == 0
-                        && gteq_conds_[i].get<0>()->intVal
-                           >= tuple[gteq_conds_[i].get<1>()].second)) {
-                    return false;
-                }
-            }
+        } else if (!matchRestriction(i, store_->getString(cid, row))) {
+            return false;
         }
     }
 
+    return true;
+}
+#endif
+
+// Evaluate one condition at a time over the selected rows.
+// Restrictions have been evaluated by parseLine().
+void Scan::execFilter(TupleBatch &batch) const
+{
+    std::vector<uint32_t> &sel = batch.sel;
+    std::size_t n;
+
     for (std::size_t i = 0; i < join_conds_.size(); ++i) {
-        if (!join_conds_[i].get<2>()) {  // INT
-            if (parseInt(&tuple[join_conds_[i].get<0>()])
-                != parseInt(&tuple[join_conds_[i].get<1>()])) {
-                return false;
-            }
-        } else {  // STRING
-            if ((tuple[join_conds_[i].get<0>()].second
-                 != tuple[join_conds_[i].get<1>()].second)
-                || (std::memcmp(tuple[join_conds_[i].get<0>()].first,
-                                tuple[join_conds_[i].get<1>()].first,
-                                tuple[join_conds_[i].get<1>()].second))) {
-                return false;
+        const std::vector<Chunk> &col1 = batch.cols[join_conds_[i].get<0>()];
+        const std::vector<Chunk> &col2 = batch.cols[join_conds_[i].get<1>()];
+        n = 0;
+        for (std::size_t k = 0; k < sel.size(); ++k) {
+            if (matchJoin(i, col1[sel[k]], col2[sel[k]])) {
+                sel[n++] = sel[k];
             }
         }
+        sel.resize(n);
     }
 
-    return true;
+    if (bloom_filter_) {
+        const std::vector<Chunk> &col = batch.cols[bloom_col_id_];
+        n = 0;
+        for (std::size_t k = 0; k < sel.size(); ++k) {
+            if (bloom_filter_->mayContain(col[sel[k]])) {
+                sel[n++] = sel[k];
+            }
+        }
+        sel.resize(n);
+    }
 }
 
-void Scan::execProject(const Tuple &input_tuple,
-                       Tuple &output_tuple) const
+// Columns are copied as a whole along with the selection vector.
+void Scan::execProject(const TupleBatch &input_batch,
+                       TupleBatch &output_batch)
 {
-    output_tuple.clear();
+    num_output_tuples_ += input_batch.sel.size();
+    output_batch.reset(numOutputCols());
 
     for (std::size_t i = 0; i < selected_input_col_ids_.size(); ++i) {
-        output_tuple.push_back(input_tuple[selected_input_col_ids_[i]]);
+        output_batch.cols[i] = input_batch.cols[selected_input_col_ids_[i]];
     }
+    output_batch.sel = input_batch.sel;
+    output_batch.num_rows = input_batch.num_rows;
 }
 
 bool Scan::hasCol(const ColName col) const
@@ -357,6 +612,14 @@ ColID Scan::getInputColID(const ColName col) const
     throw std::runtime_error("column name not found");
 }
 
+void Scan::rebind(const Query *from, const Query *to)
+{
+    for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+        gteq_conds_[i].get<0>() = rebindValue(gteq_conds_[i].get<0>(),
+                                              from, to);
+    }
+}
+
 std::pair<const PartStats *, ColID> Scan::getPartStats(const ColID cid) const
 {
     return std::make_pair(stats_, selected_input_col_ids_[cid]);
@@ -367,6 +630,12 @@ ValueType Scan::getColType(const ColName col) const
     return table_->fieldsType[getInputColID(col)];
 }
 
+// Both SeqScan and IndexScan return tuples in the order of the file.
+bool Scan::isSortedOn(const ColID cid) const
+{
+    return selected_input_col_ids_[cid] == 0;
+}
+
 double Scan::estTupleSize() const
 {
     double length = 0;
@@ -382,4 +651,50 @@ double Scan::estColSize(const ColID cid) const
     return stats_->col_lengths_[selected_input_col_ids_[cid]];
 }
 
+double Scan::estSelectivity(const ColID col, const Value *value,
+                            const CompOp op) const
+{
+    if (stats_->hasHistogram(col)) {
+        if (op == EQ) {
+            return stats_->estSelectivityEq(col, value);
+        } else {  // GT
+            return stats_->estSelectivityGt(col, value);
+        }
+    }
+
+    if (op == EQ) {
+        return 1.0 / stats_->num_distinct_values_[col];
+    } else {  // GT
+        return SELECTIVITY_GT;
+    }
+}
+
+std::string Scan::getTableSet() const
+{
+    return alias_;
+}
+
+// No estimate is available for a scan planned without stats.
+void Scan::getCardEstimates(std::vector<CardEstimate> &estimates) const
+{
+    if (stats_) {
+        estimates.push_back(
+            CardEstimate(alias_, estCardinality() / card_factor_));
+    } else {
+        estimates.push_back(CardEstimate(std::string(), 0.0));
+    }
+}
+
+void Scan::getCardCounts(std::vector<CardCount> &counts) const
+{
+    CardCount count = { num_output_tuples_, output_done_, num_slices_ > 1 };
+    counts.push_back(count);
+}
+
+void Scan::setCardCorrections(const CardCorrections &corrections)
+{
+    CardCorrections::const_iterator it = corrections.find(alias_);
+    card_factor_ = (it != corrections.end()) ? it->second : 1.0;
+}
+
 }  // namespace cardinality
@@ -32,15 +32,18 @@
 
 #include <string>
 #include <vector>
+#include <utility>  // std::pair
 #include <boost/tuple/tuple.hpp>
 #ifdef DISABLE_MEMORY_MAPPED_IO
 #include <fstream>
 #include <boost/smart_ptr/scoped_array.hpp>
-#else
-#include <utility>  // std::pair
 #endif
 #include "client/Project.h"
 #include "client/PartStats.h"
+#include "client/BloomFilter.h"
+#ifndef DISABLE_MEMORY_MAPPED_IO
+#include "client/ColumnStore.h"
+#endif
 
 
 namespace cardinality {
@@ -59,6 +62,19 @@ public:
     Scan(const Scan &);
     ~Scan();
 
+    // query execution
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
+#ifndef DISABLE_MEMORY_MAPPED_IO
+
+    // Open the file for fetching rows by their file offsets through a
+    // join index.
+    // GetRow() returns true if the row at the given offset satisfies the
+    // restrictions, and projects it into the given tuple.
+    void OpenRows();
+    bool GetRow(const uint64_t, Tuple &);
+#endif
+
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
     int ByteSize() const;
@@ -69,25 +85,59 @@ public:
     ColID getInputColID(const ColName) const;
     std::pair<const PartStats *, ColID> getPartStats(const ColID) const;
     ValueType getColType(const ColName) const;
+    bool isSortedOn(const ColID) const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estTupleSize() const;
     double estColSize(const ColID) const;
 
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
+
 protected:
     // helper for the constructor
     void initFilter(const Query *q);
 
+    // helper for estCardinality() and estCost()
+    // Estimate the fraction of rows satisfying a restriction on an input
+    // column, using the histogram of the column if any.
+    double estSelectivity(const ColID, const Value *, const CompOp) const;
+
     // helpers for GetNext()
     bool execFilter(const Tuple &) const;
-    void execProject(const Tuple &, Tuple &) const;
-    const char *parseLine(const char *);
+    void execProject(const Tuple &, Tuple &);
+    const char *parseLine(const char *, bool &);
+    void initParse();
+    const char *splitLine(const char *, bool &);
+    const char *splitFields(const char *, const uint32_t, const uint32_t,
+                            const char);
+    bool matchRestriction(const std::size_t, const Chunk &) const;
+    bool matchJoin(const std::size_t, const Chunk &, const Chunk &) const;
+
+    // helpers for GetNextBatch()
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    const char *parseLine(const char *, TupleBatch &);
+
+    // helpers for the column store
+    void openColumnStore();
+    bool execStoreFilter(const uint32_t) const;
+#endif
+    void execFilter(TupleBatch &) const;
+    void execProject(const TupleBatch &, TupleBatch &);
 
     // operator description
     std::string filename_;
     std::vector<boost::tuple<Value *, ColID, CompOp> > gteq_conds_;
     std::vector<boost::tuple<ColID, ColID, bool> > join_conds_;
     uint32_t num_input_cols_;
+    uint32_t slice_;
+    uint32_t num_slices_;
 
     // execution states
     const std::string alias_;
@@ -98,8 +148,15 @@ protected:
     boost::scoped_array<char> buffer_;
 #else
     std::pair<const char *, const char *> file_;
+    ColumnStore::Ptr store_;
 #endif
     Tuple input_tuple_;
+    TupleBatch input_batch_;
+    uint32_t num_parsed_cols_;
+    std::vector<std::pair<ColID, std::size_t> > restriction_order_;
+    std::vector<const char *> delims_;
+    boost::shared_ptr<const BloomFilter> bloom_filter_;
+    ColID bloom_col_id_;
 
     // constants
     static const double COST_DISK_READ_PAGE = 1.0;
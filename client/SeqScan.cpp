@@ -28,7 +28,12 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "client/SeqScan.h"
+#include <cstring>
+#include <algorithm>  // std::min, std::max
+#include <cstddef>  // std::ptrdiff_t
 #include "client/IOManager.h"
+#include "client/ColumnStore.h"
+#include "client/JoinIndex.h"
 
 
 namespace cardinality {
@@ -36,20 +41,23 @@ namespace cardinality {
 SeqScan::SeqScan(const NodeID n, const char *f, const char *a,
                  const Table *t, const PartStats *p, const Query *q)
     : Scan(n, f, a, t, p, q),
-      pos_()
+      pos_(), block_end_(), block_(), row_(), cursor_(),
+      prefetch_end_(), prefetch_mark_(), zones_(), zone_end_()
 {
 }
 
 SeqScan::SeqScan(google::protobuf::io::CodedInputStream *input)
     : Scan(input),
-      pos_()
+      pos_(), block_end_(), block_(), row_(), cursor_(),
+      prefetch_end_(), prefetch_mark_(), zones_(), zone_end_()
 {
     Deserialize(input);
 }
 
 SeqScan::SeqScan(const SeqScan &x)
     : Scan(x),
-      pos_()
+      pos_(), block_end_(), block_(), row_(), cursor_(),
+      prefetch_end_(), prefetch_mark_(), zones_(), zone_end_()
 {
 }
 
@@ -69,43 +77,253 @@ void SeqScan::Open(const Chunk *)
     file_.open(filename_.c_str(), std::ifstream::in | std::ifstream::binary);
 #else
     file_ = IOManager::instance()->openFile(filename_);
-    pos_ = file_.first;
+    openColumnStore();
+    initZones();
 #endif
     input_tuple_.reserve(num_input_cols_);
+    initParse();
+
+    ReOpen();
 }
 
 void SeqScan::ReOpen(const Chunk *)
 {
+    resetCardCount();
 #ifdef DISABLE_MEMORY_MAPPED_IO
     file_.clear();
     file_.seekg(0, std::ios::beg);
+    block_ = 0;
 #else
-    pos_ = file_.first;
+    if (cursor_) {
+        seekBlock(cursor_->claim());
+    } else if (num_slices_ > 1) {
+        seekBlock(slice_);
+    } else {
+        pos_ = file_.first;
+        block_end_ = file_.second;
+        row_ = 0;
+        zone_end_ = zones_.empty() ? file_.second : pos_;
+        prefetch_end_ = pos_;
+        prefetchAhead();
+    }
 #endif
 }
 
+// If the scan is split into slices, the file is split into blocks of
+// SEQSCAN_BLOCKSIZE bytes, and the blocks are assigned to the slices in
+// a round-robin fashion, or claimed through a cursor shared by the
+// slices. A line belongs to the block where it starts.
+// Without memory-mapped I/O, lines are assigned instead of blocks.
+// Zones where the column store rules out every row are skipped as a
+// whole.
 bool SeqScan::GetNext(Tuple &tuple)
 {
-#ifdef DISABLE_MEMORY_MAPPED_IO
+    bool match;
+
     for (;;) {
+#ifdef DISABLE_MEMORY_MAPPED_IO
         file_.getline(buffer_.get(), 4096);
         if (*buffer_.get() == '\0') {
-            return true;
+            return finishOutput(true);
         }
-        parseLine(buffer_.get());
+        if (block_++ % num_slices_ != slice_) {
+            continue;
+        }
+        parseLine(buffer_.get(), match);
 #else
-    while (pos_ < file_.second) {
-        pos_ = parseLine(pos_);
+        if (pos_ >= block_end_) {
+            if (block_end_ == file_.second) {
+                return finishOutput(true);
+            }
+            seekBlock(nextBlock());
+            continue;
+        }
+        if (pos_ >= zone_end_) {
+            skipZones();
+            continue;
+        }
+        if (pos_ >= prefetch_mark_) {
+            prefetchAhead();
+        }
+        if (store_ && !execStoreFilter(row_++)) {
+            pos_ = file_.first + store_->getOffset(row_);
+            continue;
+        }
+        pos_ = parseLine(pos_, match);
 #endif
 
-        if (execFilter(input_tuple_)) {
+        if (match && execFilter(input_tuple_)) {
             execProject(input_tuple_, tuple);
             return false;
         }
     }
+}
+
+// Lines satisfying the restrictions are parsed into a batch of input
+// tuples, which is filtered one condition at a time and projected column
+// by column.
+// In both methods, lines rejected by the column store are skipped
+// without being parsed.
+bool SeqScan::GetNextBatch(TupleBatch &batch)
+{
+#ifdef DISABLE_MEMORY_MAPPED_IO
+    return Operator::GetNextBatch(batch);
+#else
+    bool done = false;
+
+    do {
+        input_batch_.reset(num_parsed_cols_);
+        while (input_batch_.num_rows < OPERATOR_BATCHSIZE) {
+            if (pos_ >= block_end_) {
+                if (block_end_ == file_.second) {
+                    done = true;
+                    break;
+                }
+                seekBlock(nextBlock());
+                continue;
+            }
+            if (pos_ >= zone_end_) {
+                skipZones();
+                continue;
+            }
+            if (pos_ >= prefetch_mark_) {
+                prefetchAhead();
+            }
+            if (store_ && !execStoreFilter(row_++)) {
+                pos_ = file_.first + store_->getOffset(row_);
+                continue;
+            }
+            pos_ = parseLine(pos_, input_batch_);
+        }
+
+        input_batch_.selectAll();
+        execFilter(input_batch_);
+    } while (input_batch_.sel.empty() && !done);
+
+    execProject(input_batch_, batch);
+    return finishOutput(done);
+#endif
+}
+
+#ifndef DISABLE_MEMORY_MAPPED_IO
+void SeqScan::seekBlock(const uint32_t block)
+{
+    std::size_t file_size = file_.second - file_.first;
+    std::size_t offset = static_cast<std::size_t>(block) * SEQSCAN_BLOCKSIZE;
+
+    block_ = block;
+    if (offset >= file_size) {
+        pos_ = block_end_ = file_.second;
+        return;
+    }
+
+    pos_ = file_.first + offset;
+    block_end_ = file_.first + std::min(offset + SEQSCAN_BLOCKSIZE, file_size);
+
+    // skip the line started in the previous block
+    if (offset > 0 && pos_[-1] != '\n') {
+        const char *eol = static_cast<const char *>(
+                              std::memchr(pos_, '\n', file_.second - pos_));
+        pos_ = eol ? eol + 1 : file_.second;
+    }
+
+    if (store_) {
+        row_ = store_->findRow(pos_ - file_.first);
+    }
+    zone_end_ = zones_.empty() ? file_.second : pos_;
+
+    prefetch_end_ = pos_;
+    prefetchAhead();
+}
+
+uint32_t SeqScan::nextBlock()
+{
+    return cursor_ ? cursor_->claim() : block_ + num_slices_;
+}
+
+// Mark the zones where some rows may satisfy the restrictions on the
+// columns of the column store. zones_ is left empty if no zone can be
+// skipped.
+void SeqScan::initZones()
+{
+    zones_.clear();
+    if (!store_) {
+        return;
+    }
+
+    zones_.resize(store_->numZones(), true);
+    bool skip = false;
+    for (uint32_t z = 0; z < zones_.size(); ++z) {
+        for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+            ColID cid = gteq_conds_[i].get<1>();
+            if (store_->hasCol(cid)
+                && !ColumnStore::matchZone(store_->getZone(cid, z),
+                                           gteq_conds_[i].get<0>(),
+                                           gteq_conds_[i].get<2>() == GT)) {
+                zones_[z] = false;
+                skip = true;
+                break;
+            }
+        }
+    }
+
+    if (!skip) {
+        zones_.clear();
+    }
+}
+
+// Move pos_ to the first row of the next zone while the zone of pos_
+// is to be skipped. A line belongs to the zone where it starts.
+void SeqScan::skipZones()
+{
+    std::size_t zone_size = ColumnStore::ZONE_SIZE;
+    std::size_t file_size = file_.second - file_.first;
+
+    for (;;) {
+        std::size_t zone = (pos_ - file_.first) / zone_size;
+        if (pos_ >= file_.second || zones_[zone]) {
+            zone_end_ = file_.first + std::min((zone + 1) * zone_size,
+                                               file_size);
+            return;
+        }
+        row_ = store_->findRow((zone + 1) * zone_size);
+        pos_ = file_.first + store_->getOffset(row_);
+    }
+}
 
-    return true;
+// Keep up to SEQSCAN_PREFETCH_SIZE bytes of the current block ahead of
+// pos_ being read by the kernel, so that disk reads overlap parsing.
+// Zones to be skipped are not read.
+void SeqScan::prefetchAhead()
+{
+    const char *end = (block_end_ - pos_
+                       > static_cast<std::ptrdiff_t>(SEQSCAN_PREFETCH_SIZE))
+                      ? pos_ + SEQSCAN_PREFETCH_SIZE : block_end_;
+    if (prefetch_end_ < pos_) {
+        prefetch_end_ = pos_;
+    }
+    if (end > prefetch_end_) {
+        if (zones_.empty()) {
+            IOManager::prefetch(prefetch_end_, end);
+        } else {
+            std::size_t zone_size = ColumnStore::ZONE_SIZE;
+            std::size_t zone = (prefetch_end_ - file_.first) / zone_size;
+            for (const char *begin = prefetch_end_; begin < end; ++zone) {
+                const char *zone_end = std::min(
+                                           file_.first + (zone + 1) * zone_size,
+                                           end);
+                if (zones_[zone]) {
+                    IOManager::prefetch(begin, zone_end);
+                }
+                begin = zone_end;
+            }
+        }
+        prefetch_end_ = end;
+    }
+    prefetch_mark_ = (end == block_end_)
+                     ? block_end_ : end - SEQSCAN_PREFETCH_SIZE / 2;
 }
+#endif
 
 void SeqScan::Close()
 {
@@ -115,6 +333,11 @@ void SeqScan::Close()
 #endif
 }
 
+void SeqScan::setSliceCursor(boost::shared_ptr<SliceCursor> cursor)
+{
+    cursor_ = cursor;
+}
+
 uint8_t *SeqScan::SerializeToArray(uint8_t *target) const
 {
     using google::protobuf::io::CodedOutputStream;
@@ -148,28 +371,72 @@ void SeqScan::print(std::ostream &os, const int tab, const double) const
     os << std::endl;
 }
 
+std::string SeqScan::getJoinIndexKey(const ColID cid) const
+{
+    return JoinIndex::getKey(filename_, selected_input_col_ids_[cid]);
+}
+
 double SeqScan::estCost(const double) const
 {
+#ifdef DISABLE_MEMORY_MAPPED_IO
     return stats_->num_pages_ * COST_DISK_READ_PAGE;
+#else
+    return stats_->num_pages_ * COST_DISK_READ_PAGE * estZoneFraction();
+#endif
 }
 
 double SeqScan::estCardinality(const bool) const
 {
-    double card = stats_->num_distinct_values_[0];
+    double card = stats_->num_distinct_values_[0] * card_factor_;
 
     for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
-        if (gteq_conds_[i].get<2>() == EQ) {
-            card /= stats_->num_distinct_values_[gteq_conds_[i].get<1>()];
-        } else {  // GT
-            card *= SELECTIVITY_GT;
-        }
+        card *= estSelectivity(gteq_conds_[i].get<1>(),
+                               gteq_conds_[i].get<0>(),
+                               gteq_conds_[i].get<2>());
     }
 
     if (!join_conds_.empty()) {
         card *= SELECTIVITY_EQ;
     }
 
-    return card;
+    return std::min(card, stats_->num_distinct_values_[0] * card_factor_
+                          * estZoneFraction());
+}
+
+// Estimate the fraction of the partition in the zones that may hold rows
+// satisfying all the restrictions, from the zone maps in PartStats.
+double SeqScan::estZoneFraction() const
+{
+    std::size_t num_zones = 0;
+    for (std::size_t i = 0; i < gteq_conds_.size(); ++i) {
+        ColID cid = gteq_conds_[i].get<1>();
+        if (cid < stats_->zones_.size()) {
+            num_zones = std::max(num_zones, stats_->zones_[cid].size());
+        }
+    }
+    if (num_zones == 0) {
+        return 1.0;
+    }
+
+    std::size_t num_matches = 0;
+    for (std::size_t z = 0; z < num_zones; ++z) {
+        bool match = true;
+        for (std::size_t i = 0; match && i < gteq_conds_.size(); ++i) {
+            ColID cid = gteq_conds_[i].get<1>();
+            if (cid < stats_->zones_.size()
+                && z < stats_->zones_[cid].size()) {
+                match = ColumnStore::matchZone(
+                            stats_->zones_[cid][z],
+                            gteq_conds_[i].get<0>(),
+                            gteq_conds_[i].get<2>() == GT);
+            }
+        }
+        if (match) {
+            ++num_matches;
+        }
+    }
+
+    return static_cast<double>(num_matches) / num_zones;
 }
 
 }  // namespace cardinality
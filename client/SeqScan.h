@@ -49,7 +49,9 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
+    void setSliceCursor(boost::shared_ptr<SliceCursor>);
 
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
@@ -58,14 +60,39 @@ public:
 
     // plan exploration
     void print(std::ostream &, const int, const double) const;
+    std::string getJoinIndexKey(const ColID) const;
 
     // cost estimation
     double estCost(const double = 0.0) const;
     double estCardinality(const bool = false) const;
 
 protected:
+#ifndef DISABLE_MEMORY_MAPPED_IO
+    // helpers for GetNext()
+    void seekBlock(const uint32_t);
+    uint32_t nextBlock();
+    void prefetchAhead();
+    void initZones();
+    void skipZones();
+#endif
+
+    // helper for estCost() and estCardinality()
+    double estZoneFraction() const;
+
     // execution states
     const char *pos_;
+    const char *block_end_;
+    uint32_t block_;    // line number if DISABLE_MEMORY_MAPPED_IO
+    uint32_t row_;      // row id in the column store
+    boost::shared_ptr<SliceCursor> cursor_;  // ignored without mmap
+    const char *prefetch_end_;
+    const char *prefetch_mark_;  // prefetch again once pos_ reaches here
+    std::vector<bool> zones_;    // false if no rows can match in the zone
+    const char *zone_end_;       // check zones_ again once pos_ reaches here
+
+    // constants
+    static const std::size_t SEQSCAN_BLOCKSIZE = 1048576;
+    static const std::size_t SEQSCAN_PREFETCH_SIZE = 4194304;
 
 private:
     SeqScan& operator=(const SeqScan &);
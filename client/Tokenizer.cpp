@@ -0,0 +1,165 @@
+// Copyright (c) 2010, Hyunjung Park
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Stanford University nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "client/Tokenizer.h"
+
+// The SIMD paths need the target attribute and __builtin_cpu_supports(),
+// i.e., GCC 4.9 or later, or a compiler that declares them. Otherwise,
+// only splitLineScalar() is built.
+#ifndef __has_attribute
+#define __has_attribute(x) 0
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (__has_attribute(target) \
+        || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define ENABLE_SIMD_TOKENIZER
+#endif
+
+
+namespace cardinality {
+
+typedef const char *(*SplitLineFunc)(const char *, const char *,
+                                     const uint32_t, const char,
+                                     const char **);
+
+static const char *splitLineScalar(const char *pos, const char *end,
+                                   const uint32_t num_delims,
+                                   const char eol, const char **delims)
+{
+    uint32_t n = 0;
+
+    for (; pos < end; ++pos) {
+        if (*pos == '|' || *pos == eol) {
+            delims[n] = pos;
+            if (++n == num_delims) {
+                return pos + 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef ENABLE_SIMD_TOKENIZER
+// The SIMD paths load only whole blocks that end by the end of the
+// buffer, and leave the rest of it to splitLineScalar(), so that they
+// never read past the end.
+
+// Returns a bitmask of delimiters in the 32 bytes at the given address.
+__attribute__((target("avx2")))
+static inline uint32_t delimMaskAVX2(const char *block, const char eol)
+{
+    __m256i bytes
+        = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    return _mm256_movemask_epi8(
+               _mm256_or_si256(
+                   _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|')),
+                   _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(eol))));
+}
+
+__attribute__((target("avx2")))
+static const char *splitLineAVX2(const char *pos, const char *end,
+                                 const uint32_t num_delims,
+                                 const char eol, const char **delims)
+{
+    uint32_t n = 0;
+
+    for (; end - pos >= 32; pos += 32) {
+        for (uint32_t mask = delimMaskAVX2(pos, eol); mask != 0;
+             mask &= mask - 1) {
+            const char *delim = pos + __builtin_ctz(mask);
+            delims[n] = delim;
+            if (++n == num_delims) {
+                return delim + 1;
+            }
+        }
+    }
+
+    return splitLineScalar(pos, end, num_delims - n, eol, delims + n);
+}
+
+// Returns a bitmask of delimiters in the 16 bytes at the given address.
+__attribute__((target("sse2")))
+static inline uint32_t delimMaskSSE2(const char *block, const char eol)
+{
+    __m128i bytes
+        = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+    return _mm_movemask_epi8(
+               _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')),
+                            _mm_cmpeq_epi8(bytes, _mm_set1_epi8(eol))));
+}
+
+__attribute__((target("sse2")))
+static const char *splitLineSSE2(const char *pos, const char *end,
+                                 const uint32_t num_delims,
+                                 const char eol, const char **delims)
+{
+    uint32_t n = 0;
+
+    for (; end - pos >= 16; pos += 16) {
+        for (uint32_t mask = delimMaskSSE2(pos, eol); mask != 0;
+             mask &= mask - 1) {
+            const char *delim = pos + __builtin_ctz(mask);
+            delims[n] = delim;
+            if (++n == num_delims) {
+                return delim + 1;
+            }
+        }
+    }
+
+    return splitLineScalar(pos, end, num_delims - n, eol, delims + n);
+}
+#endif
+
+// Choose an implementation based on cpuid.
+static SplitLineFunc chooseSplitLine()
+{
+#ifdef ENABLE_SIMD_TOKENIZER
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &splitLineAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &splitLineSSE2;
+    }
+#endif
+    return &splitLineScalar;
+}
+
+static const SplitLineFunc split_line = chooseSplitLine();
+
+const char *splitLine(const char *pos, const char *end,
+                      const uint32_t num_delims,
+                      const char eol, const char **delims)
+{
+    return split_line(pos, end, num_delims, eol, delims);
+}
+
+}  // namespace cardinality
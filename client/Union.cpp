@@ -28,6 +28,9 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "client/Union.h"
+#include <poll.h>
+#include <cerrno>
+#include <stdexcept>  // std::runtime_error
 #include <string>
 #include <cstring>
 #include <algorithm>  // std::min
@@ -43,15 +46,21 @@ static bool lessPivot(const std::pair<const Value *, uint32_t> &a,
     return compareValue(a.first, b.first) < 0;
 }
 
-Union::Union(const NodeID n, std::vector<Operator::Ptr> c, const char *col)
+Union::Union(const NodeID n, std::vector<Operator::Ptr> c, const char *col,
+             const bool ordered)
     : Operator(n),
       children_(c),
       pivots_(),
+      ordered_(), order_col_id_(),
       it_(),
       deserialized_(false),
-      done_()
+      done_(),
+      lookup_(), lookup_states_(), lookup_values_(), lookup_map_(),
+      lookup_tuples_(), lookup_next_()
 {
-    if (col) {
+    if (col && ordered) {
+        initOrder(getOutputColID(col));
+    } else if (col) {
         for (std::size_t i = 0; i < children_.size(); ++i) {
             std::pair<const PartStats *, ColID> x
                 = children_[i]->getPartStats(getOutputColID(col));
@@ -70,9 +79,12 @@ Union::Union(google::protobuf::io::CodedInputStream *input)
     : Operator(input),
       children_(),
       pivots_(),
+      ordered_(), order_col_id_(),
       it_(),
       deserialized_(true),
-      done_()
+      done_(),
+      lookup_(), lookup_states_(), lookup_values_(), lookup_map_(),
+      lookup_tuples_(), lookup_next_()
 {
     Deserialize(input);
 }
@@ -81,9 +93,12 @@ Union::Union(const Union &x)
     : Operator(x),
       children_(),
       pivots_(x.pivots_),
+      ordered_(x.ordered_), order_col_id_(x.order_col_id_),
       it_(),
       deserialized_(false),
-      done_()
+      done_(),
+      lookup_(), lookup_states_(), lookup_values_(), lookup_map_(),
+      lookup_tuples_(), lookup_next_()
 {
     children_.reserve(x.children_.size());
     for (std::vector<Operator::Ptr>::const_iterator it = x.children_.begin();
@@ -101,6 +116,61 @@ Union::~Union()
     }
 }
 
+// Sort the children by the primary key ranges of their partitions so
+// that concatenating them preserves the order of the given column.
+// Leaves ordered_ false unless every child is sorted on the column and
+// the ranges do not overlap.
+void Union::initOrder(const ColID cid)
+{
+    std::vector<std::pair<const Value *, uint32_t> > ranges;
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        std::pair<const PartStats *, ColID> x
+            = children_[i]->getPartStats(cid);
+        if (x.second != 0 || !children_[i]->isSortedOn(cid)) {
+            return;
+        }
+        ranges.push_back(std::make_pair(&x.first->min_pkey_, i));
+    }
+
+    std::sort(ranges.begin(), ranges.end(), lessPivot);
+
+    std::vector<Operator::Ptr> children;
+    children.reserve(children_.size());
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        if (i > 0
+            && compareValue(&children.back()->getPartStats(cid)
+                                 .first->max_pkey_,
+                            ranges[i].first) >= 0) {
+            return;
+        }
+        children.push_back(children_[ranges[i].second]);
+    }
+
+    children_.swap(children);
+    ordered_ = true;
+    order_col_id_ = cid;
+}
+
+// Returns the child whose partition may contain the given join value.
+uint32_t Union::findChild(const Chunk *join_value) const
+{
+    Value val;
+    if (pivots_[0].first->type == INT) {
+        val.type = INT;
+        val.intVal = Operator::parseInt(join_value);
+    } else {  // STRING
+        val.type = STRING;
+        val.intVal = join_value->second;
+        std::memcpy(val.charVal, join_value->first, join_value->second);
+        val.charVal[join_value->second] = '\0';
+    }
+
+    std::pair<const Value *, uint32_t> x = std::make_pair(&val, 0);
+    std::vector<std::pair<const Value *, uint32_t> >::const_iterator it
+        = std::upper_bound(pivots_.begin(), pivots_.end(), x, lessPivot);
+    return (it != pivots_.begin()) ? (it - 1)->second : 1;
+}
+
 Operator::Ptr Union::clone() const
 {
     return boost::make_shared<Union>(*this);
@@ -117,22 +187,7 @@ void Union::Open(const Chunk *join_value)
         it_ = 0;
 
     } else {
-        Value val;
-        if (pivots_[0].first->type == INT) {
-            val.type = INT;
-            val.intVal = Operator::parseInt(join_value);
-        } else {  // STRING
-            val.type = STRING;
-            val.intVal = join_value->second;
-            std::memcpy(val.charVal, join_value->first, join_value->second);
-            val.charVal[join_value->second] = '\0';
-        }
-
-        std::pair<const Value *, uint32_t> x = std::make_pair(&val, 0);
-        std::vector<std::pair<const Value *, uint32_t> >::const_iterator it
-            = std::upper_bound(pivots_.begin(), pivots_.end(), x, lessPivot);
-        it_ = (it != pivots_.begin()) ? (it - 1)->second : 1;
-
+        it_ = findChild(join_value);
         children_[it_]->Open(join_value);
     }
 }
@@ -158,34 +213,202 @@ bool Union::GetNext(Tuple &tuple)
         return children_[it_]->GetNext(tuple);
     }
 
-    for (; it_ < children_.size(); ++it_) {
-        if (!done_[it_]) {
-            if (children_[it_]->GetNext(tuple)) {
-                done_[it_] = true;
-            } else {
-                ++it_;
+    if (ordered_) {
+        for (; it_ < children_.size(); ++it_) {
+            if (!children_[it_]->GetNext(tuple)) {
                 return false;
             }
         }
+        return true;
     }
 
-    for (it_ = 0; it_ < children_.size(); ++it_) {
-        if (!done_[it_]) {
-            if (children_[it_]->GetNext(tuple)) {
-                done_[it_] = true;
-            } else {
+    return gatherNext(&tuple, NULL);
+}
+
+bool Union::GetNextBatch(TupleBatch &batch)
+{
+    if (!pivots_.empty()) {
+        return children_[it_]->GetNextBatch(batch);
+    }
+
+    if (ordered_) {
+        while (it_ < children_.size()) {
+            if (children_[it_]->GetNextBatch(batch)) {
                 ++it_;
-                return false;
+            }
+            if (!batch.sel.empty()) {
+                return it_ == children_.size();
             }
         }
+        return true;
     }
 
-    return true;
+    return gatherNext(NULL, &batch);
 }
 
-void Union::Close()
+// Return a tuple or a batch from any child in the order of arrival.
+// Children that do not wait for other nodes are read in a round-robin
+// fashion; once all of them would wait, poll() picks the ones that
+// have received data, so that no node stalls behind a slower one.
+bool Union::gatherNext(Tuple *tuple, TupleBatch *batch)
+{
+    std::vector<pollfd> fds;
+    std::vector<uint32_t> fd_children;
+
+    for (;;) {
+        fds.clear();
+        fd_children.clear();
+
+        for (std::size_t k = 0; k < children_.size(); ++k) {
+            uint32_t i = it_;
+            it_ = (it_ + 1) % children_.size();
+            if (done_[i]) {
+                continue;
+            }
+
+            int fd = children_[i]->pollDescriptor();
+            if (fd < 0) {
+                if (fetchChild(i, tuple, batch)) {
+                    return false;
+                }
+            } else {
+                pollfd pfd = {fd, POLLIN, 0};
+                fds.push_back(pfd);
+                fd_children.push_back(i);
+            }
+        }
+
+        if (fds.empty()) {
+            if (batch) {
+                batch->reset(numOutputCols());
+            }
+            return true;
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0 && errno != EINTR) {
+            throw std::runtime_error("poll() failed");
+        }
+
+        for (std::size_t j = 0; j < fds.size(); ++j) {
+            if (fds[j].revents) {
+                uint32_t i = fd_children[j];
+                if (fetchChild(i, tuple, batch)) {
+                    it_ = (i + 1) % children_.size();
+                    return false;
+                }
+            }
+        }
+    }
+}
+
+// Get a tuple or a batch from the i-th child.
+// Returns false if the child has returned nothing.
+bool Union::fetchChild(const uint32_t i, Tuple *tuple, TupleBatch *batch)
+{
+    if (tuple) {
+        done_[i] = children_[i]->GetNext(*tuple);
+        return !done_[i];
+    }
+
+    done_[i] = children_[i]->GetNextBatch(*batch);
+    return !batch->sel.empty();
+}
+
+// With pivots, each join value is sent only to the child whose partition
+// may contain it.
+void Union::OpenLookup(const std::vector<Chunk> &join_values)
+{
+    lookup_ = true;
+    lookup_states_.assign(children_.size(), LOOKUP_CLOSED);
+    lookup_values_.resize(children_.size());
+    lookup_map_.resize(children_.size());
+    lookup_tuples_.resize(children_.size());
+    lookup_next_.resize(children_.size());
+
+    if (pivots_.empty()) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            children_[i]->OpenLookup(join_values);
+            lookup_states_[i] = LOOKUP_FETCH;
+        }
+
+    } else {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            lookup_values_[i].clear();
+            lookup_map_[i].clear();
+        }
+        for (std::size_t k = 0; k < join_values.size(); ++k) {
+            uint32_t i = findChild(&join_values[k]);
+            lookup_values_[i].push_back(join_values[k]);
+            lookup_map_[i].push_back(k);
+        }
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            if (!lookup_values_[i].empty()) {
+                children_[i]->OpenLookup(lookup_values_[i]);
+                lookup_states_[i] = LOOKUP_FETCH;
+            }
+        }
+    }
+}
+
+void Union::ReOpenLookup(const std::vector<Chunk> &join_values)
 {
     if (pivots_.empty()) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            children_[i]->ReOpenLookup(join_values);
+            lookup_states_[i] = LOOKUP_FETCH;
+        }
+
+    } else {
+        Close();
+        OpenLookup(join_values);
+    }
+}
+
+// Merge the results of the children by the positions of their join
+// values. A child is advanced only when its previous result has been
+// consumed by the caller, so that the result stays valid.
+bool Union::GetNextLookup(Tuple &tuple, uint32_t &pos)
+{
+    int next = -1;
+
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        if (lookup_states_[i] == LOOKUP_FETCH) {
+            uint32_t child_pos;
+            if (children_[i]->GetNextLookup(lookup_tuples_[i], child_pos)) {
+                lookup_states_[i] = LOOKUP_DONE;
+            } else {
+                lookup_states_[i] = LOOKUP_READY;
+                lookup_next_[i] = pivots_.empty() ? child_pos
+                                                  : lookup_map_[i][child_pos];
+            }
+        }
+        if (lookup_states_[i] == LOOKUP_READY
+            && (next < 0 || lookup_next_[i] < lookup_next_[next])) {
+            next = i;
+        }
+    }
+
+    if (next < 0) {
+        return true;
+    }
+
+    tuple = lookup_tuples_[next];
+    pos = lookup_next_[next];
+    lookup_states_[next] = LOOKUP_FETCH;
+    return false;
+}
+
+void Union::Close()
+{
+    if (lookup_) {
+        for (std::size_t i = 0; i < children_.size(); ++i) {
+            if (lookup_states_[i] != LOOKUP_CLOSED) {
+                children_[i]->Close();
+            }
+        }
+        lookup_ = false;
+
+    } else if (pivots_.empty()) {
         for (std::size_t i = 0; i < children_.size(); ++i) {
             children_[i]->Close();
         }
@@ -195,6 +418,21 @@ void Union::Close()
     }
 }
 
+void Union::setBloomFilter(const ColID cid,
+                           boost::shared_ptr<const BloomFilter> filter)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->setBloomFilter(cid, filter);
+    }
+}
+
+void Union::setSlice(const uint32_t slice, const uint32_t num_slices)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->setSlice(slice, num_slices);
+    }
+}
+
 uint8_t *Union::SerializeToArray(uint8_t *target) const
 {
     using google::protobuf::io::CodedOutputStream;
@@ -225,6 +463,9 @@ uint8_t *Union::SerializeToArray(uint8_t *target) const
                      pivots_[i].second, target);
     }
 
+    target = CodedOutputStream::WriteVarint32ToArray(ordered_, target);
+    target = CodedOutputStream::WriteVarint32ToArray(order_col_id_, target);
+
     return target;
 }
 
@@ -252,6 +493,9 @@ int Union::ByteSize() const
         total_size += CodedOutputStream::VarintSize32(pivots_[i].second);
     }
 
+    total_size += 1;
+    total_size += CodedOutputStream::VarintSize32(order_col_id_);
+
     return total_size;
 }
 
@@ -280,12 +524,21 @@ void Union::Deserialize(google::protobuf::io::CodedInputStream *input)
         input->ReadVarint32(&temp);
         pivots_.push_back(std::make_pair(value, temp));
     }
+
+    uint32_t temp;
+    input->ReadVarint32(&temp);
+    ordered_ = temp;
+    input->ReadVarint32(&temp);
+    order_col_id_ = static_cast<ColID>(temp);
 }
 
 void Union::print(std::ostream &os, const int tab, const double lcard) const
 {
     os << std::string(4 * tab, ' ');
     os << "Union@" << node_id();
+    if (ordered_) {
+        os << " ordered";
+    }
     os << " card=" << estCardinality();
     os << " cost=" << estCost(lcard);
     os << std::endl;
@@ -325,6 +578,29 @@ ColID Union::getOutputColID(const ColName col) const
     return children_[0]->getOutputColID(col);
 }
 
+bool Union::isSortedOn(const ColID cid) const
+{
+    return ordered_ && cid == order_col_id_;
+}
+
+bool Union::isRemoteLookup() const
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->isRemoteLookup()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Union::rebind(const Query *from, const Query *to)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->rebind(from, to);
+    }
+}
+
 double Union::estCost(const double lcard) const
 {
     double cost = 0.0;
@@ -361,4 +637,30 @@ double Union::estColSize(const ColID cid) const
     return children_[0]->estColSize(cid);
 }
 
+std::string Union::getTableSet() const
+{
+    return children_[0]->getTableSet();
+}
+
+void Union::getCardEstimates(std::vector<CardEstimate> &estimates) const
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->getCardEstimates(estimates);
+    }
+}
+
+void Union::getCardCounts(std::vector<CardCount> &counts) const
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->getCardCounts(counts);
+    }
+}
+
+void Union::setCardCorrections(const CardCorrections &corrections)
+{
+    for (std::size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->setCardCorrections(corrections);
+    }
+}
+
 }  // namespace cardinality
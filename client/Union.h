@@ -39,7 +39,8 @@ namespace cardinality {
 class Union: public Operator {
 public:
     // constructor, destructor
-    Union(const NodeID, std::vector<Operator::Ptr>, const char * = NULL);
+    Union(const NodeID, std::vector<Operator::Ptr>, const char * = NULL,
+          const bool = false);
     explicit Union(google::protobuf::io::CodedInputStream *);
     Union(const Union &);
     ~Union();
@@ -49,7 +50,13 @@ public:
     void Open(const Chunk * = NULL);
     void ReOpen(const Chunk * = NULL);
     bool GetNext(Tuple &);
+    bool GetNextBatch(TupleBatch &);
     void Close();
+    void setBloomFilter(const ColID, boost::shared_ptr<const BloomFilter>);
+    void setSlice(const uint32_t, const uint32_t);
+    void OpenLookup(const std::vector<Chunk> &);
+    void ReOpenLookup(const std::vector<Chunk> &);
+    bool GetNextLookup(Tuple &, uint32_t &);
 
     // serialization
     uint8_t *SerializeToArray(uint8_t *) const;
@@ -64,6 +71,11 @@ public:
     ValueType getColType(const ColName) const;
     ColID numOutputCols() const;
     ColID getOutputColID(const ColName) const;
+    bool isSortedOn(const ColID) const;
+    bool isRemoteLookup() const;
+
+    // plan caching
+    void rebind(const Query *, const Query *);
 
     // cost estimation
     double estCost(const double = 0.0) const;
@@ -71,15 +83,41 @@ public:
     double estTupleSize() const;
     double estColSize(const ColID) const;
 
+    // cardinality feedback
+    std::string getTableSet() const;
+    void getCardEstimates(std::vector<CardEstimate> &) const;
+    void getCardCounts(std::vector<CardCount> &) const;
+    void setCardCorrections(const CardCorrections &);
+
 protected:
+    // helper for the constructor
+    void initOrder(const ColID);
+
+    // helper for Open() and OpenLookup()
+    uint32_t findChild(const Chunk *) const;
+
+    // helpers for GetNext() and GetNextBatch()
+    bool gatherNext(Tuple *, TupleBatch *);
+    bool fetchChild(const uint32_t, Tuple *, TupleBatch *);
+
     // operator description
     std::vector<Operator::Ptr> children_;
     std::vector<std::pair<const Value *, uint32_t> > pivots_;
+    bool ordered_;
+    ColID order_col_id_;
 
     // execution states
     uint32_t it_;
     bool deserialized_;
     std::vector<bool> done_;
+    bool lookup_;                       // opened by OpenLookup()
+    enum LookupState { LOOKUP_CLOSED, LOOKUP_FETCH,
+                       LOOKUP_READY, LOOKUP_DONE };
+    std::vector<LookupState> lookup_states_;
+    std::vector<std::vector<Chunk> > lookup_values_;
+    std::vector<std::vector<uint32_t> > lookup_map_;  // positions in batch
+    std::vector<Tuple> lookup_tuples_;  // next result of each child
+    std::vector<uint32_t> lookup_next_;
 
 private:
     Union& operator=(const Union &);
@@ -29,13 +29,16 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <cstring>
+#include <cstdio>  // std::snprintf
+#include <cmath>  // std::pow, std::frexp
 #include <stdexcept>  // std::runtime_error
-#include <algorithm>  // std::sort, std::min, std::next_permutation,
-                      // std::random_shuffle
+#include <algorithm>  // std::sort, std::min, std::swap, std::random_shuffle
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
@@ -43,29 +46,84 @@
 #include "include/client.h"
 #include "client/IOManager.h"
 #include "client/PartStats.h"
+#include "client/ColumnStore.h"
+#include "client/JoinIndex.h"
 #include "client/SeqScan.h"
 #include "client/IndexScan.h"
 #include "client/NLJoin.h"
+#include "client/PairJoin.h"
 #include "client/NBJoin.h"
+#include "client/HashJoin.h"
+#include "client/MergeJoin.h"
 #include "client/Remote.h"
 #include "client/Union.h"
+#include "client/Exchange.h"
 #include "client/Dummy.h"
 #include "client/util.h"
 
 
 namespace ca = cardinality;
 
+// Represent the rows returned by a query, kept for identical queries.
+// INT values are stored in 4 bytes and STRING values in 2 bytes of
+// length followed by the characters.
+struct CachedResult {
+    std::string rows;
+    std::vector<bool> value_types;  // true for STRING, false for INT
+    double cost;                    // execution time in microseconds
+};
+
 // declared in include/client.h
 struct Connection {
     const Query *q;
     ca::Operator::Ptr root;
-    ca::Tuple tuple;
+    ca::TupleBatch batch;
+    uint32_t batch_pos;             // next row in batch.sel
+    bool batch_done;                // no more batch after this one
     std::vector<ca::ColID> output_col_ids;
     std::vector<bool> value_types;  // true for STRING, false for INT
+
+    // result cache
+    boost::shared_ptr<const CachedResult> cached;  // result being replayed
+    std::size_t cached_pos;         // next row in cached->rows
+    std::string result_key;         // empty if the result is not recorded
+    std::string result_rows;        // rows recorded for the cache
+    boost::system_time start_time;
 };
 
 static const ca::NodeID MASTER_NODE_ID = 0;
 
+// maximum number of tables in a query for buildQueryPlanJoin()
+static const int MAX_DP_TABLES = 16;
+
+// maximum number of threads for an Exchange operator
+static const uint32_t MAX_EXCHANGE_DEGREE = 8;
+
+// fraction of the pretreatment time spent on building column stores
+static const double STORE_TIME_FRACTION = 0.8;
+
+// fraction of the pretreatment time by which all scheduled pretreatment
+// tasks must finish
+static const double PRETREATMENT_TIME_FRACTION = 0.9;
+
+// memory for cached query results, and the largest result to be cached
+static const std::size_t RESULT_CACHE_SIZE = 256 << 20;
+static const std::size_t RESULT_MAX_SIZE = 16 << 20;
+
+// bytes of a cached result that a microsecond of execution time pays for
+static const double RESULT_BYTES_PER_USEC = 256.0;
+
+// weight of the latest execution in a cardinality correction, and the
+// largest correction in either direction
+static const double CARD_FEEDBACK_WEIGHT = 0.5;
+static const double CARD_CORRECTION_MAX = 10000.0;
+
+// a plan template is rebuilt at most MAX_REPLANS times, each time one of
+// its corrections drifts by CARD_REPLAN_RATIO from the one it was built
+// with
+static const int MAX_REPLANS = 3;
+static const double CARD_REPLAN_RATIO = 2.0;
+
 // node id to its IP address
 static boost::asio::ip::address_v4 *g_addrs;
 
@@ -80,6 +138,64 @@ static std::map<std::string, std::vector<ca::PartStats *> > g_stats;
 // mutex for g_stats
 static boost::mutex g_stats_mutex;
 
+// table name to the number of restrictions on each column in the preset
+// queries, which decides the columns kept in column stores
+static std::map<std::string, std::vector<uint32_t> > g_preset_cols;
+
+// table name to the columns without indexes that are restricted or joined
+// in the preset queries, which get indexes built by the client
+static std::map<std::string, std::vector<bool> > g_preset_index_cols;
+
+// deadline for building column stores
+static boost::system_time g_store_deadline;
+
+// Represent a query plan that can be reused for queries of the same shape.
+// Constants in the plan point to the value arrays of query, which are
+// copies of the constants used when the plan was built.
+// Cardinality corrections are learned from the executions of the plan,
+// and the plan is rebuilt once they drift from those it was built with.
+struct PlanTemplate {
+    ca::Operator::Ptr root;
+    Query query;
+    std::vector<Value> eq_values;
+    std::vector<Value> gt_values;
+    ca::CardCorrections corrections;    // learned from executions
+    ca::CardCorrections planned;        // used for building root
+    int num_replans;
+};
+
+// query shape to its query plan template
+static std::map<std::string, PlanTemplate *> g_plans;
+
+// Represent a pretreatment task on a node with its expected benefit.
+// Both the benefit and the cost are measured in pages, the former being
+// the pages that the preset queries would otherwise read from disk or
+// probe through locked indexes.
+struct PreTask {
+    ca::NodeID node;
+    ca::IOManager::PreTaskKind kind;
+    std::string name;   // file name, index name or join index name
+    ValueType type;     // key type of an index
+    double benefit;
+    double cost;
+};
+
+// mutex for g_plans
+static boost::mutex g_plans_mutex;
+
+// query with its constants to its cached result
+static std::map<std::string, boost::shared_ptr<const CachedResult> >
+    g_results;
+
+// cached results ordered by execution time saved per byte, with their keys
+static std::set<std::pair<double, std::string> > g_results_by_density;
+
+// total size of the cached results
+static std::size_t g_results_size = 0;
+
+// mutex for g_results
+static boost::mutex g_results_mutex;
+
 
 // Returns true if the given column is indexed.
 static inline bool HASIDXCOL(const ca::ColName col, const char *alias)
@@ -89,6 +205,42 @@ static inline bool HASIDXCOL(const ca::ColName col, const char *alias)
            && !std::memcmp(col, alias, aliasLen);
 }
 
+// Returns true if the given column is indexed, or has an index built by
+// the client on the nodes of all partitions of the given table.
+static bool HASIDXCOL(const ca::ColName col, const char *alias,
+                      const std::string &table_name)
+{
+    if (HASIDXCOL(col, alias)) {
+        return true;
+    }
+
+    int aliasLen = std::strlen(alias);
+    if (col[aliasLen] != '.' || std::memcmp(col, alias, aliasLen)) {
+        return false;
+    }
+
+    const Table *table = g_tables[table_name];
+    int c = 0;
+    while (c < table->nbFields
+           && std::strcmp(table->fieldsName[c], col + aliasLen + 1)) {
+        ++c;
+    }
+    if (c == table->nbFields) {
+        return false;
+    }
+
+    const std::vector<ca::PartStats *> &parts = g_stats[table_name];
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        for (const ca::PartStats *stats = parts[i];
+             stats != NULL; stats = stats->next_) {
+            if (!stats->hasColumnIndex(c)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 // Returns true if the primary key range of two given partitions
 // do not overlap.
 static bool NO_PKEY_OVERLAP(const ca::PartStats *a,
@@ -105,258 +257,127 @@ static bool lessPartStats(const ca::PartStats *a,
     return ca::compareValue(&a->min_pkey_, &b->min_pkey_) < 0;
 }
 
-// Enumerate all single table scans.
-// IndexScan is preferred to SeqScan.
-// Called by buildQueryPlanNoPartition().
-static void enumerateScans(const Query *q,
-                           std::vector<ca::Operator::Ptr> &scans)
+// Returns true if the query restricts an indexed column of the given alias.
+static bool hasIndexedRestriction(const Query *q, const char *alias)
 {
-    for (int i = 0; i < q->nbTable; ++i) {
-        std::string table_name(q->tableNames[i]);
-        Table *table = g_tables[table_name];
-        Partition *part = &table->partitions[0];
-        ca::PartStats *stats = g_stats[table_name][0];
-
-        try {
-            scans.push_back(
-                boost::make_shared<ca::IndexScan>(
-                    part->iNode,
-                    part->fileName, q->aliasNames[i],
-                    table, stats, q));
-
-        } catch (std::runtime_error &e) {
-            scans.push_back(
-                boost::make_shared<ca::SeqScan>(
-                    part->iNode,
-                    part->fileName, q->aliasNames[i],
-                    table, stats, q));
+    for (int i = 0; i < q->nbRestrictionsEqual; ++i) {
+        if (HASIDXCOL(q->restrictionEqualFields[i], alias)) {
+            return true;
+        }
+    }
+    for (int i = 0; i < q->nbRestrictionsGreaterThan; ++i) {
+        if (HASIDXCOL(q->restrictionGreaterThanFields[i], alias)) {
+            return true;
         }
     }
+    return false;
 }
 
-// Enumerate all two way joins.
-// Nested-loop index join is preferred to nest-block join.
-// Called by buildQueryPlanNoPartition().
-static void enumerate2wayJoins(const Query *q,
-                               const std::vector<ca::Operator::Ptr> &scans,
-                               std::vector<ca::Operator::Ptr> &plans)
+// Return a single table scan of a partition. IndexScan is preferred to
+// SeqScan on an indexed column, while IndexScan on a column indexed by
+// the client has to be cheaper than SeqScan.
+static ca::Operator::Ptr buildScan(const Query *q,
+                                   const Partition *part,
+                                   const char *alias_name,
+                                   const Table *table,
+                                   const ca::PartStats *stats)
 {
-    for (int i = 0; i < q->nbTable; ++i) {
-        Table *table1 = g_tables[std::string(q->tableNames[i])];
-        Partition *part1 = &table1->partitions[0];
-        ca::PartStats *stats1 = g_stats[std::string(q->tableNames[i])][0];
-
-        for (int j = i + 1; j < q->nbTable; ++j) {
-            Table *table2 = g_tables[std::string(q->tableNames[j])];
-            Partition *part2 = &table2->partitions[0];
-            ca::PartStats *stats2 = g_stats[std::string(q->tableNames[j])][0];
-
-            std::size_t plans_size = plans.size();
-            ca::Operator::Ptr scan1 = scans[i];
-            ca::Operator::Ptr scan2 = scans[j];
-
-            // add a Remote operator if needed
-            if (part1->iNode != part2->iNode) {
-                scan1 = boost::make_shared<ca::Remote>(
-                            part2->iNode, scan1, g_addrs[scan1->node_id()]);
-                scan2 = boost::make_shared<ca::Remote>(
-                            part1->iNode, scan2, g_addrs[scan2->node_id()]);
-            }
-
-            // Nested Loop Index Join
-            for (int k = 0; k < q->nbJoins; ++k) {
-                if (HASIDXCOL(q->joinFields1[k], q->aliasNames[j])
-                    && scan1->hasCol(q->joinFields2[k])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part2->iNode,
-                            scan1,
-                            boost::make_shared<ca::IndexScan>(
-                                part2->iNode,
-                                part2->fileName, q->aliasNames[j],
-                                table2, stats2, q,
-                                q->joinFields1[k]),
-                            q, k, q->joinFields2[k]));
-                    break;
-                }
-                if (HASIDXCOL(q->joinFields2[k], q->aliasNames[j])
-                    && scan1->hasCol(q->joinFields1[k])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part2->iNode,
-                            scan1,
-                            boost::make_shared<ca::IndexScan>(
-                                part2->iNode,
-                                part2->fileName, q->aliasNames[j],
-                                table2, stats2, q,
-                                q->joinFields2[k]),
-                            q, k, q->joinFields1[k]));
-                    break;
-                }
-            }
-
-            for (int k = 0; k < q->nbJoins; ++k) {
-                if (HASIDXCOL(q->joinFields1[k], q->aliasNames[i])
-                    && scan2->hasCol(q->joinFields2[k])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part1->iNode,
-                            scan2,
-                            boost::make_shared<ca::IndexScan>(
-                                part1->iNode,
-                                part1->fileName, q->aliasNames[i],
-                                table1, stats1, q,
-                                q->joinFields1[k]),
-                            q, k, q->joinFields2[k]));
-                    break;
-                }
-                if (HASIDXCOL(q->joinFields2[k], q->aliasNames[i])
-                    && scan2->hasCol(q->joinFields1[k])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part1->iNode,
-                            scan2,
-                            boost::make_shared<ca::IndexScan>(
-                                part1->iNode,
-                                part1->fileName, q->aliasNames[i],
-                                table1, stats1, q,
-                                q->joinFields2[k]),
-                            q, k, q->joinFields1[k]));
-                    break;
-                }
-            }
-
-            // Nested Block Join
-            if (plans_size == plans.size()) {
-                plans.push_back(
-                    boost::make_shared<ca::NBJoin>(
-                        scans[j]->node_id(), scan1, scans[j], q));
-                plans.push_back(
-                    boost::make_shared<ca::NBJoin>(
-                        scans[i]->node_id(), scan2, scans[i], q));
-            }
+    ca::Operator::Ptr seq_scan;
+    try {
+        ca::Operator::Ptr index_scan = boost::make_shared<ca::IndexScan>(
+                                           part->iNode,
+                                           part->fileName, alias_name,
+                                           table, stats, q);
+        if (hasIndexedRestriction(q, alias_name)) {
+            return index_scan;
+        }
+        seq_scan = boost::make_shared<ca::SeqScan>(
+                       part->iNode,
+                       part->fileName, alias_name,
+                       table, stats, q);
+        if (index_scan->estCost() < seq_scan->estCost()) {
+            return index_scan;
         }
+    } catch (std::runtime_error &e) {
+        seq_scan = boost::make_shared<ca::SeqScan>(
+                       part->iNode,
+                       part->fileName, alias_name,
+                       table, stats, q);
     }
+    return seq_scan;
 }
 
-// Enumerate all k-way joins.
-// Called by buildQueryPlanNoPartition().
-static void enumerateJoins(const Query *q,
-                           const std::vector<ca::Operator::Ptr> &scans,
-                           const std::vector<ca::Operator::Ptr> &subplans,
-                           std::vector<ca::Operator::Ptr> &plans)
+// Returns true if both plans are sorted on the given join condition.
+static bool isMergeable(const Query *q,
+                        const ca::Operator::Ptr &left,
+                        const ca::Operator::Ptr &right,
+                        const int k)
 {
-    ca::Operator::Ptr subplan;
-
-    for (std::size_t k = 0; k < subplans.size(); ++k) {
-        for (int i = 0; i < q->nbTable; ++i) {
-            if (subplans[k]->hasCol(q->aliasNames[i])) {
-                continue;
-            }
-
-            std::string table_name(q->tableNames[i]);
-            Table *table = g_tables[table_name];
-            Partition *part = &table->partitions[0];
-            ca::PartStats *stats = g_stats[table_name][0];
-            subplan = subplans[k];
-
-            // add a Remote operator if needed
-            if (subplan->node_id() != static_cast<ca::NodeID>(part->iNode)) {
-                subplan = boost::make_shared<ca::Remote>(
-                              part->iNode, subplan,
-                              g_addrs[subplan->node_id()]);
-            }
-
-            // Nested Loop Index Join
-            for (int j = 0; j < q->nbJoins; ++j) {
-                if (HASIDXCOL(q->joinFields1[j], q->aliasNames[i])
-                    && subplan->hasCol(q->joinFields2[j])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part->iNode,
-                            subplan,
-                            boost::make_shared<ca::IndexScan>(
-                                part->iNode,
-                                part->fileName, q->aliasNames[i],
-                                table, stats, q,
-                                q->joinFields1[j]),
-                            q, j, q->joinFields2[j]));
-                    break;
-                }
-                if (HASIDXCOL(q->joinFields2[j], q->aliasNames[i])
-                    && subplan->hasCol(q->joinFields1[j])) {
-                    plans.push_back(
-                        boost::make_shared<ca::NLJoin>(
-                            part->iNode,
-                            subplan,
-                            boost::make_shared<ca::IndexScan>(
-                                part->iNode,
-                                part->fileName, q->aliasNames[i],
-                                table, stats, q,
-                                q->joinFields2[j]),
-                            q, j, q->joinFields1[j]));
-                    break;
-                }
-            }
-
-            // Nested Block Join
-            plans.push_back(
-                boost::make_shared<ca::NBJoin>(
-                    scans[i]->node_id(), subplan, scans[i], q));
-        }
+    ca::ColName left_col = q->joinFields1[k];
+    ca::ColName right_col = q->joinFields2[k];
+    if (!right->hasCol(right_col)) {
+        std::swap(left_col, right_col);
     }
+
+    return left->hasCol(left_col) && right->hasCol(right_col)
+           && left->isSortedOn(left->getOutputColID(left_col))
+           && right->isSortedOn(right->getOutputColID(right_col));
 }
 
-// Return the best query plan for executing the given query.
-// The caller should ensure that all tables in the FROM clause
-// have only one partition.
-static ca::Operator::Ptr buildQueryPlanNoPartition(const Query *q)
+// Return a join condition on which both plans are sorted,
+// or -1 if there is none.
+static int findMergeCond(const Query *q,
+                         const ca::Operator::Ptr &left,
+                         const ca::Operator::Ptr &right)
 {
-    std::vector<ca::Operator::Ptr> scans;
-    enumerateScans(q, scans);
-
-    if (q->nbTable == 1 && scans[0]->node_id() == MASTER_NODE_ID) {
-        return scans[0];
+    for (int k = 0; k < q->nbJoins; ++k) {
+        if (isMergeable(q, left, right, k)) {
+            return k;
+        }
     }
 
-    std::vector<ca::Operator::Ptr> plans;
-    std::vector<ca::Operator::Ptr> subplans;
+    return -1;
+}
 
-    if (q->nbTable > 1) {
-        enumerate2wayJoins(q, scans, plans);
-    } else {
-        plans = scans;
+// Return a nested-loop index join of the given plans at the given node.
+// A PairJoin is used instead if the plans are a SeqScan and an IndexScan
+// on that node, which walks their join index if pretreatment has built
+// one and looks up the index otherwise.
+static ca::Operator::Ptr buildIndexJoin(const ca::NodeID n,
+                                        ca::Operator::Ptr left,
+                                        ca::Operator::Ptr right,
+                                        const Query *q,
+                                        const int join_cond,
+                                        const ca::ColName left_join_col)
+{
+    if (left->node_id() == n && right->node_id() == n
+        && !left->getJoinIndexKey(
+                left->getOutputColID(left_join_col)).empty()
+        && !right->getJoinIndexKey(0).empty()) {
+        return boost::make_shared<ca::PairJoin>(n, left, right,
+                                                q, join_cond, left_join_col);
     }
+    return boost::make_shared<ca::NLJoin>(n, left, right,
+                                          q, join_cond, left_join_col);
+}
 
-    for (int i = 2; i < q->nbTable; ++i) {
-        subplans.clear();
-        plans.swap(subplans);
-        enumerateJoins(q, scans, subplans, plans);
+// Return the given plan split into slices run by an Exchange operator,
+// or the plan itself if that is not expected to be faster.
+// Nodes are assumed to have as many cores as the master.
+static ca::Operator::Ptr parallelize(ca::Operator::Ptr plan)
+{
+    uint32_t degree = std::min(boost::thread::hardware_concurrency(),
+                               MAX_EXCHANGE_DEGREE);
+    if (degree <= 1) {
+        return plan;
     }
 
-    ca::Operator::Ptr best_plan;
-    double min_cost = 0.0;
-
-    for (std::size_t k = 0; k < plans.size(); ++k) {
-        ca::Operator::Ptr root = plans[k];
-
-        // add a Remote operator if needed
-        if (root->node_id() != MASTER_NODE_ID) {
-            root = boost::make_shared<ca::Remote>(
-                       MASTER_NODE_ID, root,
-                       g_addrs[root->node_id()]);
-            plans[k] = root;
-        }
-
-        // estimate execution cost
-        double cost = root->estCost();
-        if (k == 0 || cost < min_cost) {
-            min_cost = cost;
-            best_plan = plans[k];
-        }
+    ca::Operator::Ptr exchange(
+        boost::make_shared<ca::Exchange>(plan->node_id(), plan, degree));
+    if (exchange->estCost() < plan->estCost()) {
+        return exchange;
     }
-
-    return best_plan;
+    return plan;
 }
 
 // Find partitions to scan using a condition on the primary key.
@@ -486,7 +507,6 @@ typedef std::vector<ca::Operator::Ptr> PartPlan;
 typedef std::vector<PartPlan> Plan;
 
 // Return a "Plan" for single table scan.
-// IndexScan is preferred to SeqScan.
 // Called by buildQueryPlanJoin().
 static void buildScans(const Query *q,
                        const std::string &table_name,
@@ -509,20 +529,7 @@ static void buildScans(const Query *q,
         for (const ca::PartStats *stats = *it;
              stats != NULL; stats = stats->next_) {
             Partition *part = &table->partitions[stats->part_no_];
-            ca::Operator::Ptr root;
-            try {
-                root = boost::make_shared<ca::IndexScan>(
-                           part->iNode,
-                           part->fileName, alias_name,
-                           table, stats, q);
-
-            } catch (std::runtime_error &e) {
-                root = boost::make_shared<ca::SeqScan>(
-                           part->iNode,
-                           part->fileName, alias_name,
-                           table, stats, q);
-            }
-            pp.push_back(root);
+            pp.push_back(buildScan(q, part, alias_name, table, stats));
         }
         std::random_shuffle(pp.begin(), pp.end());
         right.push_back(pp);
@@ -568,9 +575,11 @@ static void buildIndexScans(const Query *q,
 }
 
 // Return the best query plan using the given "Plan".
+// If ordered is true, the Union keeps the order of the given column.
 // Called by buildQueryPlanJoin().
 static ca::Operator::Ptr
-buildUnion(const ca::NodeID n, Plan &plan, const ca::ColName col = NULL)
+buildUnion(const ca::NodeID n, const Plan &plan, const ca::ColName col = NULL,
+           const bool ordered = false)
 {
     std::vector<ca::Operator::Ptr> best_pps;
 
@@ -599,226 +608,570 @@ buildUnion(const ca::NodeID n, Plan &plan, const ca::ColName col = NULL)
     }
 
     if (best_pps.size() > 1) {
-        return boost::make_shared<ca::Union>(n, best_pps, col);
+        return boost::make_shared<ca::Union>(n, best_pps, col, ordered);
     } else {
         return best_pps[0];
     }
 }
 
-// Return the best query plan for the given query and join order.
-// Nested-loop index join is preferred to nest-block join.
-static ca::Operator::Ptr
-buildQueryPlanJoin(const Query *q, const std::vector<int> &table_order)
+// Represent a candidate "Plan" for a set of tables.
+// covers[j] indicates the partitions covered by plan[j]:
+// one character per distinct partition of each table in the FROM clause,
+// '1' if covered and '0' otherwise.
+struct PlanCandidate {
+    Plan plan;
+    std::vector<std::string> covers;
+    double cost;
+};
+
+// Candidates for a set of tables, keyed by their partitioning.
+// Candidates with the same partitioning produce the same results
+// and can be extended in the same ways, so only the cheapest one is kept.
+typedef std::map<std::string, PlanCandidate> Candidates;
+
+// Base tables available for joining in buildQueryPlanJoin().
+struct BaseTable {
+    std::string table_name;
+    const char *alias_name;
+    std::size_t cover_offset;   // offset in PlanCandidate::covers
+    std::size_t first_part;     // first partition selected by findPartStats()
+    uint32_t neighbors;         // tables sharing a join condition
+    std::map<int, Plan> scans;  // join condition to scans, -1 for no index
+};
+
+// Returns the index of the table containing the given column.
+static int findTable(const Query *q, const ca::ColName col)
+{
+    for (int i = 0; i < q->nbTable; ++i) {
+        int alias_len = std::strlen(q->aliasNames[i]);
+        if (col[alias_len] == '.'
+            && !std::memcmp(col, q->aliasNames[i], alias_len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the table and the column id of the given column of a query,
+// or -1 if the column is not found.
+static int findColumn(const Query *q, const ca::ColName col,
+                      const Table *&table)
+{
+    int a = findTable(q, col);
+    if (a < 0) {
+        return -1;
+    }
+    std::map<std::string, Table *>::const_iterator table_it
+        = g_tables.find(std::string(q->tableNames[a]));
+    if (table_it == g_tables.end()) {
+        return -1;
+    }
+    table = table_it->second;
+
+    const char *name = col + std::strlen(q->aliasNames[a]) + 1;
+    for (int c = 0; c < table->nbFields; ++c) {
+        if (!std::strcmp(table->fieldsName[c], name)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Returns true if the given set of tables is connected in the join graph.
+static bool isConnected(const std::vector<BaseTable> &tables,
+                        const uint32_t set)
 {
-    std::vector<Plan> plans;
-    std::vector<Plan> subplans;
-
-    // the first table
-    const char *alias_name = q->aliasNames[table_order[0]];
-    std::string table_name(q->tableNames[table_order[0]]);
-    Plan scan;
-    buildScans(q, table_name, alias_name, scan);
-    if (scan.empty()) {
-        return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
-    }
-    plans.push_back(scan);
-
-    // all other tables
-    for (int i = 1; i < q->nbTable; ++i) {
-        subplans.clear();
-        plans.swap(subplans);
-
-        alias_name = q->aliasNames[table_order[i]];
-        table_name = q->tableNames[table_order[i]];
-
-        ca::ColName left_join_col = NULL;
-        ca::ColName right_join_col = NULL;
-        int join_cond = 0;
-
-        // look for an index join condition
-        for (join_cond = 0; join_cond < q->nbJoins; ++join_cond) {
-            if (HASIDXCOL(q->joinFields1[join_cond], alias_name)
-                && subplans[0][0][0]->hasCol(q->joinFields2[join_cond])) {
-                left_join_col = q->joinFields2[join_cond];
-                right_join_col = q->joinFields1[join_cond];
-                break;
-            } else if (HASIDXCOL(q->joinFields2[join_cond], alias_name)
-                       && subplans[0][0][0]->hasCol(q->joinFields1[join_cond])) {
-                left_join_col = q->joinFields1[join_cond];
-                right_join_col = q->joinFields2[join_cond];
-                break;
+    uint32_t reached = set & -set;  // lowest table in the set
+    uint32_t frontier = reached;
+
+    while (frontier) {
+        uint32_t next = 0;
+        for (std::size_t i = 0; i < tables.size(); ++i) {
+            if (frontier & (1u << i)) {
+                next |= tables[i].neighbors;
             }
         }
+        frontier = next & set & ~reached;
+        reached |= frontier;
+    }
+
+    return reached == set;
+}
 
-        Plan right;
+// Return the sum of the costs of the cheapest replica of each partition.
+static double estPlanCost(const Plan &plan)
+{
+    double total_cost = 0.0;
 
-        if (left_join_col) {
-            // Nested Loop Index Join
-            buildIndexScans(q, table_name, alias_name, right_join_col, right);
-        } else {
-            // Nested Block Join
-            buildScans(q, table_name, alias_name, right);
+    for (std::size_t j = 0; j < plan.size(); ++j) {
+        double min_pp_cost = 0.0;
+        for (std::size_t jj = 0; jj < plan[j].size(); ++jj) {
+            double cost = plan[j][jj]->estCost();
+            if (jj == 0 || cost < min_pp_cost) {
+                min_pp_cost = cost;
+            }
         }
-        if (right.empty()) {
-            return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+        total_cost += min_pp_cost;
+    }
+
+    return total_cost;
+}
+
+// Add the given candidate to the set of candidates, keeping only the
+// cheapest one among those with the same partitioning, i.e., the same
+// partitions covered by each PartPlan on the same nodes.
+// The candidate is costed under the given cardinality corrections.
+static void addCandidate(Candidates &cands, PlanCandidate &cand,
+                         const ca::CardCorrections &corrections)
+{
+    std::vector<std::string> parts;
+    parts.reserve(cand.plan.size());
+    for (std::size_t j = 0; j < cand.plan.size(); ++j) {
+        std::string part(cand.covers[j]);
+        for (std::size_t jj = 0; jj < cand.plan[j].size(); ++jj) {
+            char buf[16];
+            std::snprintf(buf, sizeof(buf), "@%u",
+                          cand.plan[j][jj]->node_id());
+            part += buf;
         }
+        parts.push_back(part);
+    }
+    std::sort(parts.begin(), parts.end());
 
-        // no Union
-        for (std::size_t l = 0; l < subplans.size(); ++l) {
-            Plan &subplan = subplans[l];
-            Plan plan;
-
-            for (std::size_t k = 0; k < right.size(); ++k) {
-                for (std::size_t j = 0; j < subplan.size(); ++j) {
-                    PartPlan pp;
-
-                    // if both operands of the join condition are primary
-                    // keys and two partition ranges do not overlap, skip
-                    // this combination.
-                    if (left_join_col) {
-                        std::pair<const ca::PartStats *, ca::ColID> r
-                            = right[k][0]->getPartStats(
-                                  right[k][0]->getOutputColID(right_join_col));
-                        std::pair<const ca::PartStats *, ca::ColID> l
-                            = subplan[j][0]->getPartStats(
-                                  subplan[j][0]->getOutputColID(left_join_col));
-                        if (r.second == 0 && l.second == 0
-                            && NO_PKEY_OVERLAP(l.first, r.first)) {
-                            continue;
-                        }
-                    }
+    std::string key;
+    for (std::size_t j = 0; j < parts.size(); ++j) {
+        key += parts[j];
+        key += '|';
+    }
 
-                    for (std::size_t kk = 0; kk < right[k].size(); ++kk) {
-                        for (std::size_t jj = 0; jj < subplan[j].size(); ++jj) {
-                            ca::Operator::Ptr root = subplan[j][jj];
-                            if (root->node_id() != right[k][kk]->node_id()) {
-                                root = boost::make_shared<ca::Remote>(
-                                           right[k][kk]->node_id(), root,
-                                           g_addrs[root->node_id()]);
-                            }
-
-                            if (left_join_col) {
-                                pp.push_back(
-                                    boost::make_shared<ca::NLJoin>(
-                                        root->node_id(),
-                                        root, right[k][kk],
-                                        q, join_cond, left_join_col));
-                            } else {
-                                pp.push_back(
-                                    boost::make_shared<ca::NBJoin>(
-                                        root->node_id(),
-                                        root, right[k][kk], q));
-                            }
-                        }
-                    }
-                    plan.push_back(pp);
+    for (std::size_t j = 0; j < cand.plan.size(); ++j) {
+        for (std::size_t jj = 0; jj < cand.plan[j].size(); ++jj) {
+            cand.plan[j][jj]->setCardCorrections(corrections);
+        }
+    }
+    cand.cost = estPlanCost(cand.plan);
+
+    Candidates::iterator it = cands.find(key);
+    if (it == cands.end()) {
+        cands[key] = cand;
+    } else if (cand.cost < it->second.cost) {
+        it->second = cand;
+    }
+}
+
+// Return the covered partitions of a union or a join of two PartPlan's.
+static std::string mergeCovers(const std::string &a, const std::string &b)
+{
+    std::string covers(a);
+    for (std::size_t i = 0; i < covers.size(); ++i) {
+        if (b[i] == '1') {
+            covers[i] = '1';
+        }
+    }
+    return covers;
+}
+
+// Join algorithms considered by buildQueryPlanJoin().
+// JOIN_SEMI is a hash join that sends a Bloom filter to its left input.
+enum JoinMethod { JOIN_NL, JOIN_NB, JOIN_HASH, JOIN_MERGE, JOIN_SEMI };
+
+// Return a join of the given plans at the node of the left plan.
+// The join condition is used only by nested-loop index join and merge
+// join, and the join column only by nested-loop index join.
+// Returns NULL for merge join if the plans are not sorted.
+static ca::Operator::Ptr buildJoin(const Query *q,
+                                   ca::Operator::Ptr left,
+                                   ca::Operator::Ptr right,
+                                   const JoinMethod method,
+                                   const int join_cond,
+                                   const ca::ColName left_join_col)
+{
+    switch (method) {
+    case JOIN_NL:
+        return buildIndexJoin(
+                   left->node_id(), left, right,
+                   q, join_cond, left_join_col);
+    case JOIN_HASH:
+        return boost::make_shared<ca::HashJoin>(
+                   left->node_id(), left, right, q);
+    case JOIN_SEMI:
+        return boost::make_shared<ca::HashJoin>(
+                   left->node_id(), left, right, q, true);
+    case JOIN_MERGE:
+        if (!isMergeable(q, left, right, join_cond)) {
+            return ca::Operator::Ptr();
+        }
+        return boost::make_shared<ca::MergeJoin>(
+                   left->node_id(), left, right, q, join_cond);
+    default:
+        return boost::make_shared<ca::NBJoin>(
+                   left->node_id(), left, right, q);
+    }
+}
+
+// Extend the given candidate with a base table, adding "no Union",
+// "left Union" and "right Union" variants to the set of candidates.
+// For nested-loop index join and merge join, left_join_col and
+// right_join_col are the join columns.
+// If pkey_join_col is given, combinations of partitions whose primary
+// key ranges do not overlap on that join condition are skipped.
+// Variants whose inputs are not sorted for merge join are skipped.
+// For JOIN_SEMI, the right Union variant is skipped, and plain hash join
+// is used for co-located partitions since no transfer can be saved.
+// Returns false if no combination of partitions can produce results.
+// Called by buildQueryPlanJoin().
+static bool extendCandidate(const Query *q,
+                            const PlanCandidate &left,
+                            const Plan &right,
+                            const std::vector<std::string> &right_covers,
+                            const JoinMethod method,
+                            const int join_cond,
+                            const ca::ColName left_join_col,
+                            const ca::ColName pkey_join_col,
+                            const ca::ColName right_join_col,
+                            const ca::CardCorrections &corrections,
+                            Candidates &cands)
+{
+    const Plan &subplan = left.plan;
+
+    // pairs of partitions that may produce results
+    std::vector<std::vector<bool> > overlap(
+        right.size(), std::vector<bool>(subplan.size(), true));
+    if (pkey_join_col) {
+        for (std::size_t k = 0; k < right.size(); ++k) {
+            std::pair<const ca::PartStats *, ca::ColID> r
+                = right[k][0]->getPartStats(
+                      right[k][0]->getOutputColID(right_join_col));
+            for (std::size_t j = 0; j < subplan.size(); ++j) {
+                std::pair<const ca::PartStats *, ca::ColID> l
+                    = subplan[j][0]->getPartStats(
+                          subplan[j][0]->getOutputColID(pkey_join_col));
+                if (r.second == 0 && l.second == 0
+                    && NO_PKEY_OVERLAP(l.first, r.first)) {
+                    overlap[k][j] = false;
                 }
             }
+        }
+    }
 
-            if (plan.empty()) {
-                return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
-            }
-            plans.push_back(plan);
-        }
-
-        // left Union
-        for (std::size_t l = 0; l < subplans.size(); ++l) {
-            Plan &subplan = subplans[l];
-            Plan plan;
-
-            for (std::size_t k = 0; k < right.size(); ++k) {
-                Plan left;
-
-                for (std::size_t j = 0; j < subplan.size(); ++j) {
-                    // if both operands of the join condition are primary
-                    // keys and two partition ranges do not overlap, skip
-                    // this combination.
-                    if (left_join_col) {
-                        std::pair<const ca::PartStats *, ca::ColID> r
-                            = right[k][0]->getPartStats(
-                                  right[k][0]->getOutputColID(right_join_col));
-                        std::pair<const ca::PartStats *, ca::ColID> l
-                            = subplan[j][0]->getPartStats(
-                                  subplan[j][0]->getOutputColID(left_join_col));
-                        if (r.second == 0 && l.second == 0
-                            && NO_PKEY_OVERLAP(l.first, r.first)) {
-                            continue;
-                        }
-                    }
-                    left.push_back(subplan[j]);
-                }
+    // no Union
+    {
+        PlanCandidate cand;
+        bool valid = true;
 
-                if (left.empty()) {
+        for (std::size_t k = 0; k < right.size(); ++k) {
+            for (std::size_t j = 0; j < subplan.size(); ++j) {
+                if (!overlap[k][j]) {
                     continue;
                 }
 
                 PartPlan pp;
                 for (std::size_t kk = 0; kk < right[k].size(); ++kk) {
-                    ca::Operator::Ptr root(
-                        buildUnion(right[k][kk]->node_id(), left));
-
-                    if (left_join_col) {
-                        pp.push_back(
-                            boost::make_shared<ca::NLJoin>(
-                                root->node_id(),
-                                root, right[k][kk],
-                                q, join_cond, left_join_col));
-                    } else {
-                        pp.push_back(
-                            boost::make_shared<ca::NBJoin>(
-                                root->node_id(),
-                                root, right[k][kk], q));
+                    for (std::size_t jj = 0; jj < subplan[j].size(); ++jj) {
+                        ca::Operator::Ptr root = subplan[j][jj];
+                        JoinMethod m = method;
+                        if (root->node_id() != right[k][kk]->node_id()) {
+                            root = boost::make_shared<ca::Remote>(
+                                       right[k][kk]->node_id(), root,
+                                       g_addrs[root->node_id()]);
+                        } else if (m == JOIN_SEMI) {
+                            m = JOIN_HASH;
+                        }
+                        pp.push_back(buildJoin(q, root, right[k][kk], m,
+                                               join_cond, left_join_col));
+                        valid = valid && pp.back().get();
                     }
                 }
-                plan.push_back(pp);
+                cand.plan.push_back(pp);
+                cand.covers.push_back(
+                    mergeCovers(left.covers[j], right_covers[k]));
             }
+        }
 
-            if (plan.empty()) {
-                return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
-            }
-            plans.push_back(plan);
+        if (cand.plan.empty()) {
+            return false;
+        }
+        if (valid) {
+            addCandidate(cands, cand, corrections);
         }
+    }
+
+    // left Union
+    if (subplan.size() > 1) {
+        PlanCandidate cand;
+        bool valid = true;
 
-        // right Union
-        for (std::size_t l = 0; l < subplans.size(); ++l) {
-            Plan &subplan = subplans[l];
-            Plan plan;
+        for (std::size_t k = 0; k < right.size(); ++k) {
+            Plan union_plan;
+            std::string covers(right_covers[k]);
 
             for (std::size_t j = 0; j < subplan.size(); ++j) {
-                PartPlan pp;
-                for (std::size_t jj = 0; jj < subplan[j].size(); ++jj) {
-                    ca::Operator::Ptr root(
-                        buildUnion(subplan[j][jj]->node_id(), right,
-                                   right_join_col));
-
-                    if (left_join_col) {
-                        pp.push_back(
-                            boost::make_shared<ca::NLJoin>(
-                                subplan[j][jj]->node_id(),
-                                subplan[j][jj], root,
-                                q, join_cond, left_join_col));
-                    } else {
-                        pp.push_back(
-                            boost::make_shared<ca::NBJoin>(
-                                subplan[j][jj]->node_id(),
-                                subplan[j][jj], root, q));
+                if (overlap[k][j]) {
+                    union_plan.push_back(subplan[j]);
+                    covers = mergeCovers(covers, left.covers[j]);
+                }
+            }
+
+            if (union_plan.empty()) {
+                continue;
+            }
+
+            PartPlan pp;
+            for (std::size_t kk = 0; kk < right[k].size(); ++kk) {
+                ca::Operator::Ptr root(
+                    buildUnion(right[k][kk]->node_id(), union_plan,
+                               (method == JOIN_MERGE) ? left_join_col : NULL,
+                               method == JOIN_MERGE));
+                pp.push_back(buildJoin(q, root, right[k][kk],
+                                       method, join_cond, left_join_col));
+                valid = valid && pp.back().get();
+            }
+            cand.plan.push_back(pp);
+            cand.covers.push_back(covers);
+        }
+
+        if (valid) {
+            addCandidate(cands, cand, corrections);
+        }
+    }
+
+    // right Union
+    if (right.size() > 1 && method != JOIN_SEMI) {
+        PlanCandidate cand;
+        bool valid = true;
+
+        std::string covers(right_covers[0]);
+        for (std::size_t k = 1; k < right.size(); ++k) {
+            covers = mergeCovers(covers, right_covers[k]);
+        }
+
+        for (std::size_t j = 0; j < subplan.size(); ++j) {
+            PartPlan pp;
+            for (std::size_t jj = 0; jj < subplan[j].size(); ++jj) {
+                ca::Operator::Ptr root(
+                    buildUnion(subplan[j][jj]->node_id(), right,
+                               (method == JOIN_NL || method == JOIN_MERGE)
+                               ? right_join_col : NULL,
+                               method == JOIN_MERGE));
+                pp.push_back(buildJoin(q, subplan[j][jj], root,
+                                       method, join_cond, left_join_col));
+                valid = valid && pp.back().get();
+            }
+            cand.plan.push_back(pp);
+            cand.covers.push_back(mergeCovers(left.covers[j], covers));
+        }
+
+        if (valid) {
+            addCandidate(cands, cand, corrections);
+        }
+    }
+
+    return true;
+}
+
+// Return the best query plan for executing the given query under the
+// given cardinality corrections.
+// Left-deep plans are enumerated by dynamic programming over connected
+// sets of tables in the join graph (DPsub). For each set of tables, the
+// cheapest candidate is memoized for each partitioning (see
+// addCandidate()), and candidates for larger sets are built by joining
+// them with a base table that shares a join condition.
+// Cross products are considered only if the join graph is not connected.
+static ca::Operator::Ptr
+buildQueryPlanJoin(const Query *q, const ca::CardCorrections &corrections)
+{
+    if (q->nbTable > MAX_DP_TABLES) {
+        throw std::runtime_error("too many tables");
+    }
+
+    const uint32_t all_tables = (1u << q->nbTable) - 1;
+
+    // base tables
+    std::vector<BaseTable> tables(q->nbTable);
+    std::size_t cover_size = 0;
+    for (int i = 0; i < q->nbTable; ++i) {
+        tables[i].table_name = q->tableNames[i];
+        tables[i].alias_name = q->aliasNames[i];
+        tables[i].cover_offset = cover_size;
+        tables[i].neighbors = 0;
+
+        std::vector<ca::PartStats *>::const_iterator begin;
+        std::vector<ca::PartStats *>::const_iterator end;
+        findPartStats(q, tables[i].table_name, tables[i].alias_name,
+                      begin, end);
+        if (begin == end) {
+            // no partition contains this key
+            return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+        }
+        tables[i].first_part = begin - g_stats[tables[i].table_name].begin();
+        cover_size += g_stats[tables[i].table_name].size();
+
+        buildScans(q, tables[i].table_name, tables[i].alias_name,
+                   tables[i].scans[-1]);
+    }
+
+    // join graph
+    for (int k = 0; k < q->nbJoins; ++k) {
+        int a = findTable(q, q->joinFields1[k]);
+        int b = findTable(q, q->joinFields2[k]);
+        if (a >= 0 && b >= 0 && a != b) {
+            tables[a].neighbors |= 1u << b;
+            tables[b].neighbors |= 1u << a;
+        }
+    }
+    bool connected = isConnected(tables, all_tables);
+
+    // covered partitions of each PartPlan of base tables
+    std::vector<std::vector<std::string> > base_covers(q->nbTable);
+    for (int i = 0; i < q->nbTable; ++i) {
+        for (std::size_t k = 0; k < tables[i].scans[-1].size(); ++k) {
+            std::string covers(cover_size, '0');
+            covers[tables[i].cover_offset + tables[i].first_part + k] = '1';
+            base_covers[i].push_back(covers);
+        }
+    }
+
+    // candidates for each set of tables
+    std::vector<Candidates> best(all_tables + 1);
+    for (int i = 0; i < q->nbTable; ++i) {
+        PlanCandidate cand;
+        cand.plan = tables[i].scans[-1];
+        cand.covers = base_covers[i];
+        addCandidate(best[1u << i], cand, corrections);
+    }
+
+    // sets of tables are visited after all their subsets
+    for (uint32_t set = 1; set <= all_tables; ++set) {
+        if (!(set & (set - 1))) {  // single table
+            continue;
+        }
+        if (connected && !isConnected(tables, set)) {
+            continue;
+        }
+
+        for (int i = 0; i < q->nbTable; ++i) {
+            uint32_t subset = set & ~(1u << i);
+            if (subset == set || best[subset].empty()) {
+                continue;
+            }
+            if (connected && !(tables[i].neighbors & subset)) {
+                continue;
+            }
+
+            const char *alias_name = tables[i].alias_name;
+            const PlanCandidate &any = best[subset].begin()->second;
+
+            ca::ColName left_join_col = NULL;
+            ca::ColName right_join_col = NULL;
+            int join_cond = 0;
+
+            // look for an index join condition
+            for (join_cond = 0; join_cond < q->nbJoins; ++join_cond) {
+                if (HASIDXCOL(q->joinFields1[join_cond], alias_name,
+                              tables[i].table_name)
+                    && any.plan[0][0]->hasCol(q->joinFields2[join_cond])) {
+                    left_join_col = q->joinFields2[join_cond];
+                    right_join_col = q->joinFields1[join_cond];
+                    break;
+                } else if (HASIDXCOL(q->joinFields2[join_cond], alias_name,
+                                     tables[i].table_name)
+                           && any.plan[0][0]->hasCol(
+                                  q->joinFields1[join_cond])) {
+                    left_join_col = q->joinFields1[join_cond];
+                    right_join_col = q->joinFields2[join_cond];
+                    break;
+                }
+            }
+
+            if (left_join_col
+                && tables[i].scans.find(join_cond) == tables[i].scans.end()) {
+                buildIndexScans(q, tables[i].table_name, alias_name,
+                                right_join_col, tables[i].scans[join_cond]);
+            }
+
+            for (Candidates::const_iterator it = best[subset].begin();
+                 it != best[subset].end(); ++it) {
+                // Nested Loop Index Join
+                if (left_join_col
+                    && !extendCandidate(q, it->second,
+                                        tables[i].scans[join_cond],
+                                        base_covers[i],
+                                        JOIN_NL, join_cond, left_join_col,
+                                        left_join_col, right_join_col,
+                                        corrections, best[set])) {
+                    return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+                }
+
+                // Nested Block Join
+                if (!extendCandidate(q, it->second,
+                                     tables[i].scans[-1],
+                                     base_covers[i],
+                                     JOIN_NB, 0, NULL,
+                                     left_join_col, right_join_col,
+                                     corrections, best[set])) {
+                    return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+                }
+
+                // Merge Join
+                int merge_cond = findMergeCond(q, it->second.plan[0][0],
+                                               tables[i].scans[-1][0][0]);
+                if (merge_cond >= 0) {
+                    ca::ColName left_col = q->joinFields1[merge_cond];
+                    ca::ColName right_col = q->joinFields2[merge_cond];
+                    if (!tables[i].scans[-1][0][0]->hasCol(right_col)) {
+                        std::swap(left_col, right_col);
                     }
+                    if (!extendCandidate(q, it->second,
+                                         tables[i].scans[-1],
+                                         base_covers[i],
+                                         JOIN_MERGE, merge_cond, left_col,
+                                         left_col, right_col,
+                                         corrections, best[set])) {
+                        return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+                    }
+                }
+
+                // Hash Join
+                if ((tables[i].neighbors & subset)
+                    && !extendCandidate(q, it->second,
+                                        tables[i].scans[-1],
+                                        base_covers[i],
+                                        JOIN_HASH, 0, NULL,
+                                        left_join_col, right_join_col,
+                                        corrections, best[set])) {
+                    return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
+                }
+
+                // Hash Join with a Bloom filter sent to the left input
+                if ((tables[i].neighbors & subset)
+                    && !extendCandidate(q, it->second,
+                                        tables[i].scans[-1],
+                                        base_covers[i],
+                                        JOIN_SEMI, 0, NULL,
+                                        left_join_col, right_join_col,
+                                        corrections, best[set])) {
+                    return boost::make_shared<ca::Dummy>(MASTER_NODE_ID);
                 }
-                plan.push_back(pp);
             }
-            plans.push_back(plan);
         }
     }
 
     ca::Operator::Ptr best_plan;
     double min_cost = 0.0;
 
-    for (std::size_t l = 0; l < plans.size(); ++l) {
-        ca::Operator::Ptr root(
-            buildUnion(MASTER_NODE_ID, plans[l]));
+    for (Candidates::iterator it = best[all_tables].begin();
+         it != best[all_tables].end(); ++it) {
+        Plan &plan = it->second.plan;
+        for (std::size_t j = 0; j < plan.size(); ++j) {
+            for (std::size_t jj = 0; jj < plan[j].size(); ++jj) {
+                plan[j][jj] = parallelize(plan[j][jj]);
+            }
+        }
+
+        ca::Operator::Ptr root(buildUnion(MASTER_NODE_ID, plan));
 
         double cost = root->estCost();
-        if (l == 0 || cost < min_cost) {
+        if (!best_plan.get() || cost < min_cost) {
             min_cost = cost;
             best_plan = root;
         }
@@ -827,49 +1180,387 @@ buildQueryPlanJoin(const Query *q, const std::vector<int> &table_order)
     return best_plan->clone();
 }
 
-// Return the best query plan for executing the given query.
-// Called by performQuery().
-static ca::Operator::Ptr buildQueryPlan(const Query *q)
+// Return the best query plan for executing the given query under the
+// given cardinality corrections.
+// Called by getQueryPlan() and learnCardinalities().
+static ca::Operator::Ptr
+buildQueryPlan(const Query *q, const ca::CardCorrections &corrections)
+{
+    ca::Operator::Ptr root;
+
+    // A single partition selected by the primary key is read by an
+    // IndexScan, unless the table has only that partition, in which case
+    // the scans are costed like those of joins.
+    if (q->nbTable == 1
+        && g_tables[std::string(q->tableNames[0])]->nbPartitions != 1) {
+        root = buildQueryPlanScan(q);
+    }
+    if (!root.get()) {
+        root = buildQueryPlanJoin(q, corrections);
+    }
+
+    return root;
+}
+
+// For string values, set intVal as length.
+static void setValueLengths(const Query *q)
+{
+    for (int j = 0; j < q->nbRestrictionsEqual; ++j) {
+        Value *v = &q->restrictionEqualValues[j];
+        if (v->type == STRING) {
+            v->intVal = std::strlen(v->charVal);
+        }
+    }
+    for (int j = 0; j < q->nbRestrictionsGreaterThan; ++j) {
+        Value *v = &q->restrictionGreaterThanValues[j];
+        if (v->type == STRING) {
+            v->intVal = std::strlen(v->charVal);
+        }
+    }
+}
+
+// Returns the class of the estimated selectivity of a restriction: the
+// binary exponent of its average over the partitions selected by
+// findPartStats(). Without histograms, the estimate does not depend on
+// the constant, and 1 is returned as for a selectivity of 1.
+static int estSelectivityClass(const Query *q, const ca::ColName col,
+                               const Value *value, const bool greater)
+{
+    const Table *table = NULL;
+    int c = findColumn(q, col, table);
+    if (c < 0) {
+        return 1;
+    }
+    int a = findTable(q, col);
+    std::string table_name(q->tableNames[a]);
+
+    std::vector<ca::PartStats *>::const_iterator it;
+    std::vector<ca::PartStats *>::const_iterator end;
+    findPartStats(q, table_name, q->aliasNames[a], it, end);
+
+    double sel = 0.0;
+    int num_parts = 0;
+    for (; it != end; ++it) {
+        if ((*it)->hasHistogram(c)) {
+            sel += greater ? (*it)->estSelectivityGt(c, value)
+                           : (*it)->estSelectivityEq(c, value);
+            ++num_parts;
+        }
+    }
+    if (num_parts == 0) {
+        return 1;
+    }
+
+    int exp;
+    std::frexp(sel / num_parts, &exp);
+    return exp;
+}
+
+// Return a key identifying the shape of the given query: tables, aliases,
+// output columns, predicate columns and operators. Partitions selected
+// by conditions on the primary key are also included for every table
+// because the plan depends on them, e.g., it is a Dummy if a table has
+// no partition containing the key, even if the table is not partitioned.
+// So is the selectivity class of each restriction, as access paths are
+// chosen by the estimated selectivities of the constants.
+// Queries with the same key differ only in their constants.
+static std::string buildPlanKey(const Query *q)
 {
-    bool partitioned = false;
+    std::string key;
+
     for (int i = 0; i < q->nbTable; ++i) {
-        if (g_tables[std::string(q->tableNames[i])]->nbPartitions != 1) {
-            partitioned = true;
-            break;
+        key += q->tableNames[i];
+        key += ' ';
+        key += q->aliasNames[i];
+        key += ',';
+    }
+    key += '|';
+    for (int i = 0; i < q->nbOutputFields; ++i) {
+        key += q->outputFields[i];
+        key += ',';
+    }
+    key += '|';
+    for (int i = 0; i < q->nbRestrictionsEqual; ++i) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "=%d,",
+                      estSelectivityClass(q, q->restrictionEqualFields[i],
+                                          &q->restrictionEqualValues[i],
+                                          false));
+        key += q->restrictionEqualFields[i];
+        key += buf;
+    }
+    for (int i = 0; i < q->nbRestrictionsGreaterThan; ++i) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), ">%d,",
+                      estSelectivityClass(
+                          q, q->restrictionGreaterThanFields[i],
+                          &q->restrictionGreaterThanValues[i], true));
+        key += q->restrictionGreaterThanFields[i];
+        key += buf;
+    }
+    for (int i = 0; i < q->nbJoins; ++i) {
+        key += q->joinFields1[i];
+        key += '=';
+        key += q->joinFields2[i];
+        key += ',';
+    }
+    key += '|';
+
+    for (int i = 0; i < q->nbTable; ++i) {
+        std::string table_name(q->tableNames[i]);
+        std::vector<ca::PartStats *>::const_iterator it;
+        std::vector<ca::PartStats *>::const_iterator end;
+        findPartStats(q, table_name, q->aliasNames[i], it, end);
+
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%d-%d,",
+                      static_cast<int>(it - g_stats[table_name].begin()),
+                      static_cast<int>(end - g_stats[table_name].begin()));
+        key += buf;
+    }
+
+    return key;
+}
+
+// Return a query plan for executing the given query.
+// Reuse a cached plan template if a query of the same shape has been
+// planned before, and rebind the constants of the given query into it.
+// Called by performQuery() and startPreTreatmentMaster().
+static ca::Operator::Ptr getQueryPlan(const Query *q)
+{
+    std::string key(buildPlanKey(q));
+    PlanTemplate *tmpl = NULL;
+
+    g_plans_mutex.lock();
+    std::map<std::string, PlanTemplate *>::const_iterator it
+        = g_plans.find(key);
+    if (it != g_plans.end()) {
+        tmpl = it->second;
+    }
+    g_plans_mutex.unlock();
+
+    if (tmpl == NULL) {
+        PlanTemplate *new_tmpl = new PlanTemplate();
+        new_tmpl->root = buildQueryPlan(q, new_tmpl->planned);
+
+        // take over the constants of the given query
+        new_tmpl->eq_values.assign(
+            q->restrictionEqualValues,
+            q->restrictionEqualValues + q->nbRestrictionsEqual);
+        new_tmpl->gt_values.assign(
+            q->restrictionGreaterThanValues,
+            q->restrictionGreaterThanValues + q->nbRestrictionsGreaterThan);
+        new_tmpl->query.nbRestrictionsEqual = q->nbRestrictionsEqual;
+        new_tmpl->query.restrictionEqualValues
+            = new_tmpl->eq_values.empty() ? NULL : &new_tmpl->eq_values[0];
+        new_tmpl->query.nbRestrictionsGreaterThan
+            = q->nbRestrictionsGreaterThan;
+        new_tmpl->query.restrictionGreaterThanValues
+            = new_tmpl->gt_values.empty() ? NULL : &new_tmpl->gt_values[0];
+        new_tmpl->root->rebind(q, &new_tmpl->query);
+
+        g_plans_mutex.lock();
+        std::pair<std::map<std::string, PlanTemplate *>::iterator, bool> x
+            = g_plans.insert(std::make_pair(key, new_tmpl));
+        tmpl = x.first->second;
+        g_plans_mutex.unlock();
+
+        if (!x.second) {  // planned by another thread in the meantime
+            delete new_tmpl;
         }
     }
 
-    ca::Operator::Ptr root;
+    // the template root may be replaced by learnCardinalities()
+    g_plans_mutex.lock();
+    ca::Operator::Ptr tmpl_root(tmpl->root);
+    g_plans_mutex.unlock();
 
-    if (!partitioned) {
-        root = buildQueryPlanNoPartition(q);
-    } else {
-        if (q->nbTable == 1) {
-            root = buildQueryPlanScan(q);
+    ca::Operator::Ptr root(tmpl_root->clone());
+    root->rebind(&tmpl->query, q);
+
+    return root;
+}
+
+// Update the cardinality corrections of the plan template of the given
+// query with the actual cardinalities of its executed plan, and rebuild
+// the template if they drift from those it was built with.
+// The correction for a table set moves toward the ratio of the actual
+// cardinality to the estimate, in log space. Operators that did not
+// return all of their results, e.g., the inner plan of a nested-loop
+// join, are skipped.
+// Called by fetchRow() before the plan is closed.
+static void learnCardinalities(const Query *q, ca::Operator::Ptr root)
+{
+    std::vector<ca::CardEstimate> estimates;
+    std::vector<ca::CardCount> counts;
+    root->getCardEstimates(estimates);
+    root->getCardCounts(counts);
+    if (estimates.size() != counts.size()) {
+        return;
+    }
+
+    // table set to the estimated and actual cardinalities
+    std::map<std::string, std::pair<double, double> > cards;
+    for (std::size_t i = 0; i < estimates.size(); ++i) {
+        if (counts[i].complete && !estimates[i].first.empty()) {
+            std::pair<double, double> &card = cards[estimates[i].first];
+            card.first += estimates[i].second;
+            card.second += counts[i].num_tuples;
         }
-        if (!root.get()) {
-            std::vector<int> join_order;
-            for (int i = 0; i < q->nbTable; ++i) {
-                join_order.push_back(i);
+    }
+    if (cards.empty()) {
+        return;
+    }
+
+    std::string key(buildPlanKey(q));
+    PlanTemplate *tmpl = NULL;
+    ca::CardCorrections corrections;
+
+    g_plans_mutex.lock();
+    std::map<std::string, PlanTemplate *>::const_iterator it
+        = g_plans.find(key);
+    if (it != g_plans.end()) {
+        tmpl = it->second;
+
+        bool drifted = false;
+        std::map<std::string, std::pair<double, double> >::const_iterator
+            card_it;
+        for (card_it = cards.begin(); card_it != cards.end(); ++card_it) {
+            double ratio = (card_it->second.second + 1.0)
+                           / (card_it->second.first + 1.0);
+            ca::CardCorrections::iterator corr_it
+                = tmpl->corrections.insert(
+                      std::make_pair(card_it->first, 1.0)).first;
+            double factor = std::pow(corr_it->second,
+                                     1.0 - CARD_FEEDBACK_WEIGHT)
+                            * std::pow(ratio, CARD_FEEDBACK_WEIGHT);
+            if (factor > CARD_CORRECTION_MAX) {
+                factor = CARD_CORRECTION_MAX;
+            } else if (factor < 1.0 / CARD_CORRECTION_MAX) {
+                factor = 1.0 / CARD_CORRECTION_MAX;
             }
+            corr_it->second = factor;
+
+            ca::CardCorrections::const_iterator planned_it
+                = tmpl->planned.find(card_it->first);
+            double planned = (planned_it != tmpl->planned.end())
+                             ? planned_it->second : 1.0;
+            if (factor > planned * CARD_REPLAN_RATIO
+                || factor * CARD_REPLAN_RATIO < planned) {
+                drifted = true;
+            }
+        }
 
-            double cost = 0.0;
-            do {
-                ca::Operator::Ptr new_root(buildQueryPlanJoin(q, join_order));
-                double new_cost = new_root->estCost();
-                if (!root.get() || cost > new_cost) {
-                    root = new_root;
-                    cost = new_cost;
-                }
-            } while (std::next_permutation(join_order.begin(),
-                                           join_order.end()));
+        if (drifted && tmpl->num_replans < MAX_REPLANS) {
+            ++tmpl->num_replans;
+            corrections = tmpl->corrections;
+        } else {
+            tmpl = NULL;
         }
     }
+    g_plans_mutex.unlock();
 
-    return root;
+    if (tmpl == NULL) {
+        return;
+    }
+
+    ca::Operator::Ptr new_root(buildQueryPlan(q, corrections));
+    new_root->rebind(q, &tmpl->query);
+
+    g_plans_mutex.lock();
+    tmpl->root = new_root;
+    tmpl->planned = corrections;
+    g_plans_mutex.unlock();
+}
+
+// Return a key identifying the given query with its constants.
+static std::string buildResultKey(const Query *q)
+{
+    std::string key(buildPlanKey(q));
+
+    for (int i = 0; i < q->nbRestrictionsEqual; ++i) {
+        const Value *v = &q->restrictionEqualValues[i];
+        key += '|';
+        key.append(reinterpret_cast<const char *>(&v->intVal),
+                   sizeof(v->intVal));
+        if (v->type == STRING) {
+            key.append(v->charVal, v->intVal);
+        }
+    }
+    for (int i = 0; i < q->nbRestrictionsGreaterThan; ++i) {
+        const Value *v = &q->restrictionGreaterThanValues[i];
+        key += '|';
+        key.append(reinterpret_cast<const char *>(&v->intVal),
+                   sizeof(v->intVal));
+        if (v->type == STRING) {
+            key.append(v->charVal, v->intVal);
+        }
+    }
+
+    return key;
+}
+
+// Returns the cached result of the given query key if any.
+static boost::shared_ptr<const CachedResult>
+findResult(const std::string &key)
+{
+    boost::mutex::scoped_lock lock(g_results_mutex);
+    std::map<std::string, boost::shared_ptr<const CachedResult> >::iterator it
+        = g_results.find(key);
+    if (it == g_results.end()) {
+        return boost::shared_ptr<const CachedResult>();
+    }
+    return it->second;
+}
+
+// Cache the result of a query if its execution time pays for its size.
+// When the cache is full, results that saved less execution time per
+// byte are evicted first, but only in favor of a result saving more and
+// only if they free enough space for it.
+static void admitResult(const std::string &key,
+                        boost::shared_ptr<CachedResult> result)
+{
+    std::size_t size = key.size() + result->rows.size();
+    double density = result->cost / size;
+    if (result->cost * RESULT_BYTES_PER_USEC < size
+        || size > RESULT_MAX_SIZE) {
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(g_results_mutex);
+    if (g_results.find(key) != g_results.end()) {
+        return;
+    }
+
+    // find enough victims of lower density before evicting any
+    std::set<std::pair<double, std::string> >::iterator victims_end
+        = g_results_by_density.begin();
+    std::size_t freed = 0;
+    while (g_results_size - freed + size > RESULT_CACHE_SIZE) {
+        if (victims_end == g_results_by_density.end()
+            || victims_end->first >= density) {
+            return;
+        }
+        freed += victims_end->second.size()
+                 + g_results[victims_end->second]->rows.size();
+        ++victims_end;
+    }
+
+    std::set<std::pair<double, std::string> >::iterator it;
+    for (it = g_results_by_density.begin(); it != victims_end; ++it) {
+        g_results.erase(it->second);
+    }
+    g_results_by_density.erase(g_results_by_density.begin(), victims_end);
+    g_results_size -= freed;
+
+    g_results.insert(std::make_pair(key, result));
+    g_results_by_density.insert(std::make_pair(density, key));
+    g_results_size += size;
 }
 
 // Connect to a slave node and gather partition statistics.
+// The slave also builds column stores and column indexes for its
+// partitions.
 // Executed on the master node.
 static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
 {
@@ -898,6 +1589,17 @@ static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
                 continue;
             }
 
+            const std::vector<uint32_t> &preset_cols
+                = g_preset_cols[std::string(data->tables[i].tableName)];
+            const std::vector<bool> &index_cols
+                = g_preset_index_cols[std::string(data->tables[i].tableName)];
+
+            // remaining time for building a column store in milliseconds
+            boost::posix_time::time_duration remaining
+                = g_store_deadline - boost::get_system_time();
+            uint32_t budget = remaining.is_negative()
+                              ? 0 : remaining.total_milliseconds();
+
             // compute a request body size
             uint32_t size = 0;
             int len;
@@ -905,16 +1607,20 @@ static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
             size += CodedOutputStream::VarintSize32(len) + len;
             len = std::strlen(data->tables[i].partitions[j].fileName);
             size += CodedOutputStream::VarintSize32(len) + len;
-            size += 1;  // fieldsType[0]
             size += CodedOutputStream::VarintSize32(data->tables[i].nbFields);
             for (int k = 0; k < data->tables[i].nbFields; ++k) {
-                if (data->tables[i].fieldsName[k][0] == '_') {
+                if (data->tables[i].fieldsName[k][0] == '_'
+                    || index_cols[k]) {
                     len = std::strlen(data->tables[i].fieldsName[k]);
                 } else {
                     len = 0;
                 }
                 size += CodedOutputStream::VarintSize32(len) + len;
+                size += 1;  // fieldsType[k]
+                size += CodedOutputStream::VarintSize32(
+                            preset_cols[k]);
             }
+            size += CodedOutputStream::VarintSize32(budget);
 
             // send a request
             uint8_t *target = boost::asio::buffer_cast<uint8_t *>(
@@ -932,12 +1638,11 @@ static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
                          len, target);
             target = CodedOutputStream::WriteRawToArray(
                          data->tables[i].partitions[j].fileName, len, target);
-            target = CodedOutputStream::WriteVarint32ToArray(
-                         data->tables[i].fieldsType[0], target);
             target = CodedOutputStream::WriteVarint32ToArray(
                          data->tables[i].nbFields, target);
             for (int k = 0; k < data->tables[i].nbFields; ++k) {
-                if (data->tables[i].fieldsName[k][0] == '_') {
+                if (data->tables[i].fieldsName[k][0] == '_'
+                    || index_cols[k]) {
                     len = std::strlen(data->tables[i].fieldsName[k]);
                     target = CodedOutputStream::WriteVarint32ToArray(
                                  len, target);
@@ -948,7 +1653,12 @@ static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
                     target = CodedOutputStream::WriteVarint32ToArray(
                                  len, target);
                 }
+                target = CodedOutputStream::WriteVarint32ToArray(
+                             data->tables[i].fieldsType[k], target);
+                target = CodedOutputStream::WriteVarint32ToArray(
+                             preset_cols[k], target);
             }
+            target = CodedOutputStream::WriteVarint32ToArray(budget, target);
 
             buf.commit(size + 4);
 
@@ -987,10 +1697,330 @@ static void startPreTreatmentSlave(const ca::NodeID n, const Data *data)
     ca::IOManager::instance()->closeSocket(n, socket);
 }
 
-// Gather all partition statistics and find replicas.
+// Find the table and the column of the given field of a preset query.
+// Returns NULL if not found.
+// Called by countPresetRestrictions().
+static const Table *findPresetColumn(const Data *data, const Query *q,
+                                     const char *field, int &col)
+{
+    const char *dot = std::strchr(field, '.');
+    if (dot == NULL) {
+        return NULL;
+    }
+
+    for (int a = 0; a < q->nbTable; ++a) {
+        if (std::strlen(q->aliasNames[a]) != dot - field
+            || std::memcmp(q->aliasNames[a], field, dot - field)) {
+            continue;
+        }
+
+        for (int t = 0; t < data->nbTables; ++t) {
+            if (std::strcmp(data->tables[t].tableName, q->tableNames[a])) {
+                continue;
+            }
+            for (col = 0; col < data->tables[t].nbFields; ++col) {
+                if (!std::strcmp(data->tables[t].fieldsName[col], dot + 1)) {
+                    return &data->tables[t];
+                }
+            }
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+// Count restrictions on each column in the preset queries, and mark the
+// columns without indexes that are restricted or joined.
+// Called by startPreTreatmentMaster().
+static void countPresetRestrictions(const Data *data, const Queries *preset)
+{
+    for (int i = 0; i < data->nbTables; ++i) {
+        g_preset_cols[std::string(data->tables[i].tableName)].resize(
+            data->tables[i].nbFields);
+        g_preset_index_cols[std::string(data->tables[i].tableName)].resize(
+            data->tables[i].nbFields);
+    }
+
+    for (int i = 0; i < preset->nbQueries; ++i) {
+        const Query *q = &preset->queries[i];
+        std::vector<const char *> fields(
+            q->restrictionEqualFields,
+            q->restrictionEqualFields + q->nbRestrictionsEqual);
+        fields.insert(fields.end(),
+                      q->restrictionGreaterThanFields,
+                      q->restrictionGreaterThanFields
+                      + q->nbRestrictionsGreaterThan);
+        std::size_t num_restrictions = fields.size();
+        fields.insert(fields.end(),
+                      q->joinFields1, q->joinFields1 + q->nbJoins);
+        fields.insert(fields.end(),
+                      q->joinFields2, q->joinFields2 + q->nbJoins);
+
+        for (std::size_t k = 0; k < fields.size(); ++k) {
+            int c;
+            const Table *table = findPresetColumn(data, q, fields[k], c);
+            if (table == NULL) {
+                continue;
+            }
+
+            std::string table_name(table->tableName);
+            if (k < num_restrictions) {
+                ++g_preset_cols[table_name][c];
+            }
+            if (table->fieldsName[c][0] != '_') {
+                g_preset_index_cols[table_name][c] = true;
+            }
+        }
+    }
+}
+
+// Rank a pretreatment task with a higher benefit per page first, and a
+// cheaper one first among equals.
+static bool morePreTaskBenefit(const PreTask &a, const PreTask &b)
+{
+    double a_ratio = a.benefit * b.cost;
+    double b_ratio = b.benefit * a.cost;
+    if (a_ratio != b_ratio) {
+        return a_ratio > b_ratio;
+    }
+    return a.cost < b.cost;
+}
+
+// List pretreatment tasks for the tables used by the preset queries:
+// warming up all their partitions, each weighted by the number of preset
+// queries using the table, and mirroring their secondary indexes, each
+// weighted by the number of restrictions on the column in addition.
+// For each join condition of the preset queries with an indexed column,
+// join indexes are built from every partition of the other table to the
+// partitions of the indexed table on the same node, each weighted by the
+// number of preset queries using the join condition, unless the other
+// partition has too many rows for JoinIndex::build() to sort in memory.
+// Called by startPreTreatmentMaster() after replicas are chained.
+static void collectPreTasks(const Queries *preset,
+                            std::vector<PreTask> &tasks)
+{
+    typedef std::pair<const Table *, int> TableCol;
+    std::map<std::string, uint32_t> num_uses;
+    std::map<std::pair<TableCol, TableCol>, uint32_t> num_joins;
+    for (int i = 0; i < preset->nbQueries; ++i) {
+        const Query *q = &preset->queries[i];
+        for (int a = 0; a < q->nbTable; ++a) {
+            ++num_uses[std::string(q->tableNames[a])];
+        }
+
+        // the right column is the indexed one
+        for (int k = 0; k < q->nbJoins; ++k) {
+            for (int side = 0; side < 2; ++side) {
+                const Table *left = NULL;
+                const Table *right = NULL;
+                int left_col = findColumn(
+                    q, side ? q->joinFields2[k] : q->joinFields1[k], left);
+                int right_col = findColumn(
+                    q, side ? q->joinFields1[k] : q->joinFields2[k], right);
+                if (left_col >= 0 && right_col >= 0
+                    && right->fieldsName[right_col][0] == '_') {
+                    ++num_joins[std::make_pair(
+                                    TableCol(left, left_col),
+                                    TableCol(right, right_col))];
+                }
+            }
+        }
+    }
+
+    std::map<std::string, double> file_pages;
+    std::map<std::string, double> file_rows;
+
+    std::map<std::string, uint32_t>::const_iterator use_it;
+    for (use_it = num_uses.begin(); use_it != num_uses.end(); ++use_it) {
+        std::map<std::string, Table *>::const_iterator table_it
+            = g_tables.find(use_it->first);
+        if (table_it == g_tables.end()) {
+            continue;
+        }
+        const Table *table = table_it->second;
+        const std::vector<uint32_t> &preset_cols = g_preset_cols[use_it->first];
+        const std::vector<ca::PartStats *> &parts = g_stats[use_it->first];
+
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            for (const ca::PartStats *stats = parts[i]; stats != NULL;
+                 stats = stats->next_) {
+                const Partition &part = table->partitions[stats->part_no_];
+                double num_pages
+                    = (stats->num_pages_ > 0) ? stats->num_pages_ : 1;
+                file_pages[part.fileName] = num_pages;
+                file_rows[part.fileName] = stats->num_distinct_values_[0];
+
+                PreTask task;
+                task.node = part.iNode;
+                task.kind = ca::IOManager::PRETASK_WARM_FILE;
+                task.name = part.fileName;
+                task.type = INT;
+                task.benefit = use_it->second * num_pages;
+                task.cost = num_pages;
+                tasks.push_back(task);
+
+                // one index partition per table on each node
+                for (int k = 1; k < table->nbFields; ++k) {
+                    if (table->fieldsName[k][0] != '_') {
+                        continue;
+                    }
+                    task.kind = ca::IOManager::PRETASK_MIRROR_INDEX;
+                    task.name = use_it->first + "." + table->fieldsName[k];
+                    task.type = table->fieldsType[k];
+                    task.benefit = (use_it->second + preset_cols[k])
+                                   * num_pages;
+                    tasks.push_back(task);
+                }
+            }
+        }
+    }
+
+    std::map<std::pair<TableCol, TableCol>, uint32_t>::const_iterator join_it;
+    for (join_it = num_joins.begin(); join_it != num_joins.end();
+         ++join_it) {
+        const Table *left = join_it->first.first.first;
+        const Table *right = join_it->first.second.first;
+        int left_col = join_it->first.first.second;
+        int right_col = join_it->first.second.second;
+
+        for (int i = 0; i < left->nbPartitions; ++i) {
+            const Partition &left_part = left->partitions[i];
+            for (int j = 0; j < right->nbPartitions; ++j) {
+                const Partition &right_part = right->partitions[j];
+                if (left_part.iNode != right_part.iNode
+                    || !ca::JoinIndex::fitsInMemory(
+                           file_rows[right_part.fileName])) {
+                    continue;
+                }
+                double num_pages = file_pages[left_part.fileName]
+                                   + file_pages[right_part.fileName];
+
+                PreTask task;
+                task.node = left_part.iNode;
+                task.kind = ca::IOManager::PRETASK_JOIN_INDEX;
+                task.name = ca::JoinIndex::getName(
+                                ca::JoinIndex::getKey(left_part.fileName,
+                                                      left_col),
+                                ca::JoinIndex::getKey(right_part.fileName,
+                                                      right_col));
+                task.type = left->fieldsType[left_col];
+                task.benefit = join_it->second * num_pages;
+                task.cost = num_pages;
+                tasks.push_back(task);
+            }
+        }
+    }
+
+    std::sort(tasks.begin(), tasks.end(), morePreTaskBenefit);
+}
+
+// Send the pretreatment tasks of a slave node in priority order, and
+// wait until the slave finishes them or runs out of time.
+// Executed on the master node.
+static void sendPreTasks(const ca::NodeID n, const std::vector<PreTask> *tasks,
+                         const boost::system_time &deadline)
+{
+    using google::protobuf::io::CodedOutputStream;
+
+    // remaining time in milliseconds
+    boost::posix_time::time_duration remaining
+        = deadline - boost::get_system_time();
+    if (remaining.is_negative()) {
+        return;
+    }
+    uint32_t budget = remaining.total_milliseconds();
+
+    // compute a request body size
+    uint32_t num_tasks = 0;
+    uint32_t size = CodedOutputStream::VarintSize32(budget);
+    for (std::size_t i = 0; i < tasks->size(); ++i) {
+        if ((*tasks)[i].node != n) {
+            continue;
+        }
+        ++num_tasks;
+        size += CodedOutputStream::VarintSize32((*tasks)[i].kind);
+        size += CodedOutputStream::VarintSize32((*tasks)[i].name.size())
+                + (*tasks)[i].name.size();
+        size += CodedOutputStream::VarintSize32((*tasks)[i].type);
+    }
+    if (num_tasks == 0) {
+        return;
+    }
+    size += CodedOutputStream::VarintSize32(num_tasks);
+
+    // serialize a request
+    std::vector<uint8_t> buf(1 + 4 + size);
+    uint8_t *target = &buf[0];
+    *target++ = 'W';
+    target = CodedOutputStream::WriteLittleEndian32ToArray(size, target);
+    target = CodedOutputStream::WriteVarint32ToArray(budget, target);
+    target = CodedOutputStream::WriteVarint32ToArray(num_tasks, target);
+    for (std::size_t i = 0; i < tasks->size(); ++i) {
+        if ((*tasks)[i].node != n) {
+            continue;
+        }
+        target = CodedOutputStream::WriteVarint32ToArray(
+                     (*tasks)[i].kind, target);
+        target = CodedOutputStream::WriteVarint32ToArray(
+                     (*tasks)[i].name.size(), target);
+        target = CodedOutputStream::WriteRawToArray(
+                     (*tasks)[i].name.data(), (*tasks)[i].name.size(), target);
+        target = CodedOutputStream::WriteVarint32ToArray(
+                     (*tasks)[i].type, target);
+    }
+
+    ca::tcpsocket_ptr socket
+        = ca::IOManager::instance()->connectSocket(n, g_addrs[n]);
+    boost::asio::write(*socket, boost::asio::buffer(buf));
+
+    // receive a response (number of finished tasks)
+    uint8_t header[4];
+    boost::asio::read(*socket, boost::asio::buffer(header));
+
+    ca::IOManager::instance()->closeSocket(n, socket);
+}
+
+// Run the pretreatment tasks on all nodes in parallel, each node taking
+// its tasks in priority order until the deadline.
+// Called by startPreTreatmentMaster().
+static void runPreTasks(const int nbNodes, const std::vector<PreTask> &tasks,
+                        const boost::system_time &deadline)
+{
+    boost::thread_group threads;
+    for (int n = 1; n < nbNodes; ++n) {
+        threads.create_thread(
+            boost::bind(&sendPreTasks, n, &tasks, deadline));
+    }
+
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+        if (tasks[i].node != MASTER_NODE_ID) {
+            continue;
+        }
+        if (!ca::IOManager::instance()->runPreTask(
+                 tasks[i].kind, tasks[i].name, tasks[i].type, deadline)
+            && boost::get_system_time() >= deadline) {
+            break;
+        }
+    }
+
+    threads.join_all();
+}
+
+// Gather all partition statistics, find replicas, and build query plans
+// for the preset queries. Column stores are built for all partitions
+// within a fraction of the given time, and the rest of the time goes to
+// warming up the partitions and indexes used by the preset queries.
 void startPreTreatmentMaster(int nbSeconds, const Nodes *nodes,
                              const Data *data, const Queries *preset)
 {
+    boost::system_time start_time = boost::get_system_time();
+    g_store_deadline
+        = start_time
+          + boost::posix_time::milliseconds(
+                static_cast<int64_t>(nbSeconds * 1000 * STORE_TIME_FRACTION));
+    countPresetRestrictions(data, preset);
+
     g_addrs = new boost::asio::ip::address_v4[nodes->nbNodes];
 
     for (int n = 0; n < nodes->nbNodes; ++n) {
@@ -1020,6 +2050,39 @@ void startPreTreatmentMaster(int nbSeconds, const Nodes *nodes,
 
             ca::PartStats *stats = new ca::PartStats(table, j);
 
+            // a fence index replaces the mirror of the primary key index
+            bool has_fence
+                = table->fieldsName[0][0] == '_'
+                  && ca::IOManager::instance()->buildFenceIndex(
+                         table->partitions[j].fileName,
+                         table->fieldsType[0],
+                         (table->nbFields > 1) ? '|' : '\n',
+                         g_store_deadline);
+
+            for (int k = has_fence ? 1 : 0; k < table->nbFields; ++k) {
+                if (table->fieldsName[k][0] == '_') {
+                    ca::IOManager::instance()->buildIndexMirror(
+                        table_name + "." + table->fieldsName[k],
+                        table->fieldsType[k], g_store_deadline);
+                }
+            }
+
+            // columns restricted or joined without an index
+            for (int k = 0; k < table->nbFields; ++k) {
+                if (g_preset_index_cols[table_name][k]) {
+                    stats->column_indexes_[k]
+                        = ca::IOManager::instance()->buildColumnIndex(
+                              table->partitions[j].fileName, k,
+                              table->fieldsType[k], g_store_deadline);
+                }
+            }
+
+            std::vector<ValueType> types(table->fieldsType,
+                                         table->fieldsType + table->nbFields);
+            ca::ColumnStore::build(table->partitions[j].fileName, types,
+                                   g_preset_cols[table_name], stats,
+                                   g_store_deadline);
+
             boost::mutex::scoped_lock lock(g_stats_mutex);
             g_stats[table_name].push_back(stats);
         }
@@ -1056,6 +2119,20 @@ void startPreTreatmentMaster(int nbSeconds, const Nodes *nodes,
 
         table_it->second.resize(++unique_part_it - table_it->second.begin());
     }
+
+    // build plan templates for the preset queries
+    for (int i = 0; i < preset->nbQueries; ++i) {
+        setValueLengths(&preset->queries[i]);
+        getQueryPlan(&preset->queries[i]);
+    }
+
+    // spend the remaining time on the most beneficial pretreatment tasks
+    std::vector<PreTask> tasks;
+    collectPreTasks(preset, tasks);
+    runPreTasks(nodes->nbNodes, tasks,
+                start_time
+                + boost::posix_time::milliseconds(static_cast<int64_t>(
+                      nbSeconds * 1000 * PRETREATMENT_TIME_FRACTION)));
 }
 
 void startSlave(const Node *masterNode, const Node *currentNode)
@@ -1070,7 +2147,6 @@ void startSlave(const Node *masterNode, const Node *currentNode)
 Connection *createConnection()
 {
     Connection *conn = new Connection();
-    conn->tuple.reserve(10);
     conn->output_col_ids.reserve(10);
     conn->value_types.reserve(10);
     return conn;
@@ -1081,24 +2157,73 @@ void closeConnection(Connection *conn)
     delete conn;
 }
 
-void performQuery(Connection *conn, const Query *q)
+// Append a fetched row to the result being recorded.
+// Recording stops if the result grows beyond RESULT_MAX_SIZE.
+static void recordRow(Connection *conn, const Value *values)
 {
-    // for string values, set intVal as length
-    for (int j = 0; j < q->nbRestrictionsEqual; ++j) {
-        Value *v = &q->restrictionEqualValues[j];
-        if (v->type == STRING) {
-            v->intVal = std::strlen(v->charVal);
+    for (int i = 0; i < conn->q->nbOutputFields; ++i) {
+        if (values[i].type == INT) {
+            conn->result_rows.append(
+                reinterpret_cast<const char *>(&values[i].intVal), 4);
+        } else {  // STRING
+            uint16_t len = std::strlen(values[i].charVal);
+            conn->result_rows.append(reinterpret_cast<const char *>(&len), 2);
+            conn->result_rows.append(values[i].charVal, len);
         }
     }
-    for (int j = 0; j < q->nbRestrictionsGreaterThan; ++j) {
-        Value *v = &q->restrictionGreaterThanValues[j];
-        if (v->type == STRING) {
-            v->intVal = std::strlen(v->charVal);
+
+    if (conn->result_rows.size() > RESULT_MAX_SIZE) {
+        conn->result_key.clear();
+        std::string().swap(conn->result_rows);
+    }
+}
+
+// Replay a row of a cached result.
+static ErrCode fetchCachedRow(Connection *conn, Value *values)
+{
+    const std::string &rows = conn->cached->rows;
+    if (conn->cached_pos == rows.size()) {
+        conn->cached.reset();
+        return DB_END;
+    }
+
+    for (int i = 0; i < conn->q->nbOutputFields; ++i) {
+        if (!conn->cached->value_types[i]) {  // INT
+            values[i].type = INT;
+            std::memcpy(&values[i].intVal, &rows[conn->cached_pos], 4);
+            conn->cached_pos += 4;
+        } else {  // STRING
+            uint16_t len;
+            std::memcpy(&len, &rows[conn->cached_pos], 2);
+            values[i].type = STRING;
+            std::memcpy(values[i].charVal, &rows[conn->cached_pos + 2], len);
+            values[i].charVal[len] = '\0';
+            conn->cached_pos += 2 + len;
         }
     }
 
-    conn->root = buildQueryPlan(q);
+    return SUCCESS;
+}
+
+// Data do not change during the workload, so the result of a query is
+// replayed from the cache if an identical query has been executed.
+// Otherwise, the result is recorded while being fetched.
+void performQuery(Connection *conn, const Query *q)
+{
+    setValueLengths(q);
+
     conn->q = q;
+    conn->start_time = boost::get_system_time();
+    conn->result_key = buildResultKey(q);
+    conn->result_rows.clear();
+    conn->cached = findResult(conn->result_key);
+    if (conn->cached) {
+        conn->cached_pos = 0;
+        conn->root.reset();
+        return;
+    }
+
+    conn->root = getQueryPlan(q);
     conn->output_col_ids.clear();
     conn->value_types.clear();
 
@@ -1109,30 +2234,54 @@ void performQuery(Connection *conn, const Query *q)
             conn->root->getColType(q->outputFields[i]));
     }
 
+    conn->batch.reset(conn->root->numOutputCols());
+    conn->batch_pos = 0;
+    conn->batch_done = false;
+
     conn->root->Open();
 }
 
+// Rows are taken from the batches returned by GetNextBatch(), or from
+// a cached result.
 ErrCode fetchRow(Connection *conn, Value *values)
 {
-    if (conn->root->GetNext(conn->tuple)) {
-        conn->root->Close();
-        return DB_END;
+    if (conn->cached) {
+        return fetchCachedRow(conn, values);
+    }
+
+    while (conn->batch_pos == conn->batch.sel.size()) {
+        if (conn->batch_done) {
+            learnCardinalities(conn->q, conn->root);
+            conn->root->Close();
+            if (!conn->result_key.empty()) {
+                boost::shared_ptr<CachedResult> result(new CachedResult());
+                result->rows.swap(conn->result_rows);
+                result->value_types = conn->value_types;
+                result->cost = (boost::get_system_time() - conn->start_time)
+                               .total_microseconds();
+                admitResult(conn->result_key, result);
+                conn->result_key.clear();
+            }
+            return DB_END;
+        }
+        conn->batch_done = conn->root->GetNextBatch(conn->batch);
+        conn->batch_pos = 0;
     }
 
+    uint32_t row = conn->batch.sel[conn->batch_pos++];
     for (int i = 0; i < conn->q->nbOutputFields; ++i) {
-        ca::ColID cid = conn->output_col_ids[i];
+        const ca::Chunk &value
+            = conn->batch.cols[conn->output_col_ids[i]][row];
         if (!conn->value_types[i]) {  // INT
             values[i].type = INT;
-            values[i].intVal = ca::Operator::parseInt(&conn->tuple[cid]);
+            values[i].intVal = ca::Operator::parseInt(&value);
 #ifdef PRINT_TUPLES
             std::cout << values[i].intVal << "|";
 #endif
         } else {  // STRING
             values[i].type = STRING;
-            std::memcpy(values[i].charVal,
-                        conn->tuple[cid].first,
-                        conn->tuple[cid].second);
-            values[i].charVal[conn->tuple[cid].second] = '\0';
+            std::memcpy(values[i].charVal, value.first, value.second);
+            values[i].charVal[value.second] = '\0';
 #ifdef PRINT_TUPLES
             std::cout << values[i].charVal << "|";
 #endif
@@ -1142,11 +2291,27 @@ ErrCode fetchRow(Connection *conn, Value *values)
     std::cout << std::endl;
 #endif
 
+    if (!conn->result_key.empty()) {
+        recordRow(conn, values);
+    }
+
     return SUCCESS;
 }
 
 void closeProcess()
 {
+    // free plan templates
+    std::map<std::string, PlanTemplate *>::iterator plan_it;
+    for (plan_it = g_plans.begin(); plan_it != g_plans.end(); ++plan_it) {
+        delete plan_it->second;
+    }
+    g_plans.clear();
+
+    // free cached results
+    g_results.clear();
+    g_results_by_density.clear();
+    g_results_size = 0;
+
     // free PartStats objects
     std::map<std::string, std::vector<ca::PartStats *> >::iterator table_it;
     for (table_it = g_stats.begin(); table_it != g_stats.end(); ++table_it) {